@@ -0,0 +1,116 @@
+#include "axis_filter.h"
+#include "hot_path.h"
+
+// Written from USB callbacks, read by the capture IRQ
+volatile enum AxisFilterMode axis_filter_mode = AXIS_FILTER_NONE;
+
+void axis_filter_set_mode(enum AxisFilterMode mode)
+{
+    if (mode >= AXIS_FILTER_NUM_MODES) { return; }
+
+    axis_filter_mode = mode;
+}
+
+enum AxisFilterMode axis_filter_get_mode()
+{
+    return axis_filter_mode;
+}
+
+static inline uint16_t scale_to_16(const struct AxisFilter *filter, uint16_t sample)
+{
+    return filter->wide_samples ? sample : sample << 6;
+}
+
+static void HOT_PATH_FUNC(restart)(struct AxisFilter *filter, uint16_t sample, uint32_t time_us)
+{
+    for (int i = 0; i < AXIS_FILTER_BOX_SIZE; i++)
+    {
+        filter->box[i] = sample;
+    }
+    filter->box_index = 0;
+    filter->box_sum = sample * AXIS_FILTER_BOX_SIZE;
+
+    filter->value_q8 = ((int32_t) scale_to_16(filter, sample)) << 8;
+    filter->speed = 0;
+    filter->last_time_us = time_us;
+
+    filter->mode = axis_filter_mode;
+    filter->primed = true;
+}
+
+static uint16_t HOT_PATH_FUNC(box_update)(struct AxisFilter *filter, uint16_t sample)
+{
+    filter->box_sum += sample - filter->box[filter->box_index];
+    filter->box[filter->box_index] = sample;
+    filter->box_index = (filter->box_index + 1) & (AXIS_FILTER_BOX_SIZE - 1);
+
+    // The sum of N 10-bit samples has log2(N) extra bits of resolution; scale that up to 16 bits.
+    // For N = 8 that's sum << 3; the divide below folds to a shift since N is a power of 2.
+    if (filter->wide_samples) { return filter->box_sum / AXIS_FILTER_BOX_SIZE; }
+    return (filter->box_sum << 6) / AXIS_FILTER_BOX_SIZE;
+}
+
+_Static_assert(ONE_EURO_MAX_CUTOFF_HZ <= UINT32_MAX / 1000000, "cutoff * dt would overflow");
+
+/*
+Exponential smoothing factor for a given cutoff and sample interval,
+alpha = r / (1 + r) with r = 2*pi * cutoff * dt, returned in 16.16 fixed point.
+3373 / 2^17 is 2*pi / 10^6 in 12-bit fixed point, to within 0.01%.
+*/
+static uint32_t HOT_PATH_FUNC(smoothing_factor_q16)(uint32_t cutoff_hz, uint32_t dt_us)
+{
+    // dt is clamped to 1000000 us so cutoff * dt can't overflow after a long gap. At 1 Hz or
+    // more, cutoff * dt already reaches its own 1000000 clamp by then, so alpha is the same.
+    if (dt_us > 1000000) { dt_us = 1000000; }
+    uint32_t cutoff_dt = cutoff_hz * dt_us;
+    if (cutoff_dt > 1000000) { cutoff_dt = 1000000; }
+
+    uint32_t r_q12 = (cutoff_dt * 3373) >> 17;
+    return (r_q12 << 16) / (r_q12 + 4096);
+}
+
+static uint16_t HOT_PATH_FUNC(one_euro_update)(struct AxisFilter *filter, uint16_t sample, uint32_t time_us)
+{
+    // The stick can't actually be read this fast; the clamp just keeps the math in range
+    uint32_t dt_us = time_us - filter->last_time_us;
+    if (dt_us < 100) { dt_us = 100; }
+    filter->last_time_us = time_us;
+
+    int32_t sample_q8 = ((int32_t) scale_to_16(filter, sample)) << 8;
+
+    // Rate of change since the last filtered value, smoothed at a fixed cutoff
+    int32_t speed = ((sample_q8 - filter->value_q8) >> 8) * (int32_t)(1000000 / dt_us);
+    uint32_t alpha_speed = smoothing_factor_q16(ONE_EURO_DERIVATIVE_CUTOFF, dt_us);
+    filter->speed += (int32_t)(((int64_t)(speed - filter->speed) * alpha_speed) >> 16);
+
+    // The faster the stick moves, the higher the cutoff, so motion isn't lagged
+    uint32_t abs_speed = (filter->speed < 0) ? -filter->speed : filter->speed;
+    uint64_t cutoff = ONE_EURO_MIN_CUTOFF_HZ + (((uint64_t) abs_speed * ONE_EURO_BETA_Q16) >> 16);
+    if (cutoff > ONE_EURO_MAX_CUTOFF_HZ) { cutoff = ONE_EURO_MAX_CUTOFF_HZ; }
+
+    uint32_t alpha = smoothing_factor_q16(cutoff, dt_us);
+    filter->value_q8 += (int32_t)(((int64_t)(sample_q8 - filter->value_q8) * alpha) >> 16);
+
+    int32_t value = filter->value_q8 >> 8;
+    if (value < 0) { value = 0; }
+    if (value > 0xffff) { value = 0xffff; }
+    return value;
+}
+
+uint16_t HOT_PATH_FUNC(axis_filter_update)(struct AxisFilter *filter, uint16_t sample, uint32_t time_us)
+{
+    if (!filter->primed || filter->mode != axis_filter_mode)
+    {
+        restart(filter, sample, time_us);
+    }
+
+    switch (filter->mode)
+    {
+        case AXIS_FILTER_BOX:
+            return box_update(filter, sample);
+        case AXIS_FILTER_ONE_EURO:
+            return one_euro_update(filter, sample, time_us);
+        default:
+            return scale_to_16(filter, sample);
+    }
+}
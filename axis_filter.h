@@ -0,0 +1,58 @@
+#ifndef AXIS_FILTER_H
+#define AXIS_FILTER_H
+
+#include "pico/stdlib.h"
+
+
+/*
+Optional smoothing for the X/Y axes, run on every frame captured from the stick.
+Input samples are the stick's raw 10-bit values (16-bit for analog sticks, with
+wide_samples set); output is scaled to 16 bits, so filters that average several
+frames can report the extra resolution (see HIGH_RES_AXES in config.h).
+
+Everything here is integer math, since it runs in the capture IRQ.
+*/
+
+enum AxisFilterMode
+{
+    AXIS_FILTER_NONE        = 0,    // raw samples, just scaled up
+    AXIS_FILTER_BOX         = 1,    // average of the last AXIS_FILTER_BOX_SIZE frames
+    AXIS_FILTER_ONE_EURO    = 2,    // speed-adaptive low-pass: smooth at rest, responsive when moving
+};
+
+#define AXIS_FILTER_NUM_MODES 3
+
+// Must be a power of 2, no larger than 64
+#define AXIS_FILTER_BOX_SIZE 8
+
+// 1-euro tuning. Cutoffs are in Hz. Beta is in Hz per (16-bit unit/second), in 16.16 fixed point.
+#define ONE_EURO_MIN_CUTOFF_HZ      1
+#define ONE_EURO_MAX_CUTOFF_HZ      200
+#define ONE_EURO_DERIVATIVE_CUTOFF  1
+#define ONE_EURO_BETA_Q16           10
+
+
+struct AxisFilter
+{
+    uint16_t box[AXIS_FILTER_BOX_SIZE];
+    uint8_t box_index;
+    uint32_t box_sum;
+
+    int32_t value_q8;       // 1-euro: filtered value, 16-bit scale with 8 fractional bits
+    int32_t speed;          // 1-euro: filtered rate of change, in 16-bit units per second
+    uint32_t last_time_us;
+
+    enum AxisFilterMode mode; // the mode this state belongs to; a mismatch restarts the filter
+    bool primed;
+    bool wide_samples;      // samples are already 16-bit
+};
+
+
+void axis_filter_set_mode(enum AxisFilterMode mode);
+enum AxisFilterMode axis_filter_get_mode();
+
+// Call from the capture path only; returns the filtered value on a 16-bit scale
+uint16_t axis_filter_update(struct AxisFilter *filter, uint16_t sample, uint32_t time_us);
+
+
+#endif //AXIS_FILTER_H
@@ -0,0 +1,74 @@
+#include "button_rules.h"
+
+void button_rules_clear(struct ButtonRules *rules)
+{
+    rules->count = 0;
+    rules->mask = 0;
+}
+
+bool button_rules_add(struct ButtonRules *rules, const struct ButtonRule *rule)
+{
+    if (rules->count >= MAX_BUTTON_RULES) { return false; }
+    if (rule->button_mask == 0) { return false; }
+
+    rules->rules[rules->count++] = *rule;
+    rules->mask |= rule->button_mask;
+
+    return true;
+}
+
+// Replaces the current rule table. Returns how many rules were loaded.
+size_t button_rules_load(struct ButtonRules *rules, const struct ButtonRule *table, size_t count)
+{
+    button_rules_clear(rules);
+
+    size_t loaded = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (button_rules_add(rules, &table[i])) { loaded++; }
+    }
+
+    return loaded;
+}
+
+void button_rules_evaluate(struct ButtonRules *rules, struct EffectPool *pool, uint16_t buttons)
+{
+    uint16_t changed = buttons ^ rules->last_buttons;
+    uint16_t previous = rules->last_buttons;
+    rules->last_buttons = buttons;
+
+    if ((changed & rules->mask) == 0) { return; }
+
+    for (size_t i = 0; i < rules->count; i++)
+    {
+        const struct ButtonRule *rule = &rules->rules[i];
+
+        if ((changed & rule->button_mask) == 0) { continue; }
+
+        bool was_held = (previous & rule->button_mask) == rule->button_mask;
+        bool is_held = (buttons & rule->button_mask) == rule->button_mask;
+        if (was_held == is_held) { continue; }
+
+        bool fire;
+        switch (rule->edge)
+        {
+            case BUTTON_EDGE_RISING:  fire = is_held;  break;
+            case BUTTON_EDGE_FALLING: fire = was_held; break;
+            default:                  fire = true;     break;
+        }
+        if (!fire) { continue; }
+
+        switch (rule->action)
+        {
+            case BUTTON_ACTION_PLAY:
+                effect_pool_start(pool, rule->effect_id);
+                break;
+            case BUTTON_ACTION_PLAY_SOLO:
+                effect_pool_start_solo(pool, rule->effect_id);
+                break;
+            case BUTTON_ACTION_PAUSE:
+                effect_pool_stop(pool, rule->effect_id);
+                break;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef BUTTON_RULES_H
+#define BUTTON_RULES_H
+
+#include "pico/stdlib.h"
+
+#include "effect_pool.h"
+
+
+/*
+A button rule plays, solos, or pauses an effect when a set of buttons is pressed
+or released. Rules run on the Pico itself, so they work even in games that never
+talk to the force-feedback side of the device.
+
+The button mask uses the same bit layout as the buttons in the USB report
+(so with FIRMWARE_SHIFT, shifted buttons are in the upper byte).
+If more than one bit is set in the mask, the rule treats the buttons as a chord:
+it "presses" once all of them are held, and "releases" once any of them is let go.
+
+Effects are named by host effect ID, as PID reports and DIAG_CMD_LOAD_EFFECT use
+them (see effect_pool.h), so a rule survives its effect being paged out. The
+table is loaded at runtime with DIAG_CMD_LOAD_BUTTON_RULES (see diag.h).
+*/
+
+enum ButtonEdge
+{
+    BUTTON_EDGE_RISING,     // buttons pressed
+    BUTTON_EDGE_FALLING,    // buttons released
+    BUTTON_EDGE_BOTH,
+};
+
+enum ButtonAction
+{
+    BUTTON_ACTION_PLAY,
+    BUTTON_ACTION_PLAY_SOLO,
+    BUTTON_ACTION_PAUSE,
+};
+
+struct ButtonRule
+{
+    uint16_t button_mask;
+    enum ButtonEdge edge;
+    enum ButtonAction action;
+    int effect_id;
+};
+
+#define MAX_BUTTON_RULES 16
+
+// One rule table per attached stick
+struct ButtonRules
+{
+    struct ButtonRule rules[MAX_BUTTON_RULES];
+    size_t count;
+
+    // Union of every rule's mask, so most button changes can be dismissed with one AND
+    uint16_t mask;
+
+    // Button state as of the last evaluation
+    uint16_t last_buttons;
+};
+
+
+void button_rules_clear(struct ButtonRules *rules);
+bool button_rules_add(struct ButtonRules *rules, const struct ButtonRule *rule);
+size_t button_rules_load(struct ButtonRules *rules, const struct ButtonRule *table, size_t count);
+
+// Call only when the button word has changed; rules whose buttons didn't change are skipped.
+void button_rules_evaluate(struct ButtonRules *rules, struct EffectPool *pool, uint16_t buttons);
+
+
+#endif //BUTTON_RULES_H
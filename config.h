@@ -14,6 +14,34 @@ These can be configured somewhat, but:
 #define PIN_D1      5
 #define PIN_D2      6
 
+// Number of Sidewinders attached: 1 or 2. The second stick is read with PIO1 and gets
+// MIDI from UART1; it shows up as a second joystick, with its own force feedback,
+// on the same USB device.
+#define NUM_JOYSTICKS 1
+
+/*
+Pins for the second Sidewinder, when NUM_JOYSTICKS is 2. Same rules as above, except:
+  * PIN_MIDI_TX_2 must be 4, 8, or 20. (Other pins aren't supported for UART1 TX.)
+*/
+#define PIN_MIDI_TX_2 8
+#define PIN_TRIGGER_2 9
+#define PIN_CLK_2     10
+#define PIN_D0_2      11
+#define PIN_D1_2      12
+#define PIN_D2_2      13
+
+/*
+If this is defined, the first stick is a legacy analog GamePort joystick rather than a Sidewinder.
+Its axes are timed by PIO, with no force feedback, and it needs its own wiring (see the README):
+  * X1, Y1, X2 and Y2 go to ANALOG_AXES consecutive pins from PIN_ANALOG_AXIS0, each with a
+    capacitor to ground. X2 and Y2 are reported as throttle and twist.
+  * Buttons 1-4 use the PIN_CLK and PIN_D0-D2 pins.
+The stick's PIO block needs one state machine per axis, and each axis takes a DMA channel.
+*/
+// #define ANALOG_JOYSTICK
+#define PIN_ANALOG_AXIS0 14
+#define ANALOG_AXES 4
+
 // Disable the Sidewinder's default auto-center effect.
 #define DISABLE_AUTO_CENTER
 
@@ -26,4 +54,50 @@ These can be configured somewhat, but:
 // acting independently of the others.
 // #define FIRMWARE_SHIFT
 
+// If this is defined, X and Y are reported as 16-bit values instead of the stick's raw 10 bits.
+// This is only useful with an axis filter that averages several frames (see axis_filter.h);
+// the filter can be changed at runtime through a vendor-defined feature report.
+// #define HIGH_RES_AXES
+
+// System clock while USB is active: CLOCK_PROFILE_NORMAL (125 MHz), or CLOCK_PROFILE_TURBO
+// (200 MHz) to shave latency off the capture IRQ and USB handling at the cost of more current.
+// While USB is suspended, the clock always drops to 48 MHz. See power.h.
+#define ACTIVE_CLOCK_PROFILE CLOCK_PROFILE_NORMAL
+
+// How status bytes are sent over MIDI: MIDI_STATUS_ALWAYS sends every one, byte for byte like
+// the Windows driver. MIDI_STATUS_RUNNING leaves out a status byte the stick already has (MIDI
+// running status), which shortens runs of play/pause/erase commands; it's only been checked
+// against the model in tools/, not on a real stick yet. See ffb_midi.h.
+#define MIDI_STATUS_MODE MIDI_STATUS_ALWAYS
+
+// If this is defined, each stick's HID interface has an interrupt OUT endpoint as well as the
+// IN one, so the host sends force-feedback reports on the 1 ms interrupt schedule instead of
+// as SET_REPORT control transfers. Comment it out for hosts that mishandle the OUT endpoint.
+#define HID_OUT_ENDPOINT
+
+// If this is defined, each stick also gets a USB-MIDI interface, for software that drives the
+// stick in its own MIDI dialect instead of through PID. See midi_passthrough.h.
+// #define MIDI_PASSTHROUGH
+
+// If this is defined, the capture IRQ, the report path and the MIDI encoder run from SRAM
+// instead of flash, so XIP cache misses can't add to their latency. Costs a few kB of RAM.
+// See hot_path.h.
+// #define RAM_HOT_PATH
+
+// If this is defined, the adapter exposes an extra vendor-specific USB interface for
+// reading debug data (see diag.h). It's needed for, and turned on by, the options below.
+// #define DIAG_INTERFACE
+
+// If this is defined, timestamped events from the capture IRQ, USB and MIDI are recorded
+// in RAM and can be dumped over the diagnostics interface (see trace.h).
+// #define TRACE_ENABLED
+
+// If this is defined, XIP cache hits and misses, interrupt latency and the time taken by the
+// hot paths are measured, and can be read over the diagnostics interface (see latency_stats.h).
+// #define LATENCY_STATS
+
+#if (defined(TRACE_ENABLED) || defined(LATENCY_STATS)) && !defined(DIAG_INTERFACE)
+#define DIAG_INTERFACE
+#endif
+
 #endif //CONFIG_H
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "hardware/clocks.h"
+
+#include "cpu_load.h"
+#include "hot_path.h"
+
+// Running totals, never reset. Cycle counts wrap, but a window's worth of
+// differences doesn't, as long as a window is shorter than 2^32 cycles.
+volatile uint32_t cpu_busy_cycles[CPU_NUM_SUBSYSTEMS];
+uint32_t cpu_iterations;
+uint32_t cpu_wakeups;
+uint32_t cpu_max_iteration_cycles;
+
+// Totals as of the start of the current window
+uint32_t cpu_window_start_us;
+uint32_t cpu_window_busy_cycles[CPU_NUM_SUBSYSTEMS];
+uint32_t cpu_window_iterations;
+uint32_t cpu_window_wakeups;
+
+struct CpuLoadStats cpu_load_last_window;
+
+void cpu_load_init()
+{
+    // Free-running from clk_sys, no interrupt (but see latency_stats_init())
+    systick_hw->csr = 0;
+    systick_hw->rvr = CPU_LOAD_SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+
+    cpu_window_start_us = time_us_32();
+}
+
+uint32_t HOT_PATH_FUNC(cpu_load_account)(enum CpuSubsystem subsystem, uint32_t start)
+{
+    uint32_t now = cpu_load_mark();
+    cpu_busy_cycles[subsystem] += cpu_load_cycles(start, now);
+    return now;
+}
+
+static void end_window(uint32_t now_us)
+{
+    struct CpuLoadStats *stats = &cpu_load_last_window;
+
+    stats->sys_hz = clock_get_hz(clk_sys);
+    stats->window_us = now_us - cpu_window_start_us;
+    stats->iterations = cpu_iterations - cpu_window_iterations;
+    stats->wakeups = cpu_wakeups - cpu_window_wakeups;
+    stats->max_iteration_cycles = cpu_max_iteration_cycles;
+
+    for (int i = 0; i < CPU_NUM_SUBSYSTEMS; i++)
+    {
+        uint32_t busy = cpu_busy_cycles[i];
+        stats->busy_cycles[i] = busy - cpu_window_busy_cycles[i];
+        cpu_window_busy_cycles[i] = busy;
+    }
+
+    cpu_window_start_us = now_us;
+    cpu_window_iterations = cpu_iterations;
+    cpu_window_wakeups = cpu_wakeups;
+    cpu_max_iteration_cycles = 0;
+}
+
+void cpu_load_end_iteration(uint32_t start, bool will_sleep)
+{
+    uint32_t cycles = cpu_load_cycles(start, cpu_load_mark());
+    if (cycles > cpu_max_iteration_cycles) { cpu_max_iteration_cycles = cycles; }
+
+    cpu_iterations++;
+    if (will_sleep) { cpu_wakeups++; }
+
+    uint32_t now_us = time_us_32();
+    if (now_us - cpu_window_start_us >= CPU_LOAD_WINDOW_MS * 1000) { end_window(now_us); }
+}
+
+const struct CpuLoadStats *cpu_load_get_stats()
+{
+    return &cpu_load_last_window;
+}
@@ -0,0 +1,73 @@
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+#include "pico/stdlib.h"
+#include "hardware/structs/systick.h"
+
+
+/*
+Where the CPU's time goes. Work is timed in clk_sys cycles with SysTick, which is
+cheap to read and fine-grained enough for the many sub-microsecond main-loop passes.
+Whatever isn't accounted to a subsystem is idle time, spent asleep in WFE.
+
+Each measurement includes any interrupts that preempted it, so CPU_FRAME_IRQ time
+is also counted in whichever subsystem it interrupted.
+
+Totals are kept per CPU_LOAD_WINDOW_MS window; the last complete window can be read
+over the diagnostics interface (tools/diag.py cpu).
+*/
+
+enum CpuSubsystem
+{
+    CPU_USB,            // tud_task(), including the HID/PID callbacks and the MIDI they send
+    CPU_HID,            // sending joystick reports
+    CPU_BUTTON_RULES,
+    CPU_CUSTOM_FORCE,   // streaming custom force samples
+    CPU_EFFECT_UPLOAD,  // defining newly created effects on the stick
+    CPU_MIDI_PASSTHROUGH,
+    CPU_DIAG,
+    CPU_POWER,
+    CPU_FRAME_IRQ,      // capture IRQ: decoding and filtering frames
+    CPU_NUM_SUBSYSTEMS
+};
+
+#define CPU_LOAD_WINDOW_MS 1000
+
+// Packed, since it goes over USB as-is
+struct __attribute__((__packed__)) CpuLoadStats
+{
+    uint32_t sys_hz;
+    uint32_t window_us;
+    uint32_t iterations;            // main-loop passes
+    uint32_t wakeups;               // times the main loop slept and woke up again
+    uint32_t max_iteration_cycles;  // longest pass, i.e. the worst delay a new event could see
+    uint32_t busy_cycles[CPU_NUM_SUBSYSTEMS];
+};
+
+
+void cpu_load_init();
+
+#define CPU_LOAD_SYSTICK_MASK 0x00ffffff
+
+// SysTick counts down, and wraps at 24 bits: 134 ms at 125 MHz, more than any one piece of work takes.
+static inline uint32_t cpu_load_mark()
+{
+    return systick_hw->cvr;
+}
+
+// Cycles from one mark to a later one
+static inline uint32_t cpu_load_cycles(uint32_t start, uint32_t end)
+{
+    return (start - end) & CPU_LOAD_SYSTICK_MASK;
+}
+
+// Charge the time since `start` to a subsystem. Returns a new mark, so calls can be chained.
+uint32_t cpu_load_account(enum CpuSubsystem subsystem, uint32_t start);
+
+// Call at the end of each main-loop pass, before sleeping, with the mark from the start of the pass
+void cpu_load_end_iteration(uint32_t start, bool will_sleep);
+
+const struct CpuLoadStats *cpu_load_get_stats();
+
+
+#endif //CPU_LOAD_H
@@ -0,0 +1,204 @@
+#include <string.h>
+
+#include "custom_force.h"
+#include "hot_path.h"
+
+void custom_force_init(struct CustomForcePlayer *player, struct EffectPool *pool)
+{
+    memset(player, 0, sizeof(*player));
+    player->pool = pool;
+}
+
+static struct CustomForceEffect *get_custom_force(struct CustomForcePlayer *player, int effect_id)
+{
+    if (effect_id <= 0) { return NULL; }
+
+    for (int i = 0; i < CUSTOM_FORCE_SLOTS; i++)
+    {
+        if (player->effects[i].effect_id == effect_id) { return &player->effects[i]; }
+    }
+
+    return NULL;
+}
+
+bool custom_force_slot_available(struct CustomForcePlayer *player)
+{
+    for (int i = 0; i < CUSTOM_FORCE_SLOTS; i++)
+    {
+        if (player->effects[i].effect_id == 0) { return true; }
+    }
+
+    return false;
+}
+
+void custom_force_attach(struct CustomForcePlayer *player, int effect_id)
+{
+    for (int i = 0; i < CUSTOM_FORCE_SLOTS; i++)
+    {
+        struct CustomForceEffect *e = &player->effects[i];
+        if (e->effect_id != 0) { continue; }
+
+        memset(e, 0, sizeof(*e));
+        e->effect_id = effect_id;
+        e->sample_period_us = CUSTOM_FORCE_DEFAULT_PERIOD_US;
+        player->download_id = effect_id;
+        return;
+    }
+}
+
+void custom_force_detach(struct CustomForcePlayer *player, int effect_id)
+{
+    struct CustomForceEffect *e = get_custom_force(player, effect_id);
+    if (e == NULL) { return; }
+
+    e->effect_id = 0;
+    e->playing = false;
+    if (player->download_id == effect_id) { player->download_id = 0; }
+}
+
+void custom_force_set_timing(struct CustomForcePlayer *player, int effect_id,
+        uint16_t sample_period_ms, uint16_t duration_ms)
+{
+    struct CustomForceEffect *e = get_custom_force(player, effect_id);
+    if (e == NULL) { return; }
+
+    e->sample_period_us = (sample_period_ms == 0) ? CUSTOM_FORCE_DEFAULT_PERIOD_US : sample_period_ms * 1000u;
+    e->duration_us = (duration_ms == 0xffff) ? 0 : duration_ms * 1000u;
+}
+
+void custom_force_set_sample_count(struct CustomForcePlayer *player, int effect_id, uint16_t count)
+{
+    struct CustomForceEffect *e = get_custom_force(player, effect_id);
+    if (e == NULL) { return; }
+
+    if (count > CUSTOM_FORCE_MAX_SAMPLES) { count = CUSTOM_FORCE_MAX_SAMPLES; }
+    e->sample_count = count;
+    e->count_set = true;
+    e->download_pos = 0;
+}
+
+void custom_force_write(struct CustomForcePlayer *player, int effect_id,
+        uint16_t offset, const int8_t *samples, size_t count)
+{
+    struct CustomForceEffect *e = get_custom_force(player, effect_id);
+    if (e == NULL || offset >= CUSTOM_FORCE_MAX_SAMPLES) { return; }
+
+    if (count > CUSTOM_FORCE_MAX_SAMPLES - offset) { count = CUSTOM_FORCE_MAX_SAMPLES - offset; }
+    memcpy(&e->samples[offset], samples, count);
+
+    // Without a Set Custom Force, the data itself says how long the effect is
+    if (!e->count_set && offset + count > e->sample_count) { e->sample_count = offset + count; }
+}
+
+void custom_force_download_sample(struct CustomForcePlayer *player, int8_t sample)
+{
+    struct CustomForceEffect *e = get_custom_force(player, player->download_id);
+    if (e == NULL) { return; }
+
+    uint16_t limit = (e->count_set && e->sample_count > 0) ? e->sample_count : CUSTOM_FORCE_MAX_SAMPLES;
+    if (e->download_pos >= limit) { e->download_pos = 0; }
+
+    e->samples[e->download_pos++] = sample;
+    if (!e->count_set && e->download_pos > e->sample_count) { e->sample_count = e->download_pos; }
+}
+
+static void HOT_PATH_FUNC(send_sample)(struct CustomForcePlayer *player, struct CustomForceEffect *e, int8_t sample)
+{
+    // Same scaling as Set Constant Force: the stick takes the magnitude's low byte
+    effect_pool_modify(player->pool, e->effect_id, MODIFY_AMPLITUDE, (uint8_t) sample);
+    e->last_sent = sample;
+    e->stats.samples_sent++;
+}
+
+// Send the sample that's due now, if any. Returns false if it had to wait for the MIDI link.
+static bool HOT_PATH_FUNC(play_due)(struct CustomForcePlayer *player, struct CustomForceEffect *e, uint64_t now, bool force)
+{
+    uint64_t elapsed_us = now - e->start_us;
+
+    if (e->duration_us != 0 && elapsed_us >= e->duration_us)
+    {
+        // The stick stops the effect by itself; we just stop feeding it.
+        e->playing = false;
+        return true;
+    }
+
+    uint64_t number = elapsed_us / e->sample_period_us;
+    if (number < e->next_number || e->sample_count == 0) { return true; }
+
+    int8_t sample = e->samples[number % e->sample_count];
+
+    if (sample != e->last_sent || force)
+    {
+        if (!force && ffb_midi_tx_backlog_us(player->pool->midi) > CUSTOM_FORCE_MAX_BACKLOG_US) { return false; }
+        send_sample(player, e, sample);
+    }
+
+    e->stats.samples_skipped += number - e->next_number;
+    e->next_number = number + 1;
+
+    return true;
+}
+
+void custom_force_start(struct CustomForcePlayer *player, int effect_id)
+{
+    struct CustomForceEffect *e = get_custom_force(player, effect_id);
+    if (e == NULL) { return; }
+
+    e->playing = true;
+    e->start_us = time_us_64();
+    e->next_number = 0;
+
+    // Get the first sample in before the effect starts, so it doesn't begin at a stale amplitude
+    play_due(player, e, e->start_us, true);
+}
+
+void custom_force_stop(struct CustomForcePlayer *player, int effect_id)
+{
+    struct CustomForceEffect *e = get_custom_force(player, effect_id);
+    if (e != NULL) { e->playing = false; }
+}
+
+void custom_force_stop_all(struct CustomForcePlayer *player)
+{
+    for (int i = 0; i < CUSTOM_FORCE_SLOTS; i++)
+    {
+        player->effects[i].playing = false;
+    }
+}
+
+void HOT_PATH_FUNC(custom_force_task)(struct CustomForcePlayer *player)
+{
+    uint64_t now = time_us_64();
+
+    for (int i = 0; i < CUSTOM_FORCE_SLOTS; i++)
+    {
+        struct CustomForceEffect *e = &player->effects[i];
+        if (e->playing) { play_due(player, e, now, false); }
+    }
+}
+
+absolute_time_t custom_force_get_wake_deadline(struct CustomForcePlayer *player)
+{
+    uint64_t now = time_us_64();
+    uint32_t backlog_us = ffb_midi_tx_backlog_us(player->pool->midi);
+    uint32_t wait_us = UINT32_MAX;
+
+    for (int i = 0; i < CUSTOM_FORCE_SLOTS; i++)
+    {
+        struct CustomForceEffect *e = &player->effects[i];
+        if (!e->playing) { continue; }
+
+        int64_t until_due = (int64_t) (e->start_us + e->next_number * e->sample_period_us - now);
+        uint32_t effect_wait = (until_due > 0) ? (uint32_t) until_due : 0;
+
+        // A due sample held back by a busy link is worth retrying once the backlog drains
+        if (backlog_us > CUSTOM_FORCE_MAX_BACKLOG_US && effect_wait < backlog_us - CUSTOM_FORCE_MAX_BACKLOG_US)
+        {
+            effect_wait = backlog_us - CUSTOM_FORCE_MAX_BACKLOG_US;
+        }
+
+        if (effect_wait < wait_us) { wait_us = effect_wait; }
+    }
+
+    return (wait_us == UINT32_MAX) ? at_the_end_of_time : make_timeout_time_us(wait_us);
+}
@@ -0,0 +1,92 @@
+#ifndef CUSTOM_FORCE_H
+#define CUSTOM_FORCE_H
+
+#include "pico/stdlib.h"
+
+#include "effect_pool.h"
+
+
+/*
+PID Custom Force effects. The stick has no custom force of its own, so the host's
+samples are kept in Pico RAM and played back as a constant force whose amplitude
+is updated once per sample period, along the effect's direction.
+
+Every amplitude update is a 6-byte MIDI modify, almost 2 ms on the wire. A short
+sample period (or several custom forces at once) can ask for more than the link
+carries, so a sample is skipped whenever the UART is already backed up by more
+than CUSTOM_FORCE_MAX_BACKLOG_US. Playback is indexed by time, not by samples
+sent, so skipping lowers the effective update rate without stretching the effect.
+*/
+
+#define CUSTOM_FORCE_SLOTS          4   // custom forces that can exist at once
+#define CUSTOM_FORCE_MAX_SAMPLES    512 // per custom force
+#define CUSTOM_FORCE_DATA_SIZE      12  // samples per Custom Force Data report
+
+#define CUSTOM_FORCE_DEFAULT_PERIOD_US  10000
+#define CUSTOM_FORCE_MAX_BACKLOG_US     2000
+
+
+struct CustomForceStats
+{
+    uint32_t samples_sent;
+    uint32_t samples_skipped;   // due, but the MIDI link was too busy
+};
+
+struct CustomForceEffect
+{
+    int effect_id;              // pool effect ID, or 0 if the slot is free
+    int8_t samples[CUSTOM_FORCE_MAX_SAMPLES];
+    uint16_t sample_count;
+    uint32_t sample_period_us;
+    uint32_t duration_us;       // 0 = infinite
+
+    bool count_set;             // by Set Custom Force; otherwise downloads grow sample_count
+    uint16_t download_pos;      // next sample Download Force Sample writes
+
+    bool playing;
+    uint64_t start_us;          // 64-bit, so an infinite effect keeps playing past the 32-bit clock's wrap
+    uint64_t next_number;       // samples since start, so skips can be counted across loops
+    int8_t last_sent;           // so repeated samples cost nothing
+
+    struct CustomForceStats stats;
+};
+
+// One per attached stick
+struct CustomForcePlayer
+{
+    struct EffectPool *pool;
+    struct CustomForceEffect effects[CUSTOM_FORCE_SLOTS];
+    int download_id;            // where Download Force Sample goes: the newest custom force
+};
+
+
+void custom_force_init(struct CustomForcePlayer *player, struct EffectPool *pool);
+
+bool custom_force_slot_available(struct CustomForcePlayer *player);
+void custom_force_attach(struct CustomForcePlayer *player, int effect_id);
+void custom_force_detach(struct CustomForcePlayer *player, int effect_id);
+
+// Sample period and duration come from Set Effect, in ms; 0xffff duration is infinite.
+void custom_force_set_timing(struct CustomForcePlayer *player, int effect_id,
+        uint16_t sample_period_ms, uint16_t duration_ms);
+void custom_force_set_sample_count(struct CustomForcePlayer *player, int effect_id, uint16_t count);
+void custom_force_write(struct CustomForcePlayer *player, int effect_id,
+        uint16_t offset, const int8_t *samples, size_t count);
+
+// Download Force Sample doesn't name an effect, so it goes to the most recently created custom force.
+// Samples go into a ring: it wraps at the Set Custom Force sample count if one was given,
+// otherwise it grows to CUSTOM_FORCE_MAX_SAMPLES first.
+void custom_force_download_sample(struct CustomForcePlayer *player, int8_t sample);
+
+void custom_force_start(struct CustomForcePlayer *player, int effect_id);
+void custom_force_stop(struct CustomForcePlayer *player, int effect_id);
+void custom_force_stop_all(struct CustomForcePlayer *player);
+
+// Call from the main loop; sends whichever samples have come due
+void custom_force_task(struct CustomForcePlayer *player);
+
+// When custom_force_task() next has something to do
+absolute_time_t custom_force_get_wake_deadline(struct CustomForcePlayer *player);
+
+
+#endif //CUSTOM_FORCE_H
@@ -0,0 +1,270 @@
+#include <string.h>
+
+#include "tusb.h"
+
+#include "diag.h"
+#include "trace.h"
+#include "power.h"
+#include "cpu_load.h"
+#include "latency_stats.h"
+#include "sched.h"
+
+#ifdef DIAG_INTERFACE
+
+#ifdef TRACE_ENABLED
+#define DIAG_TRACE_PAYLOAD (sizeof(struct DiagTraceInfo) + TRACE_NUM_CONTEXTS * TRACE_RING_SIZE * sizeof(struct TraceRecord))
+#else
+#define DIAG_TRACE_PAYLOAD 0
+#endif
+
+// Every other reply is a small stats struct
+#define DIAG_STATS_PAYLOAD 256
+_Static_assert(sizeof(struct PowerStats) <= DIAG_STATS_PAYLOAD, "PowerStats too big for a diag reply");
+_Static_assert(sizeof(struct CpuLoadStats) <= DIAG_STATS_PAYLOAD, "CpuLoadStats too big for a diag reply");
+_Static_assert(sizeof(struct LatencyStats) <= DIAG_STATS_PAYLOAD, "LatencyStats too big for a diag reply");
+_Static_assert(sizeof(struct SchedStats) <= DIAG_STATS_PAYLOAD, "SchedStats too big for a diag reply");
+
+_Static_assert(sizeof(struct DiagEffectLoadResult) <= DIAG_STATS_PAYLOAD, "DiagEffectLoadResult too big for a diag reply");
+_Static_assert(sizeof(struct DiagButtonRulesLoadResult) <= DIAG_STATS_PAYLOAD, "DiagButtonRulesLoadResult too big for a diag reply");
+
+#define DIAG_MAX_PAYLOAD (DIAG_TRACE_PAYLOAD > DIAG_STATS_PAYLOAD ? DIAG_TRACE_PAYLOAD : DIAG_STATS_PAYLOAD)
+
+// A reply is built all at once, then trickled out as the endpoint has room
+uint8_t diag_tx_buffer[sizeof(struct DiagResponseHeader) + DIAG_MAX_PAYLOAD];
+uint32_t diag_tx_size = 0;
+uint32_t diag_tx_sent = 0;
+
+// A command and its arguments, which may arrive over more than one pass
+#define DIAG_MAX_ARGS (sizeof(struct DiagButtonRulesLoad) > sizeof(struct DiagEffectLoad) \
+        ? sizeof(struct DiagButtonRulesLoad) : sizeof(struct DiagEffectLoad))
+uint8_t diag_rx_buffer[1 + DIAG_MAX_ARGS];
+uint32_t diag_rx_size = 0;
+
+struct EffectPool *diag_effect_pools[NUM_JOYSTICKS];
+
+void diag_set_effect_pool(uint8_t stick, struct EffectPool *pool)
+{
+    if (stick < NUM_JOYSTICKS) { diag_effect_pools[stick] = pool; }
+}
+
+struct ButtonRules *diag_button_rules[NUM_JOYSTICKS];
+
+void diag_set_button_rules(uint8_t stick, struct ButtonRules *rules)
+{
+    if (stick < NUM_JOYSTICKS) { diag_button_rules[stick] = rules; }
+}
+
+static uint32_t command_size(uint8_t command)
+{
+    switch (command)
+    {
+        case DIAG_CMD_LOAD_EFFECT:          return 1 + sizeof(struct DiagEffectLoad);
+        case DIAG_CMD_LOAD_BUTTON_RULES:    return 1 + sizeof(struct DiagButtonRulesLoad);
+    }
+
+    return 1;
+}
+
+static uint8_t *begin_response(uint8_t command)
+{
+    struct DiagResponseHeader *header = (struct DiagResponseHeader *) diag_tx_buffer;
+    *header = (struct DiagResponseHeader) { .command = command, .status = DIAG_STATUS_OK };
+
+    return diag_tx_buffer + sizeof(*header);
+}
+
+static void finish_response(uint8_t status, uint32_t length)
+{
+    struct DiagResponseHeader *header = (struct DiagResponseHeader *) diag_tx_buffer;
+    header->status = status;
+    header->length = length;
+
+    diag_tx_size = sizeof(*header) + length;
+    diag_tx_sent = 0;
+}
+
+#ifdef TRACE_ENABLED
+static uint32_t build_trace_dump(uint8_t *payload)
+{
+    struct DiagTraceInfo *info = (struct DiagTraceInfo *) payload;
+    struct TraceRecord *records = (struct TraceRecord *) (payload + sizeof(*info));
+
+    info->now_us = time_us_32();
+    info->record_size = sizeof(struct TraceRecord);
+    info->count = trace_snapshot(records, TRACE_NUM_CONTEXTS * TRACE_RING_SIZE);
+
+    return sizeof(*info) + info->count * sizeof(struct TraceRecord);
+}
+#endif
+
+static bool known_effect_type(uint8_t type)
+{
+    switch (type)
+    {
+        case MIDI_ET_SINE:
+        case MIDI_ET_SQUARE:
+        case MIDI_ET_RAMP:
+        case MIDI_ET_TRIANGLE:
+        case MIDI_ET_SAWTOOTHDOWN:
+        case MIDI_ET_SAWTOOTHUP:
+        case MIDI_ET_SPRING:
+        case MIDI_ET_DAMPER:
+        case MIDI_ET_INERTIA:
+        case MIDI_ET_FRICTION:
+        case MIDI_ET_CONSTANT:
+            return true;
+    }
+
+    return false;
+}
+
+static uint8_t load_effect(const struct DiagEffectLoad *load, struct DiagEffectLoadResult *result)
+{
+    if (load->stick >= NUM_JOYSTICKS || diag_effect_pools[load->stick] == NULL) { return DIAG_STATUS_INVALID; }
+    if (!known_effect_type(load->type)) { return DIAG_STATUS_INVALID; }
+
+    struct EffectPool *pool = diag_effect_pools[load->stick];
+    struct Effect effect = {
+        .type = load->type,
+        .duration = load->duration,
+        .button_mask = load->button_mask,
+        .direction = load->direction,
+        .gain = load->gain,
+        .sample_rate = load->sample_rate,
+        .attack_level = load->attack_level,
+        .sustain_level = load->sustain_level,
+        .fade_level = load->fade_level,
+        .attack_time = load->attack_time,
+        .fade_time = load->fade_time,
+        .frequency = load->frequency,
+        .amplitude = load->amplitude,
+        .strength_x = load->strength_x,
+        .strength_y = load->strength_y,
+        .offset_x = load->offset_x,
+        .offset_y = load->offset_y,
+    };
+
+    int effect_id = effect_pool_load(pool, &effect);
+    if (effect_id > 0)
+    {
+        if (load->type == MIDI_ET_RAMP) { effect_pool_modify(pool, effect_id, MODIFY_RAMP_END, load->ramp_end); }
+        if (load->start) { effect_pool_start(pool, effect_id); }
+    }
+
+    *result = (struct DiagEffectLoadResult) {
+        .effect_id = (effect_id > 0) ? effect_id : 0,
+        .load_status = (effect_id > 0) ? DIAG_LOAD_SUCCESS : DIAG_LOAD_FULL,
+        .num_available = effect_pool_get_num_available_effects(pool),
+    };
+
+    return DIAG_STATUS_OK;
+}
+
+static uint8_t load_button_rules(const struct DiagButtonRulesLoad *load, struct DiagButtonRulesLoadResult *result)
+{
+    if (load->stick >= NUM_JOYSTICKS || diag_button_rules[load->stick] == NULL) { return DIAG_STATUS_INVALID; }
+    if (load->count > MAX_BUTTON_RULES) { return DIAG_STATUS_INVALID; }
+
+    // Check the whole table first, so a bad one leaves the current rules alone
+    struct ButtonRule table[MAX_BUTTON_RULES];
+    for (int i = 0; i < load->count; i++)
+    {
+        const struct DiagButtonRule *rule = &load->rules[i];
+        if (rule->edge > BUTTON_EDGE_BOTH || rule->action > BUTTON_ACTION_PAUSE) { return DIAG_STATUS_INVALID; }
+        if (rule->effect_id < 1 || rule->effect_id > VIRTUAL_EFFECT_COUNT) { return DIAG_STATUS_INVALID; }
+
+        table[i] = (struct ButtonRule) {
+            .button_mask = rule->button_mask,
+            .edge = rule->edge,
+            .action = rule->action,
+            .effect_id = rule->effect_id,
+        };
+    }
+
+    result->loaded = button_rules_load(diag_button_rules[load->stick], table, load->count);
+    return DIAG_STATUS_OK;
+}
+
+static void handle_command(uint8_t command, const uint8_t *args)
+{
+    uint8_t *payload = begin_response(command);
+
+    switch (command)
+    {
+#ifdef TRACE_ENABLED
+        case DIAG_CMD_TRACE_DUMP:
+            finish_response(DIAG_STATUS_OK, build_trace_dump(payload));
+            return;
+#endif
+
+        case DIAG_CMD_POWER_STATS:
+            memcpy(payload, power_get_stats(), sizeof(struct PowerStats));
+            finish_response(DIAG_STATUS_OK, sizeof(struct PowerStats));
+            return;
+
+        case DIAG_CMD_CPU_LOAD:
+            memcpy(payload, cpu_load_get_stats(), sizeof(struct CpuLoadStats));
+            finish_response(DIAG_STATUS_OK, sizeof(struct CpuLoadStats));
+            return;
+
+        case DIAG_CMD_SCHED_STATS:
+            memcpy(payload, sched_get_stats(), sizeof(struct SchedStats));
+            finish_response(DIAG_STATUS_OK, sizeof(struct SchedStats));
+            return;
+
+        case DIAG_CMD_LOAD_EFFECT:
+        {
+            uint8_t status = load_effect((const struct DiagEffectLoad *) args, (struct DiagEffectLoadResult *) payload);
+            finish_response(status, (status == DIAG_STATUS_OK) ? sizeof(struct DiagEffectLoadResult) : 0);
+            return;
+        }
+
+        case DIAG_CMD_LOAD_BUTTON_RULES:
+        {
+            uint8_t status = load_button_rules((const struct DiagButtonRulesLoad *) args,
+                    (struct DiagButtonRulesLoadResult *) payload);
+            finish_response(status, (status == DIAG_STATUS_OK) ? sizeof(struct DiagButtonRulesLoadResult) : 0);
+            return;
+        }
+
+#ifdef LATENCY_STATS
+        case DIAG_CMD_LATENCY_STATS:
+            memcpy(payload, latency_stats_take(), sizeof(struct LatencyStats));
+            finish_response(DIAG_STATUS_OK, sizeof(struct LatencyStats));
+            return;
+#endif
+    }
+
+    finish_response(DIAG_STATUS_UNSUPPORTED, 0);
+}
+
+void diag_task()
+{
+    if (!tud_vendor_mounted()) { return; }
+
+    // Finish the current reply before taking another command
+    if (diag_tx_sent < diag_tx_size)
+    {
+        diag_tx_sent += tud_vendor_write(diag_tx_buffer + diag_tx_sent, diag_tx_size - diag_tx_sent);
+        tud_vendor_write_flush();
+        return;
+    }
+
+    if (diag_rx_size == 0)
+    {
+        if (!tud_vendor_available() || tud_vendor_read(diag_rx_buffer, 1) != 1) { return; }
+        diag_rx_size = 1;
+    }
+
+    uint32_t size = command_size(diag_rx_buffer[0]);
+    if (diag_rx_size < size)
+    {
+        diag_rx_size += tud_vendor_read(diag_rx_buffer + diag_rx_size, size - diag_rx_size);
+        if (diag_rx_size < size) { return; }
+    }
+
+    diag_rx_size = 0;
+    handle_command(diag_rx_buffer[0], diag_rx_buffer + 1);
+}
+
+#endif // DIAG_INTERFACE
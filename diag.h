@@ -0,0 +1,136 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "effect_pool.h"
+#include "button_rules.h"
+
+
+/*
+The diagnostics interface is a vendor-specific USB interface, separate from the
+joysticks, for pulling debug data off a running adapter without disturbing games.
+The host writes a one-byte command to the OUT endpoint; the reply comes back on
+the IN endpoint as a DiagResponseHeader followed by `length` bytes of payload.
+DIAG_CMD_LOAD_EFFECT and DIAG_CMD_LOAD_BUTTON_RULES are followed by their
+arguments in the same write.
+*/
+
+#define DIAG_CMD_TRACE_DUMP     0x01    // payload: DiagTraceInfo, then `count` TraceRecords (see trace.h)
+#define DIAG_CMD_POWER_STATS    0x02    // payload: PowerStats (see power.h)
+#define DIAG_CMD_CPU_LOAD       0x03    // payload: CpuLoadStats (see cpu_load.h)
+#define DIAG_CMD_LATENCY_STATS  0x04    // payload: LatencyStats (see latency_stats.h)
+#define DIAG_CMD_SCHED_STATS    0x05    // payload: SchedStats (see sched.h)
+#define DIAG_CMD_LOAD_EFFECT    0x06    // arguments: DiagEffectLoad; payload: DiagEffectLoadResult
+#define DIAG_CMD_LOAD_BUTTON_RULES 0x07 // arguments: DiagButtonRulesLoad; payload: DiagButtonRulesLoadResult
+
+#define DIAG_STATUS_OK          0
+#define DIAG_STATUS_UNSUPPORTED 1       // unknown command, or not enabled in this build
+#define DIAG_STATUS_INVALID     2       // arguments out of range
+
+struct __attribute__((__packed__)) DiagResponseHeader
+{
+    uint8_t command;
+    uint8_t status;
+    uint16_t reserved;
+    uint32_t length;
+};
+
+struct __attribute__((__packed__)) DiagTraceInfo
+{
+    uint32_t now_us;        // when the dump was taken, for unwrapping record times
+    uint16_t record_size;
+    uint16_t count;
+};
+
+/*
+A whole effect in one request, for our own software: what PID spreads over
+Create New Effect, Block Load, Set Effect, an envelope and a type-specific
+report, then Effect Operation. It becomes a pool effect like any other, so PID
+reports can start, stop, modify and free it by the ID that comes back. Started,
+it goes to the stick as a single define-effect SysEx (see ffb_midi.c); if not,
+effect_pool_task() defines it once the link is idle.
+Fields are as in struct Effect, little-endian.
+*/
+struct __attribute__((__packed__)) DiagEffectLoad
+{
+    uint8_t stick;          // 0 to NUM_JOYSTICKS - 1
+    uint8_t start;          // nonzero to play it at once
+    uint8_t type;           // enum MidiEffectType
+    uint16_t duration;
+    uint16_t button_mask;
+    uint16_t direction;
+    uint8_t gain;
+    uint8_t sample_rate;
+    uint8_t attack_level;
+    uint8_t sustain_level;
+    uint8_t fade_level;
+    uint16_t attack_time;
+    uint16_t fade_time;
+    uint16_t frequency;
+    uint16_t amplitude;
+    uint16_t ramp_end;      // ramps only
+    uint8_t strength_x;
+    uint8_t strength_y;
+    uint16_t offset_x;
+    uint16_t offset_y;
+};
+
+// As in the PID Block Load report
+#define DIAG_LOAD_SUCCESS       1
+#define DIAG_LOAD_FULL          2
+
+struct __attribute__((__packed__)) DiagEffectLoadResult
+{
+    uint8_t effect_id;      // the host effect ID, as PID reports use it; 0 if not loaded
+    uint8_t load_status;
+    uint8_t num_available;  // effect IDs left on that stick
+};
+
+/*
+Replaces a stick's button rule table (see button_rules.h) with the first `count`
+of `rules`; a count of 0 clears it. Fields are as in struct ButtonRule.
+*/
+struct __attribute__((__packed__)) DiagButtonRule
+{
+    uint16_t button_mask;
+    uint8_t edge;           // enum ButtonEdge
+    uint8_t action;         // enum ButtonAction
+    uint8_t effect_id;      // host effect ID, e.g. from DIAG_CMD_LOAD_EFFECT
+};
+
+struct __attribute__((__packed__)) DiagButtonRulesLoad
+{
+    uint8_t stick;          // 0 to NUM_JOYSTICKS - 1
+    uint8_t count;          // up to MAX_BUTTON_RULES
+    struct DiagButtonRule rules[MAX_BUTTON_RULES];
+};
+
+struct __attribute__((__packed__)) DiagButtonRulesLoadResult
+{
+    uint8_t loaded;         // rules with an empty button mask are skipped
+};
+
+
+#ifdef DIAG_INTERFACE
+
+// Load effects for a stick into the given pool
+void diag_set_effect_pool(uint8_t stick, struct EffectPool *pool);
+
+// Load button rules for a stick into the given table
+void diag_set_button_rules(uint8_t stick, struct ButtonRules *rules);
+
+// Call from the main loop
+void diag_task();
+
+#else
+
+static inline void diag_set_effect_pool(uint8_t stick, struct EffectPool *pool) {}
+static inline void diag_set_button_rules(uint8_t stick, struct ButtonRules *rules) {}
+static inline void diag_task() {}
+
+#endif // DIAG_INTERFACE
+
+
+#endif //DIAG_H
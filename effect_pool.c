@@ -0,0 +1,377 @@
+#include <string.h>
+
+#include "effect_pool.h"
+#include "hot_path.h"
+
+void effect_pool_init(struct EffectPool *pool, struct FfbMidi *midi)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->midi = midi;
+}
+
+static struct VirtualEffect *HOT_PATH_FUNC(get_virtual_effect)(struct EffectPool *pool, int effect_id)
+{
+    if (effect_id < 1 || effect_id > VIRTUAL_EFFECT_COUNT) { return NULL; }
+    if (!pool->effects[effect_id].allocated) { return NULL; }
+
+    return &pool->effects[effect_id];
+}
+
+// Mirror a MIDI modify onto the stored parameters
+static void HOT_PATH_FUNC(apply_modify)(struct VirtualEffect *v, uint8_t param, uint16_t value)
+{
+    struct Effect *e = &v->effect;
+
+    switch (param)
+    {
+        case MODIFY_DURATION:       e->duration = value; return;
+        case MODIFY_BUTTON_MASK:    e->button_mask = value; return;
+    }
+
+    switch (e->type)
+    {
+        case MIDI_ET_CONSTANT:
+        case MIDI_ET_SINE:
+        case MIDI_ET_SQUARE:
+        case MIDI_ET_RAMP:
+        case MIDI_ET_TRIANGLE:
+        case MIDI_ET_SAWTOOTHDOWN:
+        case MIDI_ET_SAWTOOTHUP:
+
+            switch (param)
+            {
+                case MODIFY_DIRECTION:      e->direction = value; break;
+                case MODIFY_GAIN:           e->gain = value; break;
+                case MODIFY_ATTACK_TIME:    e->attack_time = value; break;
+                case MODIFY_FADE_TIME:      e->fade_time = value; break;
+                case MODIFY_ATTACK_LEVEL:   e->attack_level = value; break;
+                case MODIFY_SUSTAIN_LEVEL:  e->sustain_level = value; break;
+                case MODIFY_FADE_LEVEL:     e->fade_level = value; break;
+                case MODIFY_FREQUENCY:      e->frequency = value; break;
+                case MODIFY_AMPLITUDE:      e->amplitude = value; break;
+                case MODIFY_RAMP_END:
+                    v->has_ramp_end = true;
+                    v->ramp_end = value;
+                    break;
+            }
+            break;
+
+        default:
+
+            switch (param)
+            {
+                case MODIFY_STRENGTH_X:     e->strength_x = value; break;
+                case MODIFY_STRENGTH_Y:     e->strength_y = value; break;
+                case MODIFY_OFFSET_X:       e->offset_x = value; break;
+                case MODIFY_OFFSET_Y:       e->offset_y = value; break;
+            }
+            break;
+    }
+}
+
+/*
+Whether a resident effect is in use on the stick: playing, or armed with a trigger
+button. The stick fires a triggered effect on its own, without a Start from the
+host, so once evicted nothing would page it back in and the button would go dead.
+*/
+static bool HOT_PATH_FUNC(in_use)(struct EffectPool *pool, struct VirtualEffect *v)
+{
+    return v->effect.button_mask != 0 || ffb_midi_is_playing(pool->midi, v->midi_id);
+}
+
+// Remove the least recently played resident effect from the stick, preferring ones that aren't in use.
+// With idle_only, fail rather than take one that is.
+static bool HOT_PATH_FUNC(evict_one)(struct EffectPool *pool, bool idle_only)
+{
+    struct VirtualEffect *victim = NULL;
+    bool victim_in_use = false;
+
+    for (int i = 1; i <= VIRTUAL_EFFECT_COUNT; i++)
+    {
+        struct VirtualEffect *v = &pool->effects[i];
+        if (!v->allocated || v->midi_id < 0) { continue; }
+
+        bool busy = in_use(pool, v);
+        if (victim == NULL
+                || (victim_in_use && !busy)
+                || (victim_in_use == busy && v->last_played < victim->last_played))
+        {
+            victim = v;
+            victim_in_use = busy;
+        }
+    }
+
+    if (victim == NULL || (idle_only && victim_in_use)) { return false; }
+
+    ffb_midi_erase(pool->midi, victim->midi_id);
+    victim->midi_id = -1;
+    pool->stats.evictions++;
+
+    return true;
+}
+
+static void HOT_PATH_FUNC(cancel_upload)(struct EffectPool *pool, struct VirtualEffect *v)
+{
+    if (!v->upload_pending) { return; }
+
+    v->upload_pending = false;
+    pool->num_upload_pending--;
+    if (pool->num_upload_pending == 0) { pool->upload_held = false; }
+}
+
+static bool HOT_PATH_FUNC(define_on_stick)(struct EffectPool *pool, struct VirtualEffect *v, bool play)
+{
+    cancel_upload(pool, v);
+
+    v->effect.play_immediately = play;
+    v->midi_id = ffb_midi_define_effect(pool->midi, &v->effect);
+    if (v->midi_id < 0) { return false; }
+
+    if (v->has_ramp_end)
+    {
+        ffb_midi_modify(pool->midi, v->midi_id, MODIFY_RAMP_END, v->ramp_end);
+    }
+
+    return true;
+}
+
+// Define an effect on the stick on demand, evicting if needed
+static bool HOT_PATH_FUNC(page_in)(struct EffectPool *pool, struct VirtualEffect *v, bool play)
+{
+    uint32_t start_us = time_us_32();
+
+    if (ffb_midi_get_num_available_effects(pool->midi) == 0 && !evict_one(pool, false)) { return false; }
+    bool ok = define_on_stick(pool, v, play);
+
+    uint32_t elapsed_us = time_us_32() - start_us;
+    pool->stats.page_ins++;
+    pool->stats.page_in_us_total += elapsed_us;
+    if (elapsed_us > pool->stats.page_in_us_max) { pool->stats.page_in_us_max = elapsed_us; }
+
+    return ok;
+}
+
+// Put off effect_pool_task() for at least delay_us
+static void HOT_PATH_FUNC(hold_uploads)(struct EffectPool *pool, uint32_t delay_us)
+{
+    uint32_t until_us = time_us_32() + delay_us;
+    if (!pool->upload_held || (int32_t) (until_us - pool->upload_hold_until_us) > 0)
+    {
+        pool->upload_hold_until_us = until_us;
+    }
+    pool->upload_held = true;
+}
+
+// Reserve a host effect ID, to be defined on the stick by effect_pool_task() or when started
+static struct VirtualEffect *HOT_PATH_FUNC(allocate)(struct EffectPool *pool, const struct Effect *effect)
+{
+    for (int i = 1; i <= VIRTUAL_EFFECT_COUNT; i++)
+    {
+        struct VirtualEffect *v = &pool->effects[i];
+        if (v->allocated) { continue; }
+
+        *v = (struct VirtualEffect) {
+            .allocated = true,
+            .effect = *effect,
+            .midi_id = -1,
+            .last_played = pool->play_count,
+            .upload_pending = true,
+        };
+        pool->num_upload_pending++;
+
+        return v;
+    }
+
+    return NULL;
+}
+
+int HOT_PATH_FUNC(effect_pool_create)(struct EffectPool *pool, enum MidiEffectType type)
+{
+    struct Effect defaults = {
+        .type = type,
+        .duration = 0,
+        .button_mask = 0,
+        .direction = 0,
+        .gain = 0x7f,
+        .strength_x = 0,
+        .strength_y = 0,
+        .sample_rate = 100,
+        .attack_level = 0x7f,
+        .sustain_level = 0x7f,
+        .fade_level = 0x7f,
+        .attack_time = 0,
+        .fade_time = 0,
+        .frequency = 1,
+        .amplitude = 0x7f,
+    };
+
+    struct VirtualEffect *v = allocate(pool, &defaults);
+    pool->last_add_succeeded = (v != NULL);
+    if (v == NULL) { return -1; }
+
+    // Its parameters follow in separate reports
+    hold_uploads(pool, UPLOAD_SETTLE_US);
+
+    int effect_id = v - pool->effects;
+    pool->last_assigned_effect_id = effect_id;
+    return effect_id;
+}
+
+int effect_pool_load(struct EffectPool *pool, const struct Effect *effect)
+{
+    struct VirtualEffect *v = allocate(pool, effect);
+    if (v == NULL) { return -1; }
+
+    v->effect.play_immediately = false;
+    return v - pool->effects;
+}
+
+void HOT_PATH_FUNC(effect_pool_free)(struct EffectPool *pool, int effect_id)
+{
+    struct VirtualEffect *v = get_virtual_effect(pool, effect_id);
+    if (v == NULL) { return; }
+
+    if (v->midi_id >= 0) { ffb_midi_erase(pool->midi, v->midi_id); }
+
+    cancel_upload(pool, v);
+    v->allocated = false;
+    v->midi_id = -1;
+}
+
+void HOT_PATH_FUNC(effect_pool_modify)(struct EffectPool *pool, int effect_id, uint8_t param, uint16_t value)
+{
+    struct VirtualEffect *v = get_virtual_effect(pool, effect_id);
+    if (v == NULL) { return; }
+
+    apply_modify(v, param, value);
+    if (v->upload_pending) { hold_uploads(pool, UPLOAD_SETTLE_US); }
+
+    if (v->midi_id >= 0) { ffb_midi_modify(pool->midi, v->midi_id, param, value); }
+}
+
+void HOT_PATH_FUNC(effect_pool_start)(struct EffectPool *pool, int effect_id)
+{
+    struct VirtualEffect *v = get_virtual_effect(pool, effect_id);
+    if (v == NULL) { return; }
+
+    v->last_played = ++pool->play_count;
+
+    if (v->midi_id >= 0) { ffb_midi_play(pool->midi, v->midi_id); }
+    else { page_in(pool, v, true); }
+}
+
+void HOT_PATH_FUNC(effect_pool_start_solo)(struct EffectPool *pool, int effect_id)
+{
+    struct VirtualEffect *v = get_virtual_effect(pool, effect_id);
+    if (v == NULL) { return; }
+
+    v->last_played = ++pool->play_count;
+
+    if (v->midi_id < 0 && !page_in(pool, v, false)) { return; }
+
+    ffb_midi_play_solo(pool->midi, v->midi_id);
+}
+
+void HOT_PATH_FUNC(effect_pool_stop)(struct EffectPool *pool, int effect_id)
+{
+    struct VirtualEffect *v = get_virtual_effect(pool, effect_id);
+    if (v == NULL) { return; }
+
+    if (v->midi_id >= 0) { ffb_midi_pause(pool->midi, v->midi_id); }
+}
+
+/*
+Load one created effect onto the stick, so starting it later is quick. This waits
+for the link to go idle, so the UART's FIFO takes all but the last byte or so of
+the definition and the main loop hardly blocks, and for the host to finish
+setting the effect's parameters. An effect the stick has no room
+for stays in RAM until it's started, as it would if it had been evicted.
+
+Except one with a trigger button: the stick fires that itself, and the host may
+never start it. It takes the slot of an idle resident effect instead, or if
+there's none, waits and tries again every UPLOAD_RETRY_US.
+*/
+void effect_pool_task(struct EffectPool *pool)
+{
+    if (pool->num_upload_pending == 0 || ffb_midi_tx_backlog_us(pool->midi) > 0) { return; }
+    if (pool->upload_held && (int32_t) (time_us_32() - pool->upload_hold_until_us) < 0) { return; }
+
+    pool->upload_held = false;
+
+    for (int i = 1; i <= VIRTUAL_EFFECT_COUNT; i++)
+    {
+        struct VirtualEffect *v = &pool->effects[i];
+        if (!v->allocated || !v->upload_pending) { continue; }
+
+        if (ffb_midi_get_num_available_effects(pool->midi) == 0)
+        {
+            if (v->effect.button_mask == 0)
+            {
+                cancel_upload(pool, v);
+                continue;
+            }
+
+            if (!evict_one(pool, true))
+            {
+                hold_uploads(pool, UPLOAD_RETRY_US);
+                continue;
+            }
+        }
+
+        if (define_on_stick(pool, v, false)) { pool->stats.uploads++; }
+        return;
+    }
+}
+
+absolute_time_t effect_pool_get_wake_deadline(struct EffectPool *pool)
+{
+    if (pool->num_upload_pending == 0) { return at_the_end_of_time; }
+
+    uint32_t wait_us = ffb_midi_tx_backlog_us(pool->midi);
+    if (pool->upload_held)
+    {
+        int32_t hold_us = (int32_t) (pool->upload_hold_until_us - time_us_32());
+        if (hold_us > (int32_t) wait_us) { wait_us = hold_us; }
+    }
+
+    return make_timeout_time_us(wait_us);
+}
+
+enum MidiEffectType effect_pool_get_type(struct EffectPool *pool, int effect_id)
+{
+    struct VirtualEffect *v = get_virtual_effect(pool, effect_id);
+    return (v == NULL) ? MIDI_ET_NONE : v->effect.type;
+}
+
+size_t effect_pool_get_num_available_effects(struct EffectPool *pool)
+{
+    size_t num_free = 0;
+
+    for (int i = 1; i <= VIRTUAL_EFFECT_COUNT; i++)
+    {
+        if (!pool->effects[i].allocated) { num_free++; }
+    }
+
+    return num_free;
+}
+
+// For creates turned down before reaching the pool, so Block Load still reports them as full
+void effect_pool_refuse_create(struct EffectPool *pool)
+{
+    pool->last_add_succeeded = false;
+}
+
+bool effect_pool_last_add_succeeded(struct EffectPool *pool)
+{
+    return pool->last_add_succeeded;
+}
+
+uint8_t effect_pool_last_assigned_effect_id(struct EffectPool *pool)
+{
+    return pool->last_assigned_effect_id;
+}
+
+const struct EffectPoolStats *effect_pool_get_stats(struct EffectPool *pool)
+{
+    return &pool->stats;
+}
@@ -0,0 +1,102 @@
+#ifndef EFFECT_POOL_H
+#define EFFECT_POOL_H
+
+#include "pico/stdlib.h"
+
+#include "ffb_midi.h"
+
+
+/*
+The host sees effect IDs from this pool, not the stick's own MIDI effect IDs.
+Every pool effect keeps its parameters in Pico RAM; only some of them are
+"resident", i.e. actually defined on the stick. A non-resident effect is paged
+onto the stick when it's started, evicting whichever resident effect was played
+least recently. This lets games allocate far more effects than the stick can hold,
+as long as they don't try to play them all at once.
+
+Creating an effect only reserves its ID, so the Create New Effect transfer and
+the Block Load that follows it are answered at once. effect_pool_task() then
+defines it on the stick from the main loop, once the MIDI link is idle and the
+host's parameter reports for it have stopped coming for UPLOAD_SETTLE_US, if the
+stick has room (or, for an effect with a trigger button, once it can make some).
+Until then the effect is like any other non-resident one: changes go to its
+stored parameters, and starting it defines it with them, so nothing sent for it
+can overtake its definition. Defining it with its real parameters, rather than
+the creation defaults, also lets ffb_midi.c reuse an identical freed effect.
+*/
+
+#define VIRTUAL_EFFECT_COUNT 100 // host-facing effect IDs run from 1 to this
+
+#define UPLOAD_RETRY_US 50000   // how often a triggered effect waiting for a slot tries again
+#define UPLOAD_SETTLE_US 20000  // quiet time after a new effect's last parameter report before uploading
+
+
+// What paging is costing us, for tuning the eviction policy
+struct EffectPoolStats
+{
+    uint32_t page_ins;          // non-resident effects defined on Start
+    uint32_t evictions;         // resident effects removed to make room
+    uint32_t page_in_us_total;  // time spent paging in (mostly blocking MIDI writes)
+    uint32_t page_in_us_max;
+    uint32_t uploads;           // created effects defined in the background
+};
+
+
+struct VirtualEffect
+{
+    bool allocated;
+    struct Effect effect;   // the effect's parameters, whether resident or not
+    bool has_ramp_end;      // ramp end isn't part of the effect definition,
+    uint16_t ramp_end;      // so it's reapplied after paging in
+    int midi_id;            // stick effect ID, or -1 if not resident
+    bool upload_pending;    // created, but not yet defined by effect_pool_task()
+    uint32_t last_played;   // for least-recently-played eviction
+};
+
+// One per attached stick
+struct EffectPool
+{
+    struct FfbMidi *midi;
+
+    // Index 0 is unused, since host effect IDs start at 1
+    struct VirtualEffect effects[VIRTUAL_EFFECT_COUNT + 1];
+    uint32_t play_count;
+    uint32_t num_upload_pending;
+    bool upload_held;           // no uploads until upload_hold_until_us; see effect_pool_task()
+    uint32_t upload_hold_until_us;
+
+    struct EffectPoolStats stats;
+
+    bool last_add_succeeded;
+    uint8_t last_assigned_effect_id;
+};
+
+
+void effect_pool_init(struct EffectPool *pool, struct FfbMidi *midi);
+
+int effect_pool_create(struct EffectPool *pool, enum MidiEffectType type);
+void effect_pool_free(struct EffectPool *pool, int effect_id);
+void effect_pool_modify(struct EffectPool *pool, int effect_id, uint8_t param, uint16_t value);
+void effect_pool_start(struct EffectPool *pool, int effect_id);
+void effect_pool_start_solo(struct EffectPool *pool, int effect_id);
+void effect_pool_stop(struct EffectPool *pool, int effect_id);
+void effect_pool_refuse_create(struct EffectPool *pool);
+
+// Create with every parameter at once, e.g. from the diagnostics interface; returns the ID, or -1 if full.
+// Unlike effect_pool_create(), this leaves the Block Load reply alone.
+int effect_pool_load(struct EffectPool *pool, const struct Effect *effect);
+
+// Defines newly created effects on the stick; call from the main loop
+void effect_pool_task(struct EffectPool *pool);
+
+// When effect_pool_task() next has something to do
+absolute_time_t effect_pool_get_wake_deadline(struct EffectPool *pool);
+
+enum MidiEffectType effect_pool_get_type(struct EffectPool *pool, int effect_id);
+size_t effect_pool_get_num_available_effects(struct EffectPool *pool);
+bool effect_pool_last_add_succeeded(struct EffectPool *pool);
+uint8_t effect_pool_last_assigned_effect_id(struct EffectPool *pool);
+const struct EffectPoolStats *effect_pool_get_stats(struct EffectPool *pool);
+
+
+#endif //EFFECT_POOL_H
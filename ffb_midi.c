@@ -1,79 +1,489 @@
+#include <string.h>
+
+#include "config.h"
 #include "ffb_midi.h"
+#include "trace.h"
+#include "hot_path.h"
+
+/*
+Since the MSB is reserved, we get 7 bits of real data per MIDI byte.
+14-bit values must be split into high and low 7-bit chunks.
+*/
+static inline uint8_t lo7(uint16_t val) { return val & 0x7f; }
+static inline uint8_t hi7(uint16_t val) { return (val >> 7) & 0x7f; }
+
+// One-byte fields saturate; a modify can set them higher than a definition can carry
+static inline uint8_t sat7(uint16_t val) { return (val > 0x7f) ? 0x7f : val; }
+
+/*
+Effect cache.
+
+Games tend to destroy and recreate the same effects over and over. Rather than
+erasing an effect when the host frees it, we pause it and leave it "warm" on the
+stick, remembering the SysEx payload it was defined with (kept up to date as the
+effect is modified). If the host later defines an identical effect, we hand back
+the warm slot without sending the definition again.
+
+Warm slots still take up room on the stick, so they're erased (oldest first)
+whenever a genuinely new effect needs the space.
+*/
+
+void ffb_midi_init(struct FfbMidi *midi, uart_inst_t *uart)
+{
+    memset(midi, 0, sizeof(*midi));
+    midi->uart = uart;
+    midi->status_mode = MIDI_STATUS_MODE;
+}
 
-enum MidiEffectType effects_assigned[EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE] = { 0 };
+void ffb_midi_set_status_mode(struct FfbMidi *midi, enum FfbMidiStatusMode mode)
+{
+    midi->status_mode = mode;
+    midi->running_status = 0;
+}
+
+/*
+Every byte bound for the stick goes through here, as one or more whole messages.
+In running status mode, the first message's status byte is dropped if the stick
+already has it; the running status is then whatever the last message left.
+*/
+static void HOT_PATH_FUNC(midi_write)(struct FfbMidi *midi, const uint8_t *data, size_t size)
+{
+    uint32_t now = time_us_32();
+    bool line_idle = (int32_t) (midi->tx_busy_until_us - now) <= 0;
+
+    TRACE(TRACE_MIDI_SEND, data[0], size);
+
+    if (midi->status_mode == MIDI_STATUS_RUNNING)
+    {
+        if (line_idle && now - midi->tx_busy_until_us > MIDI_STATUS_REFRESH_US) { midi->running_status = 0; }
+
+        bool skip_status = (data[0] == midi->running_status);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            // Channel messages set the running status; system common ones (SysEx included) clear it.
+            // Real-time bytes (0xf8 and up) would leave it alone, but we never send any.
+            if (data[i] & 0x80) { midi->running_status = (data[i] < 0xf0) ? data[i] : 0; }
+        }
+
+        if (skip_status)
+        {
+            data++;
+            size--;
+            midi->status_bytes_saved++;
+        }
+    }
+
+#ifdef BENCH_BUILD
+    bench_midi_sink(data, size);
+#else
+    uart_write_blocking(midi->uart, data, size);
+#endif
+
+    // uart_write_blocking() returns once the bytes are in the FIFO, not on the wire
+    uint32_t start = line_idle ? now : midi->tx_busy_until_us;
+    midi->tx_busy_until_us = start + size * MIDI_BYTE_TIME_US;
+}
+
+uint32_t ffb_midi_tx_backlog_us(struct FfbMidi *midi)
+{
+    int32_t backlog = (int32_t) (midi->tx_busy_until_us - time_us_32());
+    return (backlog > 0) ? backlog : 0;
+}
 
-int ffb_midi_get_free_effect_id()
+const struct FfbMidiCacheStats *ffb_midi_get_cache_stats(struct FfbMidi *midi)
+{
+    return &midi->cache_stats;
+}
+
+const struct FfbMidiPlayStats *ffb_midi_get_play_stats(struct FfbMidi *midi)
+{
+    return &midi->play_stats;
+}
+
+// FNV-1a; cheap, and plenty for a few dozen short payloads
+static uint32_t HOT_PATH_FUNC(payload_hash)(const uint8_t *payload, size_t size)
+{
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= payload[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+bool HOT_PATH_FUNC(ffb_midi_is_periodic)(enum MidiEffectType type)
+{
+    switch (type)
+    {
+        case MIDI_ET_CONSTANT:
+        case MIDI_ET_SINE:
+        case MIDI_ET_SQUARE:
+        case MIDI_ET_RAMP:
+        case MIDI_ET_TRIANGLE:
+        case MIDI_ET_SAWTOOTHDOWN:
+        case MIDI_ET_SAWTOOTHUP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+Where a modify parameter lands in the define-effect SysEx, so the cached payload
+can follow modifications. Returns -1 for parameters we can't place, which makes
+the slot uncacheable. Fade time is left out until its behavior is understood.
+*/
+static int HOT_PATH_FUNC(payload_offset_for_param)(enum MidiEffectType type, uint8_t param, bool *wide)
+{
+    *wide = true;
+
+    switch (param)
+    {
+        case MODIFY_DURATION:       return 8;
+        case MODIFY_BUTTON_MASK:    return 10;
+    }
+
+    if (ffb_midi_is_periodic(type))
+    {
+        switch (param)
+        {
+            case MODIFY_DIRECTION:      return 12;
+            case MODIFY_ATTACK_TIME:    return 20;
+            case MODIFY_FREQUENCY:      return 26;
+            case MODIFY_AMPLITUDE:      return 28;
+        }
+
+        *wide = false;
+        switch (param)
+        {
+            case MODIFY_GAIN:           return 14;
+            case MODIFY_ATTACK_LEVEL:   return 19;
+            case MODIFY_SUSTAIN_LEVEL:  return 22;
+            case MODIFY_FADE_LEVEL:     return 25;
+        }
+    }
+    else
+    {
+        switch (param)
+        {
+            case MODIFY_STRENGTH_X:     return 12;
+            case MODIFY_STRENGTH_Y:     return 14;
+        }
+
+        if (type != MIDI_ET_FRICTION)
+        {
+            switch (param)
+            {
+                case MODIFY_OFFSET_X:   return 16;
+                case MODIFY_OFFSET_Y:   return 18;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static void HOT_PATH_FUNC(cache_update_param)(struct FfbMidi *midi, int effect_id, uint8_t param, uint16_t value)
+{
+    struct CachedEffect *cached = &midi->effect_cache[effect_id];
+    if (!cached->cacheable) { return; }
+
+    bool wide;
+    int offset = payload_offset_for_param(midi->effects_assigned[effect_id], param, &wide);
+    if (offset < 0 || (!wide && hi7(value) != 0))
+    {
+        cached->cacheable = false;
+        return;
+    }
+
+    uint8_t *field = &cached->payload[offset - EFFECT_PAYLOAD_START];
+    field[0] = lo7(value);
+    if (wide) { field[1] = hi7(value); }
+
+    cached->hash = payload_hash(cached->payload, cached->payload_size);
+}
+
+/*
+Whether a freed effect can be left warm. Triggered effects would keep firing
+from the button, and an infinite periodic effect with an attack would resume
+mid-envelope rather than start over like a fresh definition.
+*/
+static bool HOT_PATH_FUNC(cache_can_keep_warm)(struct FfbMidi *midi, int effect_id)
+{
+    const struct CachedEffect *cached = &midi->effect_cache[effect_id];
+    if (!cached->cacheable) { return false; }
+
+    // Offsets into the effect data message, as in ffb_midi_define_effect()
+    const uint8_t *p = cached->payload;
+    bool triggered = (p[10 - EFFECT_PAYLOAD_START] | p[11 - EFFECT_PAYLOAD_START]) != 0;
+    bool infinite = (p[8 - EFFECT_PAYLOAD_START] | p[9 - EFFECT_PAYLOAD_START]) == 0;
+    bool has_attack = ffb_midi_is_periodic(midi->effects_assigned[effect_id])
+            && (p[20 - EFFECT_PAYLOAD_START] | p[21 - EFFECT_PAYLOAD_START]) != 0;
+
+    return !triggered && !(infinite && has_attack);
+}
+
+static int HOT_PATH_FUNC(cache_find)(struct FfbMidi *midi, const uint8_t *payload, uint8_t size, uint32_t hash)
+{
+    for (int i = EFFECT_MEMORY_START; i < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE; i++)
+    {
+        const struct CachedEffect *cached = &midi->effect_cache[i];
+        if (cached->warm && cached->hash == hash && cached->payload_size == size
+                && memcmp(cached->payload, payload, size) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void HOT_PATH_FUNC(send_erase)(struct FfbMidi *midi, int effect_id)
+{
+    uint8_t msg[3] = { 0xb5, 0x10, effect_id & 0x7f };
+    midi_write(midi, msg, sizeof(msg));
+}
+
+// Make room on the stick by erasing the warm slot that was freed longest ago.
+static bool HOT_PATH_FUNC(cache_evict_oldest)(struct FfbMidi *midi)
+{
+    int oldest = -1;
+    for (int i = EFFECT_MEMORY_START; i < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE; i++)
+    {
+        if (midi->effect_cache[i].warm
+                && (oldest < 0 || midi->effect_cache[i].freed_seq < midi->effect_cache[oldest].freed_seq))
+        {
+            oldest = i;
+        }
+    }
+
+    if (oldest < 0) { return false; }
+
+    send_erase(midi, oldest);
+    midi->effect_cache[oldest].warm = false;
+    midi->effects_assigned[oldest] = MIDI_ET_NONE;
+    midi->cache_stats.evictions++;
+
+    return true;
+}
+
+// Free as far as the stick is concerned: neither in use nor warm
+int HOT_PATH_FUNC(ffb_midi_get_free_effect_id)(struct FfbMidi *midi)
 {
     for (int i = EFFECT_MEMORY_START; i < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE; i++)
     {
-        if (effects_assigned[i] == MIDI_ET_NONE) { return i; }
+        if (midi->effects_assigned[i] == MIDI_ET_NONE && !midi->effect_cache[i].warm) { return i; }
     }
 
     return -1;
 }
 
-size_t ffb_midi_get_num_available_effects()
+// Warm slots count as available, since they can be reclaimed on demand
+size_t ffb_midi_get_num_available_effects(struct FfbMidi *midi)
 {
     size_t num_free = 0;
 
     for (int i = EFFECT_MEMORY_START; i < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE; i++)
     {
-        if (effects_assigned[i] == MIDI_ET_NONE) { num_free++; }
+        if (midi->effects_assigned[i] == MIDI_ET_NONE || midi->effect_cache[i].warm) { num_free++; }
     }
 
     return num_free;
 }
 
-bool last_add_succeeded;
+bool ffb_midi_last_add_succeeded(struct FfbMidi *midi)
+{
+    return midi->last_add_succeeded;
+}
 
-bool ffb_midi_last_add_succeeded()
+uint8_t ffb_midi_last_assigned_effect_id(struct FfbMidi *midi)
 {
-    return last_add_succeeded;
+    return midi->last_assigned_effect_id;
 }
 
-uint8_t last_assigned_effect_id;
+/*
+Playing set.
+
+The stick mixes up to MAX_SIMULTANEOUS_EFFECTS effects (the limit we advertise in
+the PID pool report); what it does with more isn't known. So we track what's
+playing: effects started with play or play solo, or defined to play immediately,
+until they're paused or erased, or their duration runs out. Starting one effect
+too many pauses the playing effect with the lowest priority, the oldest first
+among equals. If the new effect has a lower priority than all of them, it isn't
+started instead.
+
+Priority is an effect's strength (its gain, or the stronger axis of a condition),
+weighted by type. Constant forces and ramps carry a game's main feedback, so they
+outrank conditions, which outrank periodic effects (mostly rumble).
+
+Effects triggered by a button mask play without our knowing, so they aren't counted.
+*/
+
+#define PLAYBACK_SLOTS (EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE)
 
-uint8_t ffb_midi_last_assigned_effect_id()
+static uint32_t HOT_PATH_FUNC(play_priority)(enum MidiEffectType type, const uint16_t strength[2])
 {
-    return last_assigned_effect_id;
+    uint32_t level = (strength[0] > strength[1]) ? strength[0] : strength[1];
+
+    switch (type)
+    {
+        case MIDI_ET_CONSTANT:
+        case MIDI_ET_RAMP:
+            return level * 4;
+        case MIDI_ET_SPRING:
+        case MIDI_ET_DAMPER:
+        case MIDI_ET_INERTIA:
+        case MIDI_ET_FRICTION:
+            return level * 3;
+        default:
+            return level * 2;
+    }
 }
 
-void ffb_midi_set_autocenter(uart_inst_t *uart, bool enabled)
+static void HOT_PATH_FUNC(effect_strength)(const struct Effect *effect, uint16_t strength[2])
 {
-    uint8_t autocenter_cmd[] = {
-            0xc5, 0x01
-    };
+    if (ffb_midi_is_periodic(effect->type))
+    {
+        strength[0] = effect->gain;
+        strength[1] = 0;
+    }
+    else
+    {
+        strength[0] = effect->strength_x;
+        strength[1] = effect->strength_y;
+    }
+}
 
-    autocenter_cmd[1] = enabled ? 0x01 : 0x06; 
-    uart_write_blocking(uart, autocenter_cmd, sizeof(autocenter_cmd));
+static void HOT_PATH_FUNC(playback_define)(struct FfbMidi *midi, int effect_id, const struct Effect *effect)
+{
+    struct EffectPlayback *playback = &midi->playback[effect_id];
+
+    playback->playing = false;
+    playback->duration_us = effect->duration * 2000;
+    effect_strength(effect, playback->strength);
 }
 
-/*
-Since the MSB is reserved, we get 7 bits of real data per MIDI byte.
-14-bit values must be split into high and low 7-bit chunks.
-*/
-static inline uint8_t lo7(uint16_t val) { return val & 0x7f; }
-static inline uint8_t hi7(uint16_t val) { return (val >> 7) & 0x7f; }
+static void HOT_PATH_FUNC(playback_modify)(struct FfbMidi *midi, int effect_id, uint8_t param, uint16_t value)
+{
+    struct EffectPlayback *playback = &midi->playback[effect_id];
+
+    // Taking a new duration to count from when the effect started
+    if (param == MODIFY_DURATION) { playback->duration_us = value * 2000; }
+    else if (ffb_midi_is_periodic(midi->effects_assigned[effect_id]))
+    {
+        if (param == MODIFY_GAIN) { playback->strength[0] = value; }
+    }
+    else if (param == MODIFY_STRENGTH_X) { playback->strength[0] = value; }
+    else if (param == MODIFY_STRENGTH_Y) { playback->strength[1] = value; }
+}
+
+// Drops effects whose duration has run out, and counts the rest
+static size_t HOT_PATH_FUNC(playback_count)(struct FfbMidi *midi, uint32_t now)
+{
+    size_t count = 0;
+
+    for (int i = EFFECT_MEMORY_START; i < PLAYBACK_SLOTS; i++)
+    {
+        struct EffectPlayback *playback = &midi->playback[i];
+        if (!playback->playing) { continue; }
+
+        if (playback->duration_us != 0 && now - playback->started_us >= playback->duration_us)
+        {
+            playback->playing = false;
+            continue;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+static void HOT_PATH_FUNC(playback_start)(struct FfbMidi *midi, int effect_id, uint32_t now)
+{
+    if (effect_id >= PLAYBACK_SLOTS) { return; }
+
+    struct EffectPlayback *playback = &midi->playback[effect_id];
+    playback->playing = true;
+    playback->started_us = now;
+    playback->start_seq = midi->play_seq++;
+
+    size_t count = playback_count(midi, now);
+    if (count > midi->play_stats.peak_playing) { midi->play_stats.peak_playing = count; }
+}
+
+static void HOT_PATH_FUNC(playback_stop)(struct FfbMidi *midi, int effect_id)
+{
+    if (effect_id == MIDI_ALL_EFFECTS)
+    {
+        for (int i = 0; i < PLAYBACK_SLOTS; i++) { midi->playback[i].playing = false; }
+    }
+    else if (effect_id < PLAYBACK_SLOTS)
+    {
+        midi->playback[effect_id].playing = false;
+    }
+}
 
-int ffb_midi_define_effect(uart_inst_t *uart, struct Effect *effect)
+// Whether an effect of this priority may start, pausing another to make room if need be
+static bool HOT_PATH_FUNC(playback_make_room)(struct FfbMidi *midi, uint32_t priority, uint32_t now)
 {
-    // Get an effect id (and make sure we have enough room)
-    int effect_id = ffb_midi_get_free_effect_id();
-    if (effect_id < 0)
+    if (playback_count(midi, now) < MAX_SIMULTANEOUS_EFFECTS) { return true; }
+
+    int victim = -1;
+    uint32_t victim_priority = 0;
+
+    for (int i = EFFECT_MEMORY_START; i < PLAYBACK_SLOTS; i++)
     {
-        last_add_succeeded = false;
-        return effect_id;
+        const struct EffectPlayback *playback = &midi->playback[i];
+        if (!playback->playing) { continue; }
+
+        uint32_t p = play_priority(midi->effects_assigned[i], playback->strength);
+        if (victim < 0 || p < victim_priority
+                || (p == victim_priority && playback->start_seq < midi->playback[victim].start_seq))
+        {
+            victim = i;
+            victim_priority = p;
+        }
     }
 
-    // At a glance, 0x24 through 0x2f will start the effect immediately,
-    // 0x20 through 0x23 will wait for it to be started,
-    // and any upper nibble besides 0x2* will fail.
-    uint8_t flags = effect->play_immediately ? 0x24 : 0x23;
+    // The newest effect wins a tie
+    if (priority < victim_priority)
+    {
+        midi->play_stats.refusals++;
+        return false;
+    }
+
+    ffb_midi_pause(midi, victim);
+    midi->play_stats.preemptions++;
+    return true;
+}
+
+bool ffb_midi_is_playing(struct FfbMidi *midi, int effect_id)
+{
+    if (effect_id < EFFECT_MEMORY_START || effect_id >= PLAYBACK_SLOTS) { return false; }
+
+    playback_count(midi, time_us_32());
+    return midi->playback[effect_id].playing;
+}
+
+void ffb_midi_set_autocenter(struct FfbMidi *midi, bool enabled)
+{
+    uint8_t autocenter_cmd[] = {
+            0xc5, 0x01
+    };
+
+    autocenter_cmd[1] = enabled ? 0x01 : 0x06; 
+    midi_write(midi, autocenter_cmd, sizeof(autocenter_cmd));
+}
 
-    uint8_t effect_data[33] = {
+int HOT_PATH_FUNC(ffb_midi_define_effect)(struct FfbMidi *midi, struct Effect *effect)
+{
+    uint8_t effect_data[34] = {
         0xf0,                           // 0: SysEx start - effect data
         0x00, 0x01, 0x0a, 0x01,         // 1..4: Effect header
-        flags,                          // 5: Effect flags?
+        0x23,                           // 5: Effect flags?; set below, once we know whether it plays
         effect->type,                   // 6: enumerated effect type
         0x7f,                           // 7: Overwrite existing effect ID (0x7f to claim new effect)
         lo7(effect->duration),          // 8, 9: duration
@@ -94,25 +504,25 @@ int ffb_midi_define_effect(uart_inst_t *uart, struct Effect *effect)
         case MIDI_ET_SAWTOOTHDOWN:
         case MIDI_ET_SAWTOOTHUP:
 
-            effect_data[12] = lo7(effect->direction);   // 12, 13: direction
+            effect_data[12] = lo7(effect->direction);      // 12, 13: direction
             effect_data[13] = hi7(effect->direction);
-            effect_data[14] = effect->gain;             // 14: gain
-            effect_data[15] = lo7(effect->sample_rate); // 15, 16: sample rate
+            effect_data[14] = sat7(effect->gain);          // 14: gain
+            effect_data[15] = lo7(effect->sample_rate);    // 15, 16: sample rate
             effect_data[16] = hi7(effect->sample_rate);
-            effect_data[17] = 0x10;                     // 17, 18: truncate; 0x4e10 = 10000 = full waveform
+            effect_data[17] = 0x10;                        // 17, 18: truncate; 0x4e10 = 10000 = full waveform
             effect_data[18] = 0x4e;
-            effect_data[19] = effect->attack_level;     // 19: Envelope Attack Start Level
-            effect_data[20] = lo7(effect->attack_time); // 20, 21: Envelope Attack Time
+            effect_data[19] = sat7(effect->attack_level);  // 19: Envelope Attack Start Level
+            effect_data[20] = lo7(effect->attack_time);    // 20, 21: Envelope Attack Time
             effect_data[21] = hi7(effect->attack_time);
-            effect_data[22] = effect->sustain_level;    // 22: Envelope Sustain Level
-            effect_data[23] = lo7(effect->fade_time);   // 23, 24: Envelope Fade Time
+            effect_data[22] = sat7(effect->sustain_level); // 22: Envelope Sustain Level
+            effect_data[23] = lo7(effect->fade_time);      // 23, 24: Envelope Fade Time
             effect_data[24] = hi7(effect->fade_time);
-            effect_data[25] = effect->fade_level;       // 25: Envelope Fade End Level
-            effect_data[26] = lo7(effect->frequency);   // 26, 27: Frequency
+            effect_data[25] = sat7(effect->fade_level);    // 25: Envelope Fade End Level
+            effect_data[26] = lo7(effect->frequency);      // 26, 27: Frequency
             effect_data[27] = hi7(effect->frequency);
-            effect_data[28] = lo7(effect->amplitude);   // 28, 29: Amplitude
+            effect_data[28] = lo7(effect->amplitude);      // 28, 29: Amplitude
             effect_data[29] = hi7(effect->amplitude);
-            effect_data[30] = 0x01;                     // 30, 31: ???
+            effect_data[30] = 0x01;                        // 30, 31: ???
             effect_data[31] = 0x01;
             next_index = 32;
 
@@ -122,9 +532,9 @@ int ffb_midi_define_effect(uart_inst_t *uart, struct Effect *effect)
         case MIDI_ET_DAMPER:
         case MIDI_ET_INERTIA:
 
-            effect_data[12] = effect->strength_x;
+            effect_data[12] = sat7(effect->strength_x);
             effect_data[13] = 0x00;
-            effect_data[14] = effect->strength_y;
+            effect_data[14] = sat7(effect->strength_y);
             effect_data[15] = 0x00;
             effect_data[16] = lo7(effect->offset_x);
             effect_data[17] = hi7(effect->offset_x);
@@ -136,72 +546,327 @@ int ffb_midi_define_effect(uart_inst_t *uart, struct Effect *effect)
 
         case MIDI_ET_FRICTION:
 
-            effect_data[12] = effect->strength_x;
+            effect_data[12] = sat7(effect->strength_x);
             effect_data[13] = 0x00;
-            effect_data[14] = effect->strength_y;
+            effect_data[14] = sat7(effect->strength_y);
             effect_data[15] = 0x00;
             next_index = 16;
 
             break;
+
+        default:
+            midi->last_add_succeeded = false;
+            return -1;
+    }
+
+    // Reuse an identical warm effect if there is one
+    const uint8_t *payload = &effect_data[EFFECT_PAYLOAD_START];
+    uint8_t payload_size = next_index - EFFECT_PAYLOAD_START;
+    uint32_t hash = payload_hash(payload, payload_size);
+
+    int effect_id = cache_find(midi, payload, payload_size, hash);
+    bool warm = (effect_id >= 0);
+    if (warm)
+    {
+        midi->effect_cache[effect_id].warm = false;
+        midi->cache_stats.hits++;
+        midi->cache_stats.bytes_saved += next_index + 2;
+    }
+    else
+    {
+        // Get an effect id (and make sure we have enough room)
+        effect_id = ffb_midi_get_free_effect_id(midi);
+        if (effect_id < 0 && cache_evict_oldest(midi))
+        {
+            effect_id = ffb_midi_get_free_effect_id(midi);
+        }
+        if (effect_id < 0)
+        {
+            midi->last_add_succeeded = false;
+            return effect_id;
+        }
     }
 
-    // Calculate and write checksum
-    uint8_t checksum = 0;
-    for (int i = 5; i < next_index; i++)
+    // Only make room once the effect has a slot, so a define that fails doesn't pause anything
+    uint16_t strength[2];
+    effect_strength(effect, strength);
+    bool play = effect->play_immediately && playback_make_room(midi, play_priority(effect->type, strength), time_us_32());
+
+    if (!warm)
     {
-        checksum += effect_data[i];
+        // At a glance, 0x24 through 0x2f will start the effect immediately,
+        // 0x20 through 0x23 will wait for it to be started,
+        // and any upper nibble besides 0x2* will fail.
+        effect_data[5] = play ? 0x24 : 0x23;
+
+        // Calculate and write checksum
+        uint8_t checksum = 0;
+        for (int i = 5; i < next_index; i++)
+        {
+            checksum += effect_data[i];
+        }
+        // A sum that's already a multiple of 128 needs a checksum of 0, not 0x80, which isn't a data byte
+        effect_data[next_index++] = (0x80 - (checksum & 0x7f)) & 0x7f;
+
+        effect_data[next_index++] = 0xf7; // SysEx end
+
+        midi_write(midi, effect_data, next_index);
+        midi->cache_stats.misses++;
+
+        struct CachedEffect *cached = &midi->effect_cache[effect_id];
+        memcpy(cached->payload, payload, payload_size);
+        cached->payload_size = payload_size;
+        cached->hash = hash;
+        cached->cacheable = true;
+        cached->warm = false;
     }
-    effect_data[next_index++] = 0x80 - (checksum & 0x7f);
 
-    effect_data[next_index++] = 0xf7; // SysEx end
+    midi->last_add_succeeded = true;
+    midi->last_assigned_effect_id = effect_id;
+    midi->effects_assigned[effect_id] = effect->type;
 
-    uart_write_blocking(uart, effect_data, next_index);
+    playback_define(midi, effect_id, effect);
+    if (play)
+    {
+        // A warm effect was left paused, so it needs starting
+        if (warm) { ffb_midi_play(midi, effect_id); }
+        else { playback_start(midi, effect_id, time_us_32()); }
+    }
 
-    last_add_succeeded = true;
-    last_assigned_effect_id = effect_id;
-    effects_assigned[effect_id] = effect->type;
     return effect_id;
 }
 
-void ffb_midi_erase(uart_inst_t *uart, int effect_id)
+void HOT_PATH_FUNC(ffb_midi_erase)(struct FfbMidi *midi, int effect_id)
 {
     if (effect_id < 0) { return; }
 
-    uint8_t msg[3] = { 0xb5, 0x10, effect_id & 0x7f };
-    uart_write_blocking(uart, msg, sizeof(msg));
+    if (effect_id < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE
+            && midi->effects_assigned[effect_id] != MIDI_ET_NONE
+            && cache_can_keep_warm(midi, effect_id))
+    {
+        // Stop it, but leave it defined for reuse
+        ffb_midi_pause(midi, effect_id);
+
+        midi->effect_cache[effect_id].warm = true;
+        midi->effect_cache[effect_id].freed_seq = midi->effect_cache_free_count++;
+    }
+    else
+    {
+        send_erase(midi, effect_id);
 
-    effects_assigned[effect_id] = MIDI_ET_NONE;
+        if (effect_id < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE) { midi->effect_cache[effect_id].warm = false; }
+    }
+
+    playback_stop(midi, effect_id);
+    midi->effects_assigned[effect_id] = MIDI_ET_NONE;
 }
 
-void ffb_midi_play_solo(uart_inst_t *uart, int effect_id)
+void HOT_PATH_FUNC(ffb_midi_play_solo)(struct FfbMidi *midi, int effect_id)
 {
     if (effect_id < 0) { return; }
 
     uint8_t msg[3] = { 0xb5, 0x00, effect_id & 0x7f };
-    uart_write_blocking(uart, msg, sizeof(msg));
+    midi_write(midi, msg, sizeof(msg));
+
+    playback_stop(midi, MIDI_ALL_EFFECTS);
+    playback_start(midi, effect_id, time_us_32());
 }
 
-void ffb_midi_play(uart_inst_t *uart, int effect_id)
+void HOT_PATH_FUNC(ffb_midi_play)(struct FfbMidi *midi, int effect_id)
 {
     if (effect_id < 0) { return; }
 
+    // Restarting an effect that's already playing doesn't take another place
+    uint32_t now = time_us_32();
+    if (effect_id < PLAYBACK_SLOTS && !ffb_midi_is_playing(midi, effect_id))
+    {
+        uint32_t priority = play_priority(midi->effects_assigned[effect_id], midi->playback[effect_id].strength);
+        if (!playback_make_room(midi, priority, now)) { return; }
+    }
+
     uint8_t msg[3] = { 0xb5, 0x20, effect_id & 0x7f };
-    uart_write_blocking(uart, msg, sizeof(msg));
+    midi_write(midi, msg, sizeof(msg));
+
+    playback_start(midi, effect_id, now);
 }
 
-void ffb_midi_pause(uart_inst_t *uart, int effect_id)
+void HOT_PATH_FUNC(ffb_midi_pause)(struct FfbMidi *midi, int effect_id)
 {
     if (effect_id < 0) { return; }
 
     uint8_t msg[3] = { 0xb5, 0x30, effect_id & 0x7f };
-    uart_write_blocking(uart, msg, sizeof(msg));
+    midi_write(midi, msg, sizeof(msg));
+
+    playback_stop(midi, effect_id);
 }
 
-void ffb_midi_modify(uart_inst_t *uart, int effect_id, uint8_t param, uint16_t value)
+void HOT_PATH_FUNC(ffb_midi_modify)(struct FfbMidi *midi, int effect_id, uint8_t param, uint16_t value)
 {
     if (effect_id < 0) { return; }
 
     uint8_t msg[6] = {
         0xb5, param, effect_id & 0x7f, 0xa5, lo7(value), hi7(value) };
-    uart_write_blocking(uart, msg, sizeof(msg));
-}
\ No newline at end of file
+    midi_write(midi, msg, sizeof(msg));
+
+    if (effect_id < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE
+            && midi->effects_assigned[effect_id] != MIDI_ET_NONE)
+    {
+        cache_update_param(midi, effect_id, param, value);
+        playback_modify(midi, effect_id, param, value);
+    }
+}
+
+/*
+Forwarded messages.
+
+MIDI the host sends the stick itself comes through here, one whole message at a
+time, so it can't be interleaved with ours; a modify is its 0xb5 and 0xa5
+messages together. Each is read for what it does to the stick's slots, so that
+our own bookkeeping stays right:
+- A definition claiming a new ID gets the slot the stick will give it: the
+  lowest free one, after reclaiming a warm slot if there's none. That slot is
+  then the host's. Its playback is tracked like ours, and shares
+  MAX_SIMULTANEOUS_EFFECTS with ours, but it's never cached.
+- Play, pause, erase, modify and redefinition are refused for slots that aren't
+  the host's, so the effect pool's effects can't change behind its back. Of the
+  all-effects (0x7f) forms, only pause and device gain are let through. A 0xa5
+  message on its own, which would modify whatever was addressed last, is refused,
+  as is a define-effect SysEx too short to hold its parameters.
+- Starting an effect, by play or by a definition that plays at once, needs room
+  in the playing set as ours does: it may pause a weaker effect, or be refused.
+Anything else, such as autocenter, goes straight out.
+*/
+
+static bool forward_slot_ok(struct FfbMidi *midi, int effect_id)
+{
+    return effect_id >= EFFECT_MEMORY_START && effect_id < EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE
+            && midi->forwarded_slot[effect_id];
+}
+
+// Whether a host effect may start: the same check as ffb_midi_play(), pausing one of ours if need be
+static bool forward_make_room(struct FfbMidi *midi, int effect_id, enum MidiEffectType type, const uint16_t strength[2])
+{
+    // Restarting an effect that's already playing doesn't take another place
+    if (ffb_midi_is_playing(midi, effect_id)) { return true; }
+
+    return playback_make_room(midi, play_priority(type, strength), time_us_32());
+}
+
+static bool forward_define(struct FfbMidi *midi, const uint8_t *msg, size_t size)
+{
+    static const uint8_t header[] = { 0xf0, 0x00, 0x01, 0x0a, 0x01 };
+
+    // Some other SysEx; it doesn't touch the slots
+    size_t compare = (size < sizeof(header)) ? size : sizeof(header);
+    if (memcmp(msg, header, compare) != 0)
+    {
+        midi_write(midi, msg, size);
+        return true;
+    }
+
+    // A define too short to check would get past the slot and playback bookkeeping
+    if (size < 16) { return false; }
+
+    int effect_id = msg[7];
+    if (effect_id == MIDI_ALL_EFFECTS)
+    {
+        effect_id = ffb_midi_get_free_effect_id(midi);
+        if (effect_id < 0 && cache_evict_oldest(midi)) { effect_id = ffb_midi_get_free_effect_id(midi); }
+        if (effect_id < 0) { return false; }
+    }
+    else if (!forward_slot_ok(midi, effect_id))
+    {
+        return false;
+    }
+
+    struct Effect effect = {
+        .type = msg[6],
+        .duration = msg[8] | (msg[9] << 7),
+        .gain = msg[14],
+        .strength_x = msg[12],
+        .strength_y = msg[14],
+    };
+
+    bool play = msg[5] >= 0x24 && msg[5] <= 0x2f;
+    if (play)
+    {
+        uint16_t strength[2];
+        effect_strength(&effect, strength);
+        if (!forward_make_room(midi, effect_id, effect.type, strength)) { return false; }
+    }
+
+    midi_write(midi, msg, size);
+
+    midi->effects_assigned[effect_id] = effect.type;
+    midi->forwarded_slot[effect_id] = true;
+    midi->effect_cache[effect_id].cacheable = false;
+    midi->effect_cache[effect_id].warm = false;
+
+    playback_define(midi, effect_id, &effect);
+    if (play) { playback_start(midi, effect_id, time_us_32()); }
+
+    return true;
+}
+
+bool ffb_midi_forward(struct FfbMidi *midi, const uint8_t *msg, size_t size)
+{
+    bool ok = true;
+
+    if (msg[0] == 0xf0)
+    {
+        ok = forward_define(midi, msg, size);
+    }
+    else if (msg[0] == 0xb5 && size >= 3)
+    {
+        uint8_t op = msg[1];
+        int effect_id = msg[2];
+        bool all = (effect_id == MIDI_ALL_EFFECTS);
+
+        switch (op)
+        {
+            case 0x00:  // play solo
+            case 0x20:  // play
+                ok = forward_slot_ok(midi, effect_id);
+                if (ok && op == 0x00) { playback_stop(midi, MIDI_ALL_EFFECTS); }
+                ok = ok && forward_make_room(midi, effect_id, midi->effects_assigned[effect_id],
+                        midi->playback[effect_id].strength);
+                if (ok) { playback_start(midi, effect_id, time_us_32()); }
+                break;
+
+            case 0x30:  // pause
+                ok = all || forward_slot_ok(midi, effect_id);
+                if (ok) { playback_stop(midi, effect_id); }
+                break;
+
+            case 0x10:  // erase
+                ok = forward_slot_ok(midi, effect_id);
+                if (ok)
+                {
+                    playback_stop(midi, effect_id);
+                    midi->effects_assigned[effect_id] = MIDI_ET_NONE;
+                    midi->forwarded_slot[effect_id] = false;
+                }
+                break;
+
+            default:    // modify, with the value in the 0xa5 message after
+                ok = size == 6 && msg[3] == 0xa5
+                        && ((all && op == MODIFY_DEVICE_GAIN) || forward_slot_ok(midi, effect_id));
+                if (ok && !all) { playback_modify(midi, effect_id, op, msg[4] | (msg[5] << 7)); }
+                break;
+        }
+
+        if (ok) { midi_write(midi, msg, size); }
+    }
+    else if (msg[0] == 0xa5)
+    {
+        // A modify's value without its 0xb5 half: the stick would apply it to whatever was last addressed
+        ok = false;
+    }
+    else
+    {
+        midi_write(midi, msg, size);
+    }
+
+    if (!ok) { midi->forward_dropped++; }
+    return ok;
+}
@@ -21,9 +21,9 @@ enum MidiEffectType
     MIDI_ET_CONSTANT        = 0x12,
 };
 
-#define EFFECT_MEMORY_SIZE 39 // max effect ID is 40, per descriptor
+#define EFFECT_MEMORY_SIZE 39 // max stick effect ID is 40; the host sees virtual IDs (see effect_pool.h)
 #define EFFECT_MEMORY_START 2
-#define MAX_SIMULTANEOUS_EFFECTS 10
+#define MAX_SIMULTANEOUS_EFFECTS 10 // what we advertise, and keep to (see ffb_midi.c)
 
 /*
 TODO investigate: fade time property isn't behaving as expected.
@@ -87,22 +87,140 @@ struct Effect
 #define MODIFY_OFFSET_Y     0x54
 
 
+// 10 bits at 31250 baud
+#define MIDI_BYTE_TIME_US 320
+
 // Use this as an effect ID to manipulate all effects at once
 #define MIDI_ALL_EFFECTS 0x7f
 
+/*
+How status bytes go out (MIDI_STATUS_MODE in config.h sets the default):
+  MIDI_STATUS_ALWAYS   every message carries its status byte, as the Windows driver sends them
+  MIDI_STATUS_RUNNING  a message with the same status as the one before leaves it out (MIDI
+                       running status). After MIDI_STATUS_REFRESH_US of silence the next status
+                       is sent anyway, so a stick that lost track resynchronises.
+
+Only back-to-back messages with the same status save anything. A modify is a 0xb5 message
+followed by an 0xa5 one, so streams of modifies don't benefit; runs of play, pause and erase
+(0xb5 each) do.
+*/
+enum FfbMidiStatusMode
+{
+    MIDI_STATUS_ALWAYS,
+    MIDI_STATUS_RUNNING,
+};
+
+#define MIDI_STATUS_REFRESH_US 100000
+
+
+// How well the effect cache is doing; see ffb_midi.c
+struct FfbMidiCacheStats
+{
+    uint32_t hits;          // definitions satisfied by a warm slot, with no MIDI sent
+    uint32_t misses;        // definitions sent to the stick
+    uint32_t evictions;     // warm slots erased to make room
+    uint32_t bytes_saved;   // SysEx bytes not sent thanks to hits
+};
+
+
+// How often the stick ran out of room to play; see ffb_midi.c
+struct FfbMidiPlayStats
+{
+    uint32_t peak_playing;  // most effects playing at once
+    uint32_t preemptions;   // playing effects paused to make room for a stronger one
+    uint32_t refusals;      // effects not started, because all MAX_SIMULTANEOUS_EFFECTS were stronger
+};
+
+// What we know of one slot's playback
+struct EffectPlayback
+{
+    bool playing;
+    uint32_t started_us;
+    uint32_t start_seq;     // for preempting the oldest first among equals
+    uint32_t duration_us;   // 0 = infinite
+    uint16_t strength[2];   // gain for constant, ramp and periodic effects; X and Y strength for the rest
+};
+
+
+// Bytes 6 onward of the define-effect SysEx, up to (not including) the checksum.
+// The flags byte and the "claim new ID" byte are left out, since they don't describe the effect.
+#define EFFECT_PAYLOAD_START 6
+#define EFFECT_PAYLOAD_MAX_SIZE (32 - EFFECT_PAYLOAD_START)
+
+struct CachedEffect
+{
+    uint8_t payload[EFFECT_PAYLOAD_MAX_SIZE];
+    uint8_t payload_size;
+    uint32_t hash;
+    bool cacheable;     // false once the stick's copy may differ from payload
+    bool warm;          // freed by the host, but still defined on the stick
+    uint32_t freed_seq; // for evicting the oldest warm slot first
+};
+
+// Everything we know about one stick's MIDI side. Each attached Sidewinder gets its own.
+struct FfbMidi
+{
+    uart_inst_t *uart;
+
+    enum MidiEffectType effects_assigned[EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE];
+    struct CachedEffect effect_cache[EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE];
+    uint32_t effect_cache_free_count;
+    struct FfbMidiCacheStats cache_stats;
+
+    bool forwarded_slot[EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE]; // defined by ffb_midi_forward()
+    uint32_t forward_dropped;
+
+    struct EffectPlayback playback[EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE];
+    uint32_t play_seq;
+    struct FfbMidiPlayStats play_stats;
+
+    bool last_add_succeeded;
+    uint8_t last_assigned_effect_id;
+
+    uint32_t tx_busy_until_us; // when the last byte written will have left the UART
+
+    enum FfbMidiStatusMode status_mode;
+    uint8_t running_status;         // the stick's current running status; 0 for none
+    uint32_t status_bytes_saved;
+};
+
+
+void ffb_midi_init(struct FfbMidi *midi, uart_inst_t *uart);
+
+#ifdef BENCH_BUILD
+// The on-device benchmark image (tools/bench) times the encoding, not the 31250 baud wire,
+// so MIDI goes here instead of the UART.
+void bench_midi_sink(const uint8_t *data, size_t size);
+#endif
+
+void ffb_midi_set_status_mode(struct FfbMidi *midi, enum FfbMidiStatusMode mode);
+
+int ffb_midi_get_free_effect_id(struct FfbMidi *midi);
+size_t ffb_midi_get_num_available_effects(struct FfbMidi *midi);
+bool ffb_midi_last_add_succeeded(struct FfbMidi *midi);
+uint8_t ffb_midi_last_assigned_effect_id(struct FfbMidi *midi);
+const struct FfbMidiCacheStats *ffb_midi_get_cache_stats(struct FfbMidi *midi);
+const struct FfbMidiPlayStats *ffb_midi_get_play_stats(struct FfbMidi *midi);
+
+// Whether we started an effect, and it hasn't been stopped, preempted or run its course since
+bool ffb_midi_is_playing(struct FfbMidi *midi, int effect_id);
+
+// Constant, periodic and ramp effects, which share one set of modify parameters
+bool ffb_midi_is_periodic(enum MidiEffectType type);
+
+// How long until everything written so far is on the wire
+uint32_t ffb_midi_tx_backlog_us(struct FfbMidi *midi);
 
-int ffb_midi_get_free_effect_id();
-size_t ffb_midi_get_num_available_effects();
-bool ffb_midi_last_add_succeeded();
-uint8_t ffb_midi_last_assigned_effect_id();
+void ffb_midi_set_autocenter(struct FfbMidi *midi, bool enabled);
+int ffb_midi_define_effect(struct FfbMidi *midi, struct Effect *effect);
+void ffb_midi_erase(struct FfbMidi *midi, int effect_id);
+void ffb_midi_play_solo(struct FfbMidi *midi, int effect_id);
+void ffb_midi_play(struct FfbMidi *midi, int effect_id);
+void ffb_midi_pause(struct FfbMidi *midi, int effect_id);
+void ffb_midi_modify(struct FfbMidi *midi, int effect_id, uint8_t param, uint16_t value);
 
-void ffb_midi_set_autocenter(uart_inst_t *uart, bool enabled);
-int ffb_midi_define_effect(uart_inst_t *uart, struct Effect *effect);
-void ffb_midi_erase(uart_inst_t *uart, int effect_id);
-void ffb_midi_play_solo(uart_inst_t *uart, int effect_id);
-void ffb_midi_play(uart_inst_t *uart, int effect_id);
-void ffb_midi_pause(uart_inst_t *uart, int effect_id);
-void ffb_midi_modify(uart_inst_t *uart, int effect_id, uint8_t param, uint16_t value);
+// Sends one whole message from the host's own MIDI (see midi_passthrough.h); false if it was refused
+bool ffb_midi_forward(struct FfbMidi *midi, const uint8_t *msg, size_t size);
 
 
 #endif //FFB_MIDI_H
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef HOT_PATH_H
+#define HOT_PATH_H
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+
+
+/*
+Code and tables on the latency-sensitive paths: the capture IRQ, building and
+sending joystick reports, handling PID reports, and encoding and sending MIDI.
+
+Normally these run from flash through the XIP cache, like everything else, and a
+cache miss stalls them while the line is fetched over QSPI. With RAM_HOT_PATH,
+they're copied to SRAM at boot instead, so their timing doesn't depend on what
+else has been through the cache. LATENCY_STATS measures the difference.
+
+Mark a definition as `void HOT_PATH_FUNC(name)(...)`, and a table as
+`static const type HOT_PATH_DATA(name) name[] = ...`.
+*/
+
+#ifdef RAM_HOT_PATH
+#define HOT_PATH_FUNC(name) __not_in_flash_func(name)
+#define HOT_PATH_DATA(name) __not_in_flash(#name)
+#else
+#define HOT_PATH_FUNC(name) name
+#define HOT_PATH_DATA(name)
+#endif
+
+
+#endif //HOT_PATH_H
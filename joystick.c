@@ -0,0 +1,163 @@
+#include "hardware/clocks.h"
+
+#include "joystick.h"
+#include "hot_path.h"
+
+#include "ffb_handshake.pio.h"
+#include "read_joystick.pio.h"
+
+#include "config.h"
+
+void joystick_init(struct Joystick *js)
+{
+    // Hardware UART setup.
+    // The default is 8 data bits, no parity bit, and 1 stop bit.
+    uart_init(js->uart, 31250);
+    gpio_set_function(js->pin_midi_tx, UART_FUNCSEL_NUM(js->uart, js->pin_midi_tx));
+
+    ffb_midi_init(&js->midi, js->uart);
+    effect_pool_init(&js->pool, &js->midi);
+    custom_force_init(&js->custom_force, &js->pool);
+}
+
+void joystick_handshake_start(struct Joystick *js)
+{
+    // Analog sticks have no force feedback to enable
+    if (js->analog) { return; }
+
+    // Handshake PIO program setup
+    uint offset_handshake = pio_add_program(js->pio, &ffb_handshake_program);
+
+    ffb_handshake_program_init(js->pio, js->sm, offset_handshake,
+            JOYSTICK_HANDSHAKE_FREQ, js->pin_trigger);
+
+    // Populate the state machine with our pulses/delays.
+    // Delays (ms):            7     30    15    78     4    59
+    uint delays[7] = { 1000,   70,   300,  150,  780,   40,  590   };
+    // Pulses (count):       1     4     3     2     2     3     2
+    uint pulses[7] = {       1,    4,    3,    2,    2,    3,    2 };
+    for (int i = 0; i < 7; i++)
+    {
+        uint32_t word = (pulses[i]-1) << 16 | (delays[i] - 1);
+        pio_sm_put(js->pio, js->sm, word);
+    }
+
+    // Activate the state machine for sending the FFB handshake
+    pio_sm_set_enabled(js->pio, js->sm, true);
+}
+
+// Call once the handshake has had time to finish (about 400 ms).
+void joystick_handshake_finish(struct Joystick *js)
+{
+    if (js->analog) { return; }
+
+    // The FFB handshake program is done now
+    pio_sm_set_enabled(js->pio, js->sm, false);
+}
+
+void joystick_capture_start(struct Joystick *js, irq_handler_t irq_handler)
+{
+    if (js->analog)
+    {
+        joystick_analog_capture_start(js);
+        return;
+    }
+
+    // Read-data PIO program setup
+    js->offset_read = read_joystick_program_add(js->pio, js->pin_clk);
+
+    // We blow away the initial FFB-handshake state machine config,
+    // because we don't need it anymore.
+    read_joystick_program_init(js->pio, js->sm, js->offset_read, JOYSTICK_READ_FREQ,
+            js->pin_trigger, js->pin_clk, js->pin_d0, js->pin_d0 + 1, js->pin_d0 + 2);
+
+    // Set up our IRQ to read the collected joystick data
+    uint pio_irq = (pio_get_index(js->pio) == 0) ? PIO0_IRQ_0 : PIO1_IRQ_0;
+    pio_set_irq0_source_enabled(js->pio, pis_interrupt0, true);
+    irq_set_exclusive_handler(pio_irq, irq_handler);
+    irq_set_enabled(pio_irq, true);
+
+    // Activate the state machine for reading the stick.
+    // This one stays on, loops, and keeps firing IRQs.
+    pio_sm_set_enabled(js->pio, js->sm, true);
+}
+
+void joystick_capture_pause(struct Joystick *js)
+{
+    if (js->analog)
+    {
+        joystick_analog_capture_pause(js);
+        return;
+    }
+
+    pio_sm_set_enabled(js->pio, js->sm, false);
+    js->single_shot = false;
+
+    // We may have stopped mid-pulse; leave the trigger low
+    pio_sm_exec(js->pio, js->sm, pio_encode_set(pio_pins, 0));
+}
+
+void joystick_capture_resume(struct Joystick *js)
+{
+    if (js->analog)
+    {
+        joystick_analog_capture_resume(js);
+        return;
+    }
+
+    // Start from the top of the program, with nothing half-read in the FIFO
+    pio_sm_restart(js->pio, js->sm);
+    pio_sm_clear_fifos(js->pio, js->sm);
+    pio_interrupt_clear(js->pio, 0);
+    pio_sm_exec(js->pio, js->sm, pio_encode_jmp(js->offset_read));
+
+    pio_sm_set_enabled(js->pio, js->sm, true);
+}
+
+void joystick_capture_once(struct Joystick *js)
+{
+    // Only the buttons matter here, and those are read directly
+    if (js->analog)
+    {
+        joystick_analog_poll(js);
+        return;
+    }
+
+    js->single_shot = true;
+    joystick_capture_resume(js);
+}
+
+void joystick_clocks_changed(struct Joystick *js)
+{
+    uart_set_baudrate(js->uart, 31250);
+
+    if (js->analog)
+    {
+        joystick_analog_clocks_changed(js);
+        return;
+    }
+
+    pio_sm_set_clkdiv(js->pio, js->sm, (float) clock_get_hz(clk_sys) / JOYSTICK_READ_FREQ);
+}
+
+void HOT_PATH_FUNC(joystick_read_irq)(struct Joystick *js)
+{
+    uint64_t raw0 = pio_sm_get(js->pio, js->sm);
+    uint64_t raw1 = pio_sm_get(js->pio, js->sm);
+    uint64_t raw = (raw1 << 16) | (raw0 >> 8);
+
+    joystick_store_frame(js, raw, time_us_32());
+
+    if (js->single_shot)
+    {
+        pio_sm_set_enabled(js->pio, js->sm, false);
+        js->single_shot = false;
+    }
+
+    pio_interrupt_clear(js->pio, 0);
+}
+
+void HOT_PATH_FUNC(joystick_poll)(struct Joystick *js)
+{
+    if (js->analog) { joystick_analog_poll(js); }
+}
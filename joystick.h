@@ -0,0 +1,152 @@
+#ifndef JOYSTICK_H
+#define JOYSTICK_H
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/uart.h"
+
+#include "ffb_midi.h"
+#include "effect_pool.h"
+#include "button_rules.h"
+#include "custom_force.h"
+#include "axis_filter.h"
+
+
+/*
+The capture IRQ only stores each 48-bit frame, with its arrival time, in a small ring.
+The main loop decodes the newest frame when it needs the result (joystick_decode()),
+so frames that are never reported are never unpacked. The axis filters still see
+every frame, as long as the main loop isn't more than JOYSTICK_FRAME_RING - 1 behind.
+
+Frame layout, from bit 0: 9 buttons (active low), X (10), Y (10), throttle (7),
+twist (6), hat (4).
+
+Analog sticks (see joystick_analog.c) have no capture IRQ: a frame is taken when
+the main loop asks for one, from axis timings that DMA keeps up to date. Their
+frames have 4 buttons (the other 5 read as released), then X (16), Y (16),
+throttle (7) and twist (6), already calibrated; there's no hat.
+*/
+#define JOYSTICK_FRAME_RING 8 // power of 2
+#define JOYSTICK_RAW_BUTTONS 0x1ff
+
+#define JOYSTICK_ANALOG_AXES 4 // X1, Y1, X2 (throttle), Y2 (twist)
+
+#define JOYSTICK_ANALOG_X_SHIFT         9
+#define JOYSTICK_ANALOG_Y_SHIFT         25
+#define JOYSTICK_ANALOG_THROTTLE_SHIFT  41
+#define JOYSTICK_ANALOG_TWIST_SHIFT     48
+
+struct JoystickReport
+{
+    uint16_t buttons;
+    uint16_t x;
+    uint16_t y;
+    uint8_t twist;
+    uint8_t throttle;
+    uint8_t hat;
+};
+
+#define JOYSTICK_REPORT_SIZE 9 // sizeof doesn't necessarily work well due to packing
+
+// PIO state machine clocks. The dividers are derived from clk_sys,
+// so they're recomputed whenever the system clock changes (see power.c).
+#define JOYSTICK_HANDSHAKE_FREQ 100000  // 10 us per cycle
+#define JOYSTICK_READ_FREQ      1000000 // 1 us per cycle
+
+// Analog axes that haven't charged by then are taken as unplugged, and read as centred
+#define JOYSTICK_ANALOG_TIMEOUT_US 4000
+// Until an axis has moved this far (in counts), it reads as centred
+#define JOYSTICK_ANALOG_MIN_RANGE 1000
+
+
+/*
+Everything belonging to one attached Sidewinder: the pins and PIO block used to read it,
+the UART used to talk MIDI to it, its latest state, and its force-feedback bookkeeping.
+*/
+struct Joystick
+{
+    // Wiring
+    PIO pio;
+    uint sm;
+    uint pin_trigger;
+    uint pin_clk;
+    uint pin_d0;        // D1 and D2 follow consecutively
+    uart_inst_t *uart;
+    uint pin_midi_tx;
+    bool analog;        // a legacy analog stick instead of a Sidewinder; see ANALOG_JOYSTICK
+    uint pin_axis0;     // analog only: Y1, X2 and Y2 follow consecutively
+
+    // Capture; written by the PIO IRQ
+    uint offset_read;
+    uint64_t frames[JOYSTICK_FRAME_RING];
+    uint32_t frame_times_us[JOYSTICK_FRAME_RING];
+    volatile uint32_t frame_count;      // frames captured; the newest is at (frame_count - 1) % ring
+    volatile uint16_t buttons_changed;  // raw button bits that changed; cleared by the main loop
+    volatile bool single_shot;          // stop capturing after the next frame
+
+    // Analog capture: one state machine and DMA channel per axis. DMA keeps the latest
+    // reading (counts left before the timeout) in analog_counts.
+    volatile uint32_t analog_counts[JOYSTICK_ANALOG_AXES];
+    uint analog_dma[JOYSTICK_ANALOG_AXES];
+    uint32_t analog_timeout;            // in counts at the current clk_sys
+    uint32_t analog_clock_hz;
+    uint32_t analog_min[JOYSTICK_ANALOG_AXES];  // calibration: the range seen so far
+    uint32_t analog_max[JOYSTICK_ANALOG_AXES];
+    uint64_t analog_scale[JOYSTICK_ANALOG_AXES]; // 65535 / range, in 32.32 fixed point
+
+    // Decoded by the main loop
+    uint32_t frames_decoded;
+    uint32_t frame_time_us;             // when the frame in report arrived
+    struct JoystickReport report;
+    struct AxisFilter filter_x;
+    struct AxisFilter filter_y;
+
+    // Force feedback
+    struct FfbMidi midi;
+    struct EffectPool pool;
+    struct ButtonRules rules;
+    struct CustomForcePlayer custom_force;
+};
+
+
+void joystick_init(struct Joystick *js);
+void joystick_handshake_start(struct Joystick *js);
+void joystick_handshake_finish(struct Joystick *js);
+void joystick_capture_start(struct Joystick *js, irq_handler_t irq_handler);
+
+// Stop polling the stick, e.g. while USB is suspended
+void joystick_capture_pause(struct Joystick *js);
+// Start polling continuously again after a pause
+void joystick_capture_resume(struct Joystick *js);
+// Read one frame, then pause again; for checking the buttons now and then while paused
+void joystick_capture_once(struct Joystick *js);
+
+// Call after changing clk_sys (and so clk_peri), to keep the PIO and UART timing right.
+// Any MIDI still in the UART FIFO must be drained first.
+void joystick_clocks_changed(struct Joystick *js);
+
+// Call from the PIO IRQ handler for this stick's PIO block
+void joystick_read_irq(struct Joystick *js);
+
+// Analog sticks: take a frame now, from the latest axis timings and the buttons.
+// Call before joystick_decode(); does nothing for Sidewinders, which have the IRQ.
+void joystick_poll(struct Joystick *js);
+
+// Analog stick capture (joystick_analog.c); joystick.c hands over to these
+void joystick_analog_capture_start(struct Joystick *js);
+void joystick_analog_capture_pause(struct Joystick *js);
+void joystick_analog_capture_resume(struct Joystick *js);
+void joystick_analog_clocks_changed(struct Joystick *js);
+void joystick_analog_poll(struct Joystick *js);
+
+// Capture side: queue a raw frame. Called from the IRQ.
+void joystick_store_frame(struct Joystick *js, uint64_t raw, uint32_t time_us);
+
+// Bring report up to date with the frames captured since the last call; cheap if there are none
+void joystick_decode(struct Joystick *js);
+
+// USB button word of the newest frame, without decoding the rest
+uint16_t joystick_buttons(struct Joystick *js);
+
+
+#endif //JOYSTICK_H
@@ -0,0 +1,161 @@
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+
+#include "joystick.h"
+#include "hot_path.h"
+
+#include "analog_axes.pio.h"
+
+#include "config.h"
+
+/*
+Legacy analog GamePort sticks. Each axis is a potentiometer charging a capacitor
+on its pin; a PIO state machine per axis drains the capacitor, then counts (in
+2-cycle steps) until the pin reads high. A DMA channel per axis copies each
+reading from the state machine's FIFO to analog_counts, so the CPU does no
+timing and takes no interrupts: it just reads the latest values when a report
+is due.
+
+Counts map to positions through a calibration that grows to cover the range
+each axis has been seen to move through, so move the stick to its corners once
+after plugging it in. The buttons are read straight from their pins.
+*/
+
+#if ANALOG_AXES > JOYSTICK_ANALOG_AXES
+#error "ANALOG_AXES can be at most 4"
+#endif
+
+#define CENTRE 0x8000
+
+static uint32_t timeout_counts()
+{
+    return (uint32_t) ((uint64_t) clock_get_hz(clk_sys) / 2 * JOYSTICK_ANALOG_TIMEOUT_US / 1000000);
+}
+
+static void reset_calibration(struct Joystick *js)
+{
+    for (int i = 0; i < JOYSTICK_ANALOG_AXES; i++)
+    {
+        js->analog_min[i] = UINT32_MAX;
+        js->analog_max[i] = 0;
+        js->analog_scale[i] = 0;
+    }
+}
+
+void joystick_analog_capture_start(struct Joystick *js)
+{
+    // Buttons short to ground; the PC's GamePort would have had the pull-ups
+    uint button_pins[4] = { js->pin_clk, js->pin_d0, js->pin_d0 + 1, js->pin_d0 + 2 };
+    for (int i = 0; i < 4; i++)
+    {
+        gpio_init(button_pins[i]);
+        gpio_pull_up(button_pins[i]);
+    }
+
+    js->analog_clock_hz = clock_get_hz(clk_sys);
+    js->analog_timeout = timeout_counts();
+    reset_calibration(js);
+
+    // X and Y are already 16-bit
+    js->filter_x.wide_samples = true;
+    js->filter_y.wide_samples = true;
+
+    uint offset = pio_add_program(js->pio, &analog_axis_program);
+
+    for (uint i = 0; i < ANALOG_AXES; i++)
+    {
+        analog_axis_program_init(js->pio, i, offset, js->pin_axis0 + i, js->analog_timeout);
+
+        js->analog_dma[i] = dma_claim_unused_channel(true);
+        dma_channel_config c = dma_channel_get_default_config(js->analog_dma[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(js->pio, i, false));
+        dma_channel_configure(js->analog_dma[i], &c, &js->analog_counts[i], &js->pio->rxf[i], UINT32_MAX, true);
+    }
+
+    pio_set_sm_mask_enabled(js->pio, (1u << ANALOG_AXES) - 1, true);
+}
+
+void joystick_analog_capture_pause(struct Joystick *js)
+{
+    pio_set_sm_mask_enabled(js->pio, (1u << ANALOG_AXES) - 1, false);
+}
+
+void joystick_analog_capture_resume(struct Joystick *js)
+{
+    pio_set_sm_mask_enabled(js->pio, (1u << ANALOG_AXES) - 1, true);
+}
+
+// Counts scale with clk_sys; carry the calibration over rather than starting again
+void joystick_analog_clocks_changed(struct Joystick *js)
+{
+    uint32_t old_hz = js->analog_clock_hz;
+    uint32_t new_hz = clock_get_hz(clk_sys);
+    if (new_hz == old_hz) { return; }
+
+    js->analog_clock_hz = new_hz;
+    js->analog_timeout = timeout_counts();
+
+    for (uint i = 0; i < ANALOG_AXES; i++)
+    {
+        analog_axis_set_timeout(js->pio, i, js->analog_timeout);
+
+        if (js->analog_max[i] < js->analog_min[i]) { continue; }
+        js->analog_min[i] = (uint64_t) js->analog_min[i] * new_hz / old_hz;
+        js->analog_max[i] = (uint64_t) js->analog_max[i] * new_hz / old_hz;
+        if (js->analog_max[i] > js->analog_min[i])
+        {
+            js->analog_scale[i] = ((uint64_t) 0xffff << 32) / (js->analog_max[i] - js->analog_min[i]);
+        }
+    }
+
+    // Readings in flight were timed at the old clock; they read as centred until replaced
+    for (uint i = 0; i < ANALOG_AXES; i++) { js->analog_counts[i] = 0; }
+}
+
+// One axis, calibrated to 16 bits; CENTRE if it's unplugged or hasn't moved enough yet
+static uint16_t HOT_PATH_FUNC(read_axis)(struct Joystick *js, uint i)
+{
+    uint32_t left = js->analog_counts[i];
+    if (left == 0 || left > js->analog_timeout) { return CENTRE; }
+
+    uint32_t count = js->analog_timeout - left;
+
+    // The division only happens when the range grows, which soon stops
+    if (count < js->analog_min[i] || count > js->analog_max[i])
+    {
+        if (count < js->analog_min[i]) { js->analog_min[i] = count; }
+        if (count > js->analog_max[i]) { js->analog_max[i] = count; }
+
+        uint32_t range = js->analog_max[i] - js->analog_min[i];
+        js->analog_scale[i] = (range >= JOYSTICK_ANALOG_MIN_RANGE) ? ((uint64_t) 0xffff << 32) / range : 0;
+    }
+
+    if (js->analog_scale[i] == 0) { return CENTRE; }
+    return ((count - js->analog_min[i]) * js->analog_scale[i]) >> 32;
+}
+
+void HOT_PATH_FUNC(joystick_analog_poll)(struct Joystick *js)
+{
+    // The DMA channels count down from UINT32_MAX transfers; at a few kHz that lasts weeks
+    for (uint i = 0; i < ANALOG_AXES; i++)
+    {
+        if (!dma_channel_is_busy(js->analog_dma[i])) { dma_channel_set_trans_count(js->analog_dma[i], UINT32_MAX, true); }
+    }
+
+    uint16_t axes[JOYSTICK_ANALOG_AXES] = { CENTRE, CENTRE, CENTRE, CENTRE };
+    for (uint i = 0; i < ANALOG_AXES; i++) { axes[i] = read_axis(js, i); }
+
+    // Buttons, active low like the Sidewinder's; the 5 it doesn't have read as released
+    uint32_t pins = gpio_get_all();
+    uint64_t raw = ((pins >> js->pin_clk) & 1) | (((pins >> js->pin_d0) & 7) << 1) | 0x1f0;
+
+    raw |= (uint64_t) axes[0] << JOYSTICK_ANALOG_X_SHIFT;
+    raw |= (uint64_t) axes[1] << JOYSTICK_ANALOG_Y_SHIFT;
+    raw |= (uint64_t) (axes[2] >> 9) << JOYSTICK_ANALOG_THROTTLE_SHIFT;
+    raw |= (uint64_t) (axes[3] >> 10) << JOYSTICK_ANALOG_TWIST_SHIFT;
+
+    joystick_store_frame(js, raw, time_us_32());
+}
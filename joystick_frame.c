@@ -0,0 +1,117 @@
+#include "joystick.h"
+#include "hot_path.h"
+
+#include "config.h"
+
+/*
+Frame capture and decoding, kept apart from the PIO and UART handling in joystick.c
+so it can be built and benchmarked on a PC (see tools/bench).
+*/
+
+#define FRAME_MASK (JOYSTICK_FRAME_RING - 1)
+
+// The axis filters work on a 16-bit scale; without HIGH_RES_AXES we report 10 bits.
+#ifdef HIGH_RES_AXES
+    #define AXIS_REPORT_SHIFT 0
+#else
+    #define AXIS_REPORT_SHIFT 6
+#endif
+
+#define RAW_X(raw)          (((raw) >>  9) & 0x3ff)
+#define RAW_Y(raw)          (((raw) >> 19) & 0x3ff)
+#define RAW_THROTTLE(raw)   (((raw) >> 29) & 0x07f)
+#define RAW_TWIST(raw)      (((raw) >> 36) & 0x03f)
+#define RAW_HAT(raw)        (((raw) >> 42) & 0x00f)
+
+#define ANALOG_X(raw)           (((raw) >> JOYSTICK_ANALOG_X_SHIFT) & 0xffff)
+#define ANALOG_Y(raw)           (((raw) >> JOYSTICK_ANALOG_Y_SHIFT) & 0xffff)
+#define ANALOG_THROTTLE(raw)    (((raw) >> JOYSTICK_ANALOG_THROTTLE_SHIFT) & 0x7f)
+#define ANALOG_TWIST(raw)       (((raw) >> JOYSTICK_ANALOG_TWIST_SHIFT) & 0x3f)
+
+/*
+Raw button bits (active low) to the USB button word, for the button mode picked in config.h.
+The table is built by the preprocessor, so neither mode costs a branch at run time.
+*/
+#ifdef FIRMWARE_SHIFT
+// The shift button moves the other 8 up to the upper byte
+#define BUTTONS(raw) ((uint16_t) ((~(raw) & 0x100) ? (~(raw) & 0xff) << 8 : ~(raw) & 0xff))
+#else
+#define BUTTONS(raw) ((uint16_t) (~(raw) & JOYSTICK_RAW_BUTTONS))
+#endif
+
+#define BUTTONS_4(n)    BUTTONS(n), BUTTONS(n + 1), BUTTONS(n + 2), BUTTONS(n + 3)
+#define BUTTONS_16(n)   BUTTONS_4(n), BUTTONS_4(n + 4), BUTTONS_4(n + 8), BUTTONS_4(n + 12)
+#define BUTTONS_64(n)   BUTTONS_16(n), BUTTONS_16(n + 16), BUTTONS_16(n + 32), BUTTONS_16(n + 48)
+#define BUTTONS_256(n)  BUTTONS_64(n), BUTTONS_64(n + 64), BUTTONS_64(n + 128), BUTTONS_64(n + 192)
+
+static const uint16_t HOT_PATH_DATA(raw_to_buttons) raw_to_buttons[JOYSTICK_RAW_BUTTONS + 1] = { BUTTONS_256(0), BUTTONS_256(256) };
+
+void HOT_PATH_FUNC(joystick_store_frame)(struct Joystick *js, uint64_t raw, uint32_t time_us)
+{
+    uint32_t count = js->frame_count;
+    uint64_t previous = js->frames[(count - 1) & FRAME_MASK];
+
+    js->frames[count & FRAME_MASK] = raw;
+    js->frame_times_us[count & FRAME_MASK] = time_us;
+    js->buttons_changed |= (raw ^ previous) & JOYSTICK_RAW_BUTTONS;
+
+    // The frame must be in place before the main loop can see the new count
+    __compiler_memory_barrier();
+    js->frame_count = count + 1;
+}
+
+void HOT_PATH_FUNC(joystick_decode)(struct Joystick *js)
+{
+    uint32_t count = js->frame_count;
+    __compiler_memory_barrier();
+
+    if (count == js->frames_decoded) { return; }
+
+    // Averaging filters need every frame, not just the newest. Leave out the slot the IRQ
+    // writes next, in case it lands while we're reading.
+    uint32_t first = js->frames_decoded;
+    if (count - first > JOYSTICK_FRAME_RING - 1) { first = count - (JOYSTICK_FRAME_RING - 1); }
+    if (axis_filter_get_mode() == AXIS_FILTER_NONE) { first = count - 1; }
+
+    uint16_t x = 0;
+    uint16_t y = 0;
+    for (uint32_t n = first; n != count; n++)
+    {
+        uint64_t raw = js->frames[n & FRAME_MASK];
+        uint32_t time_us = js->frame_times_us[n & FRAME_MASK];
+
+        x = axis_filter_update(&js->filter_x, js->analog ? ANALOG_X(raw) : RAW_X(raw), time_us);
+        y = axis_filter_update(&js->filter_y, js->analog ? ANALOG_Y(raw) : RAW_Y(raw), time_us);
+    }
+
+    uint64_t raw = js->frames[(count - 1) & FRAME_MASK];
+
+    js->report.buttons  = raw_to_buttons[raw & JOYSTICK_RAW_BUTTONS];
+    js->report.x        = x >> AXIS_REPORT_SHIFT;
+    js->report.y        = y >> AXIS_REPORT_SHIFT;
+
+    if (js->analog)
+    {
+        js->report.twist    = ANALOG_TWIST(raw);
+        js->report.throttle = ANALOG_THROTTLE(raw);
+        js->report.hat      = 0;
+    }
+    else
+    {
+        js->report.twist    = RAW_TWIST(raw);
+        js->report.throttle = RAW_THROTTLE(raw);
+        js->report.hat      = RAW_HAT(raw);
+    }
+
+    js->frame_time_us = js->frame_times_us[(count - 1) & FRAME_MASK];
+    js->frames_decoded = count;
+}
+
+uint16_t HOT_PATH_FUNC(joystick_buttons)(struct Joystick *js)
+{
+    uint32_t count = js->frame_count;
+    __compiler_memory_barrier();
+
+    if (count == 0) { return 0; }
+    return raw_to_buttons[js->frames[(count - 1) & FRAME_MASK] & JOYSTICK_RAW_BUTTONS];
+}
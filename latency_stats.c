@@ -0,0 +1,106 @@
+#include "hardware/clocks.h"
+#include "hardware/exception.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/structs/xip_ctrl.h"
+
+#include "latency_stats.h"
+#include "hot_path.h"
+
+#ifdef LATENCY_STATS
+
+// Each path has a single writer (the probe, the capture IRQ or the main loop);
+// latency_stats_take() resets them with interrupts off.
+struct LatencyTiming latency_paths[LATENCY_NUM_PATHS];
+
+// The hardware counters are 32 bits and can wrap in under a minute, so the probe
+// folds them in here on every wrap of SysTick
+uint64_t latency_xip_accesses;
+uint64_t latency_xip_hits;
+
+uint32_t latency_window_start_us;
+
+struct LatencyStats latency_last_window;
+
+static void HOT_PATH_FUNC(add_timing)(struct LatencyTiming *timing, uint32_t cycles)
+{
+    if (timing->count == 0 || cycles < timing->min_cycles) { timing->min_cycles = cycles; }
+    if (cycles > timing->max_cycles) { timing->max_cycles = cycles; }
+    timing->total_cycles += cycles;
+    timing->count++;
+}
+
+static void HOT_PATH_FUNC(fold_xip_counters)()
+{
+    // A few accesses between the reads and the clear are lost, which doesn't matter here
+    uint32_t accesses = xip_ctrl_hw->ctr_acc;
+    uint32_t hits = xip_ctrl_hw->ctr_hit;
+    xip_ctrl_hw->ctr_acc = 0;
+    xip_ctrl_hw->ctr_hit = 0;
+
+    latency_xip_accesses += accesses;
+    latency_xip_hits += hits;
+}
+
+// Pends as SysTick wraps from 0 to CPU_LOAD_SYSTICK_MASK, so the count since then is the latency
+static void HOT_PATH_FUNC(probe_handler)()
+{
+    uint32_t cycles = CPU_LOAD_SYSTICK_MASK - cpu_load_mark();
+
+    add_timing(&latency_paths[LATENCY_IRQ_ENTRY], cycles);
+    fold_xip_counters();
+}
+
+void latency_stats_init()
+{
+    fold_xip_counters();
+    latency_xip_accesses = 0;
+    latency_xip_hits = 0;
+    latency_window_start_us = time_us_32();
+
+    // Compete with the capture IRQ on equal terms, rather than preempting it
+    exception_set_exclusive_handler(SYSTICK_EXCEPTION, probe_handler);
+    exception_set_priority(SYSTICK_EXCEPTION, PICO_DEFAULT_IRQ_PRIORITY);
+    systick_hw->csr |= M0PLUS_SYST_CSR_TICKINT_BITS;
+}
+
+void HOT_PATH_FUNC(latency_stats_record)(enum LatencyPath path, uint32_t start)
+{
+    add_timing(&latency_paths[path], cpu_load_cycles(start, cpu_load_mark()));
+}
+
+const struct LatencyStats *latency_stats_take()
+{
+    struct LatencyStats *stats = &latency_last_window;
+    uint32_t now_us = time_us_32();
+
+    uint32_t saved = save_and_disable_interrupts();
+
+    fold_xip_counters();
+
+    stats->sys_hz = clock_get_hz(clk_sys);
+    stats->window_us = now_us - latency_window_start_us;
+#ifdef RAM_HOT_PATH
+    stats->ram_hot_path = 1;
+#else
+    stats->ram_hot_path = 0;
+#endif
+    stats->xip_accesses = latency_xip_accesses;
+    stats->xip_hits = latency_xip_hits;
+
+    for (int i = 0; i < LATENCY_NUM_PATHS; i++)
+    {
+        stats->paths[i] = latency_paths[i];
+        latency_paths[i] = (struct LatencyTiming) { 0 };
+    }
+
+    latency_xip_accesses = 0;
+    latency_xip_hits = 0;
+    latency_window_start_us = now_us;
+
+    restore_interrupts(saved);
+
+    return stats;
+}
+
+#endif // LATENCY_STATS
@@ -0,0 +1,83 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+
+#ifdef LATENCY_STATS
+#include "cpu_load.h"
+#endif
+
+
+/*
+Measurements for comparing the default build with RAM_HOT_PATH (see hot_path.h)
+on a real workload: how often the XIP cache missed, how long interrupts take to
+be serviced, and how long the hot paths take, in clk_sys cycles.
+
+Interrupt latency comes from a probe on SysTick, which cpu_load.c already runs
+from clk_sys: its wrap interrupt is enabled, at the same priority as the capture
+IRQ, and the handler reads how many cycles have passed since the wrap. That's
+every 134 ms at 125 MHz. It includes waking from WFE when the CPU was asleep,
+and waiting out whatever IRQ of the same priority was running.
+
+Each read over the diagnostics interface (tools/diag.py latency) returns what
+was measured since the previous one, then starts afresh.
+*/
+
+enum LatencyPath
+{
+    LATENCY_IRQ_ENTRY,      // SysTick probe: from the interrupt to its handler
+    LATENCY_FRAME_IRQ,      // the whole capture IRQ
+    LATENCY_HID_REPORT,     // decoding a frame and queueing its report
+    LATENCY_SET_REPORT,     // handling a report from the host, MIDI sends included
+    LATENCY_NUM_PATHS
+};
+
+struct __attribute__((__packed__)) LatencyTiming
+{
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+};
+
+// Packed, since it goes over USB as-is
+struct __attribute__((__packed__)) LatencyStats
+{
+    uint32_t sys_hz;
+    uint32_t window_us;         // since the previous read
+    uint8_t ram_hot_path;       // whether this build has RAM_HOT_PATH
+    uint8_t reserved[3];
+    uint64_t xip_accesses;      // cached XIP reads, from any bus master
+    uint64_t xip_hits;
+    struct LatencyTiming paths[LATENCY_NUM_PATHS];
+};
+
+
+#ifdef LATENCY_STATS
+
+// Call after cpu_load_init()
+void latency_stats_init();
+
+static inline uint32_t latency_stats_mark()
+{
+    return cpu_load_mark();
+}
+
+// Time from a latency_stats_mark() to now, for one of the paths
+void latency_stats_record(enum LatencyPath path, uint32_t start);
+
+// Everything since the previous call
+const struct LatencyStats *latency_stats_take();
+
+#else
+
+static inline void latency_stats_init() {}
+static inline uint32_t latency_stats_mark() { return 0; }
+static inline void latency_stats_record(enum LatencyPath path, uint32_t start) {}
+
+#endif // LATENCY_STATS
+
+
+#endif //LATENCY_STATS_H
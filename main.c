@@ -3,166 +3,271 @@
 #include "pico/stdlib.h"
 #include "hardware/pio.h"
 #include "hardware/uart.h"
+#include "hardware/structs/scb.h"
 
 #include "tusb.h"
 
-#include "ffb_handshake.pio.h"
-#include "read_joystick.pio.h"
-#include "ffb_midi.h"
+#include "joystick.h"
+#include "usb.h"
+#include "pid_table.h"
+#include "diag.h"
+#include "trace.h"
+#include "power.h"
+#include "cpu_load.h"
+#include "latency_stats.h"
+#include "hot_path.h"
+#include "sched.h"
+#include "midi_passthrough.h"
 
 #include "config.h"
 
 
-struct JoystickState
+/*
+Each stick gets its own PIO block and UART, so both can be polled at full rate
+and have their own effects. The second stick is optional; see NUM_JOYSTICKS.
+*/
+struct Joystick joysticks[NUM_JOYSTICKS] =
 {
-    uint16_t buttons        ;
-    uint16_t x          : 10;
-    uint16_t y          : 10;
-    uint8_t  throttle   :  7;
-    uint8_t  twist      :  6;
-    uint8_t  hat        :  4;
-} joystickState;
+    {
+        .pio = pio0,
+        .sm = 0,
+        .pin_trigger = PIN_TRIGGER,
+        .pin_clk = PIN_CLK,
+        .pin_d0 = PIN_D0,
+        .uart = uart0,
+        .pin_midi_tx = PIN_MIDI_TX,
+#ifdef ANALOG_JOYSTICK
+        .analog = true,
+        .pin_axis0 = PIN_ANALOG_AXIS0,
+#endif
+    },
+#if NUM_JOYSTICKS > 1
+    {
+        .pio = pio1,
+        .sm = 0,
+        .pin_trigger = PIN_TRIGGER_2,
+        .pin_clk = PIN_CLK_2,
+        .pin_d0 = PIN_D0_2,
+        .uart = uart1,
+        .pin_midi_tx = PIN_MIDI_TX_2,
+    },
+#endif
+};
 
-struct report
+static inline void joystick_irq(int i)
 {
-    uint16_t buttons;
-    uint16_t x;
-    uint16_t y;
-    uint8_t twist;
-    uint8_t throttle;
-    uint8_t hat;
-} report;
+    uint32_t start = cpu_load_mark();
+    TRACE_IRQ(TRACE_FRAME_IRQ_BEGIN, i, 0);
 
-uint16_t report_size_bytes = 9; // sizeof doesn't necessarily work well due to packing
+    joystick_read_irq(&joysticks[i]);
 
-uint rxFifoEntries;
-uint32_t raw0;
-uint32_t raw1;
-uint64_t joystickStateRaw;
+    TRACE_IRQ(TRACE_FRAME_IRQ_END, i, joystick_buttons(&joysticks[i]));
+    cpu_load_account(CPU_FRAME_IRQ, start);
+    latency_stats_record(LATENCY_FRAME_IRQ, start);
+}
 
+void HOT_PATH_FUNC(joystickReadIRQ0)()
+{
+    joystick_irq(0);
+}
 
-void joystickReadIRQ()
+#if NUM_JOYSTICKS > 1
+void HOT_PATH_FUNC(joystickReadIRQ1)()
 {
-    const PIO pio = pio0;
-    const uint sm = 0;
+    joystick_irq(1);
+}
+#endif
 
-    rxFifoEntries = pio_sm_get_rx_fifo_level(pio, sm);
+const irq_handler_t joystick_irq_handlers[NUM_JOYSTICKS] =
+{
+    joystickReadIRQ0,
+#if NUM_JOYSTICKS > 1
+    joystickReadIRQ1,
+#endif
+};
 
-    uint64_t raw0 = pio_sm_get(pio, sm);
-    uint64_t raw1 = pio_sm_get(pio, sm);
-    uint64_t raw = (raw1 << 16) | (raw0 >> 8);
+void usb_task()
+{
+#ifdef TRACE_ENABLED
+    // Only trace passes with something to do; idle ones would flood the trace
+    if (!tud_task_event_ready())
+    {
+        tud_task();
+        return;
+    }
 
-#ifdef FIRMWARE_SHIFT
-    bool shift = ((~raw) & 0x100) != 0;
-    uint16_t buttons = (~raw) & 0xff;
-    joystickState.buttons = shift ? (buttons << 8) : buttons;
+    TRACE(TRACE_USB_TASK_BEGIN, 0, 0);
+    tud_task();
+    TRACE(TRACE_USB_TASK_END, 0, 0);
 #else
-    joystickState.buttons   = ~(raw & 0x1ff);
+    tud_task();
 #endif
+}
+
+void HOT_PATH_FUNC(hid_task)()
+{
+    // While suspended, power_task() takes care of waking the host
+    if (!power_is_active()) { return; }
+
+    // Each stick has its own HID interface
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        if (!tud_hid_n_ready(i)) { continue; }
 
-    joystickState.x         = (raw >>  9) & 0x3ff;
-    joystickState.y         = (raw >> 19) & 0x3ff;
-    joystickState.throttle  = (raw >> 29) & 0x07f;
-    joystickState.twist     = (raw >> 36) & 0x03f;
-    joystickState.hat       = (raw >> 42) & 0x00f;
+        uint32_t start = latency_stats_mark();
 
-    report.buttons = joystickState.buttons;
-    report.x = joystickState.x;
-    report.y = joystickState.y;
-    report.twist = joystickState.twist;
-    report.throttle = joystickState.throttle;
-    report.hat = joystickState.hat;
+        // Decoding waits until now, so frames that would never be sent aren't decoded.
+        // Analog sticks take their frame now, too.
+        joystick_poll(&joysticks[i]);
+        joystick_decode(&joysticks[i]);
 
-    pio_interrupt_clear(pio, 0);
+        power_record_report_latency(time_us_32() - joysticks[i].frame_time_us);
+        tud_hid_n_report(i, 0x01, &joysticks[i].report, JOYSTICK_REPORT_SIZE);
+        latency_stats_record(LATENCY_HID_REPORT, start);
+    }
 }
 
-void hid_task()
+void button_rules_task()
 {
-    if (tud_suspended())
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
     {
-        tud_remote_wakeup();
+        struct Joystick *js = &joysticks[i];
+
+        // Only look at the button rules when the capture IRQ saw a change.
+        // Clear the flag before sampling, so a change that lands in between isn't lost.
+        if (js->buttons_changed)
+        {
+            js->buttons_changed = 0;
+            button_rules_evaluate(&js->rules, &js->pool, joystick_buttons(js));
+        }
     }
-    else
+}
+
+// Anything that arrived during this pass, after its handler had already run
+void custom_force_task_all()
+{
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
     {
-        if (!tud_hid_ready()) { return; }
+        custom_force_task(&joysticks[i].custom_force);
+    }
+}
 
-        tud_hid_n_report(0x00, 0x01, &report, report_size_bytes);
+// Definitions for effects created during this pass, now that the host has its answer
+void effect_pool_task_all()
+{
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        effect_pool_task(&joysticks[i].pool);
     }
 }
 
+absolute_time_t custom_force_wake_deadline_all()
+{
+    absolute_time_t deadline = at_the_end_of_time;
 
-int main()
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        deadline = absolute_time_min(deadline, custom_force_get_wake_deadline(&joysticks[i].custom_force));
+    }
+
+    return deadline;
+}
+
+absolute_time_t effect_pool_wake_deadline_all()
 {
-    tud_init(0);
+    absolute_time_t deadline = at_the_end_of_time;
 
-    // Hardware UART setup.
-    // The default is 8 data bits, no parity bit, and 1 stop bit.
-    uart_init(uart0, 31250);
-    gpio_set_function(PIN_MIDI_TX, UART_FUNCSEL_NUM(uart0, PIN_MIDI_TX));
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        deadline = absolute_time_min(deadline, effect_pool_get_wake_deadline(&joysticks[i].pool));
+    }
+
+    return deadline;
+}
+
+// Each frame's reports are due at its SOF, and should be queued before the next one
+void tud_sof_cb(uint32_t frame_count)
+{
+    sched_release(SCHED_HID);
+}
+
+/*
+The main loop's jobs, in the order each pass runs them (see sched.h). Everything
+gets a frame to finish once it's due; diag and power are housekeeping, and run
+at most once per SCHED_TIMER_PERIOD_US unless power has a timed job.
+*/
+const struct SchedTask sched_task_table[SCHED_NUM_TASKS] =
+{
+    [SCHED_USB]              = { usb_task,              0,                     SCHED_FRAME_US, CPU_USB,              NULL },
+    [SCHED_HID]              = { hid_task,              0,                     SCHED_FRAME_US, CPU_HID,              NULL },
+    [SCHED_MIDI_PASSTHROUGH] = { midi_passthrough_task, 0,                     SCHED_FRAME_US, CPU_MIDI_PASSTHROUGH, midi_passthrough_get_wake_deadline },
+    [SCHED_DIAG]             = { diag_task,             SCHED_TIMER_PERIOD_US, SCHED_FRAME_US, CPU_DIAG,             NULL },
+    [SCHED_POWER]            = { power_task,            SCHED_TIMER_PERIOD_US, SCHED_FRAME_US, CPU_POWER,            power_get_wake_deadline },
+    [SCHED_BUTTON_RULES]     = { button_rules_task,     0,                     SCHED_FRAME_US, CPU_BUTTON_RULES,     NULL },
+    [SCHED_CUSTOM_FORCE]     = { custom_force_task_all, 0,                     SCHED_FRAME_US, CPU_CUSTOM_FORCE,     custom_force_wake_deadline_all },
+    [SCHED_EFFECT_UPLOAD]    = { effect_pool_task_all,  0,                     SCHED_FRAME_US, CPU_EFFECT_UPLOAD,    effect_pool_wake_deadline_all },
+};
+
+bool work_pending()
+{
+    if (tud_task_event_ready()) { return true; }
+
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        if (joysticks[i].buttons_changed) { return true; }
+    }
+
+    return false;
+}
 
-    // PIO setup
-    PIO pio = pio0;
-    uint sm = 0;
 
-    // Handshake PIO program setup
-    uint offset_handshake = pio_add_program(pio, &ffb_handshake_program);
-    uint freq_handshake = 100000;
+int main()
+{
+    power_init(joysticks, NUM_JOYSTICKS);
 
-    ffb_handshake_program_init(pio, sm, offset_handshake,
-            freq_handshake, PIN_TRIGGER);
+    pid_table_init();
+    tud_init(0);
 
-    // Populate the state machine with our pulses/delays.
-    // Delays (ms):            7     30    15    78     4    59
-    uint delays[7] = { 1000,   70,   300,  150,  780,   40,  590   };
-    // Pulses (count):       1     4     3     2     2     3     2
-    uint pulses[7] = {       1,    4,    3,    2,    2,    3,    2 };
-    for (int i = 0; i < 7; i++)
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
     {
-        uint32_t word = (pulses[i]-1) << 16 | (delays[i] - 1);
-        pio_sm_put(pio, sm, word);
+        joystick_init(&joysticks[i]);
+        usb_set_effect_pool(i, &joysticks[i].pool);
+        usb_set_custom_force_player(i, &joysticks[i].custom_force);
+        midi_passthrough_set_target(i, &joysticks[i].midi);
+        diag_set_effect_pool(i, &joysticks[i].pool);
+        diag_set_button_rules(i, &joysticks[i].rules);
     }
 
-    // Activate the state machine for sending the FFB handshake
-    pio_sm_set_enabled(pio, sm, true);
+    // Both sticks can be handshaken at once, since they're on separate PIO blocks.
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        joystick_handshake_start(&joysticks[i]);
+    }
 
-    // Wait for the state machine to finish enabling FFB.
+    // Wait for the state machines to finish enabling FFB.
     // We could do this via an IRQ, but we know how long it takes.
     sleep_ms(400);
 
-    // The FFB handshake program is done now
-    pio_sm_set_enabled(pio, sm, false);
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        joystick_handshake_finish(&joysticks[i]);
 
-    // Now that the handshake is done, we can send MIDI commands.
+        // Now that the handshake is done, we can send MIDI commands.
 #ifdef DISABLE_AUTO_CENTER
-    // We'll start by disabling the built-in auto-center effect.
-    ffb_midi_set_autocenter(uart0, false);
+        // We'll start by disabling the built-in auto-center effect.
+        ffb_midi_set_autocenter(&joysticks[i].midi, false);
 #endif // DISABLE_AUTO_CENTER
 
-    // Read-data PIO program setup
-    uint offset_readjoy = pio_add_program(pio, &read_joystick_program);
-    uint freq_readjoy = 1000000;
-
-    // We blow away the initial FFB-handshake state machine config,
-    // because we don't need it anymore.
-    read_joystick_program_init(pio, sm, offset_readjoy, freq_readjoy,
-            PIN_TRIGGER, PIN_CLK, PIN_D0, PIN_D1, PIN_D2);
-
-    // Set up our IRQ to read the collected joystick data
-    uint pio_irq = PIO0_IRQ_0;
-    pio_set_irq0_source_enabled(pio0, pis_interrupt0, true);
-    irq_set_exclusive_handler(pio_irq, joystickReadIRQ);
-    irq_set_enabled(pio_irq, true);
-
-    // Activate the state machine for reading the stick.
-    // This one stays on, loops, and keeps firing IRQs.
-    pio_sm_set_enabled(pio, sm, true);
+        joystick_capture_start(&joysticks[i], joystick_irq_handlers[i]);
+    }
 
 /*
 Most games don't actually support force-feedback, but we can still use the joystick's
 FFB to enhance them. We do so by adding two effects: a light spring effect that is
 (at least in this author's opinion) gentler and more pleasant than the stock auto-center,
 and a kickback effect that plays when the trigger is pulled, and sustains a little while
-the trigger is held.
+the trigger is held. The kickback uses the stick's own button mask, so the stick starts
+and stops it by itself without waiting on USB or MIDI.
 */
 #ifdef EXAMPLE_EFFECTS
 
@@ -181,7 +286,7 @@ the trigger is held.
         .play_immediately = false,
         .type = MIDI_ET_CONSTANT,
         .duration = 0x3fff, // must be finite for the envelope to restart when stopping/playing
-        .button_mask = 0x00,
+        .button_mask = 0x01, // trigger
         .direction = 0,
         .gain = 0x7f,
         .sample_rate = 100,
@@ -194,30 +299,35 @@ the trigger is held.
         .amplitude = 0x7f,
     };
 
-    int effect_id_spring = ffb_midi_define_effect(uart0, &lightSpringEffect);
-    int effect_id_kickback = ffb_midi_define_effect(uart0, &kickbackEffect);
-
-    bool fire_old;
+    for (int i = 0; i < NUM_JOYSTICKS; i++)
+    {
+        ffb_midi_define_effect(&joysticks[i].midi, &lightSpringEffect);
+        ffb_midi_define_effect(&joysticks[i].midi, &kickbackEffect);
+    }
 
 #endif
 
-    // Main USB loop
+    // Any interrupt that becomes pending sets the event flag, so one arriving just before
+    // the WFE below still wakes us, instead of being slept through.
+    scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS;
+
+    cpu_load_init();
+    latency_stats_init();
+
+    sched_init(sched_task_table);
+    tud_sof_cb_enable(true);
+
+    // Main USB loop. Each pass runs whatever tasks are due, then sleeps until an interrupt
+    // (USB, a captured frame) or a timed job (see sched.h) needs us.
     while (1)
     {
-        tud_task(); // tinyusb device task
-        hid_task();
+        uint32_t start = cpu_load_mark();
 
-#ifdef EXAMPLE_EFFECTS
-        bool fire = (joystickState.buttons & 0x0001) != 0;
-        if (fire && !fire_old)
-        {
-            ffb_midi_play(uart0, effect_id_kickback);
-        }
-        else if (!fire && fire_old)
-        {
-            ffb_midi_pause(uart0, effect_id_kickback);
-        }
-        fire_old = fire;
-#endif
+        sched_run_pass();
+
+        bool idle = !work_pending();
+        cpu_load_end_iteration(start, idle);
+
+        if (idle) { sched_sleep(); }
     }
 }
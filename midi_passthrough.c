@@ -0,0 +1,158 @@
+#include "tusb.h"
+
+#include "midi_passthrough.h"
+
+#ifdef MIDI_PASSTHROUGH
+
+// Past this, reading stops and USB holds the host off, rather than the main loop blocking on the UART
+#define MAX_BACKLOG_US 10000
+
+// One interface's MIDI, being put back together into whole messages
+struct PassthroughStream
+{
+    struct FfbMidi *midi;
+    uint8_t msg[MIDI_PASSTHROUGH_MAX_MESSAGE];
+    size_t size;
+    size_t expected;        // the length of the message in progress; 0 for SysEx, which runs to 0xf7
+    uint8_t running_status;
+    bool modify_head;       // msg holds a modify's 0xb5 half, waiting for the 0xa5 one
+};
+
+struct PassthroughStream passthrough_streams[CFG_TUD_MIDI];
+
+void midi_passthrough_set_target(uint8_t instance, struct FfbMidi *midi)
+{
+    if (instance < CFG_TUD_MIDI) { passthrough_streams[instance].midi = midi; }
+}
+
+static size_t message_length(uint8_t status)
+{
+    if (status < 0xc0 || (status >= 0xe0 && status < 0xf0)) { return 3; }
+    if (status < 0xe0) { return 2; }
+
+    switch (status)
+    {
+        case 0xf0:  return 0;
+        case 0xf1:
+        case 0xf3:  return 2;
+        case 0xf2:  return 3;
+        default:    return 1;
+    }
+}
+
+static void message_complete(struct PassthroughStream *s)
+{
+    // Play solo, erase, play and pause (0x00 to 0x30) stand alone; a modify parameter is the first half of two
+    if (s->size == 3 && s->msg[0] == 0xb5 && s->msg[1] >= 0x40)
+    {
+        s->modify_head = true;
+        return;
+    }
+
+    ffb_midi_forward(s->midi, s->msg, s->size);
+    s->size = 0;
+    s->modify_head = false;
+}
+
+static void receive_byte(struct PassthroughStream *s, uint8_t byte)
+{
+    // Real-time bytes don't interrupt anything, and the stick has no use for them
+    if (byte >= 0xf8) { return; }
+
+    if (byte == 0xf7)
+    {
+        if (s->size > 0 && s->msg[0] == 0xf0 && s->size < sizeof(s->msg))
+        {
+            s->msg[s->size++] = byte;
+            message_complete(s);
+        }
+        s->size = 0;
+        return;
+    }
+
+    if (byte & 0x80)
+    {
+        if (s->modify_head && byte == 0xa5)
+        {
+            s->msg[s->size++] = byte;
+            s->expected = 6;
+            s->running_status = 0;
+            s->modify_head = false;
+            return;
+        }
+
+        // Whatever was in progress is cut short, and dropped
+        s->size = 0;
+        s->modify_head = false;
+        s->msg[s->size++] = byte;
+        s->expected = message_length(byte);
+        // 0xa5 isn't kept as running status: a modify's value only comes along with its 0xb5 half
+        s->running_status = (byte < 0xf0 && byte != 0xa5) ? byte : 0;
+
+        if (s->expected == 1) { message_complete(s); }
+        return;
+    }
+
+    // A modify's first half, not followed by its second
+    if (s->modify_head)
+    {
+        s->size = 0;
+        s->modify_head = false;
+    }
+
+    if (s->size == 0)
+    {
+        // A data byte with no status of its own
+        if (s->running_status == 0) { return; }
+        s->msg[s->size++] = s->running_status;
+        s->expected = message_length(s->running_status);
+    }
+
+    if (s->size == sizeof(s->msg))
+    {
+        s->size = 0;
+        return;
+    }
+
+    s->msg[s->size++] = byte;
+    if (s->expected != 0 && s->size == s->expected) { message_complete(s); }
+}
+
+void midi_passthrough_task()
+{
+    for (uint8_t i = 0; i < CFG_TUD_MIDI; i++)
+    {
+        struct PassthroughStream *s = &passthrough_streams[i];
+        if (s->midi == NULL) { continue; }
+
+        // A packet's worth at a time, so the backlog check keeps up
+        uint8_t buffer[4];
+        while (ffb_midi_tx_backlog_us(s->midi) < MAX_BACKLOG_US && tud_midi_n_available(i, 0) > 0)
+        {
+            uint32_t count = tud_midi_n_stream_read(i, 0, buffer, sizeof(buffer));
+            if (count == 0) { break; }
+
+            for (uint32_t j = 0; j < count; j++) { receive_byte(s, buffer[j]); }
+        }
+    }
+}
+
+absolute_time_t midi_passthrough_get_wake_deadline()
+{
+    absolute_time_t deadline = at_the_end_of_time;
+
+    for (uint8_t i = 0; i < CFG_TUD_MIDI; i++)
+    {
+        struct PassthroughStream *s = &passthrough_streams[i];
+        if (s->midi == NULL || tud_midi_n_available(i, 0) == 0) { continue; }
+
+        // Held off by the backlog; come back once it's down to the limit
+        uint32_t backlog_us = ffb_midi_tx_backlog_us(s->midi);
+        uint32_t wait_us = (backlog_us > MAX_BACKLOG_US) ? backlog_us - MAX_BACKLOG_US : 0;
+        deadline = absolute_time_min(deadline, make_timeout_time_us(wait_us));
+    }
+
+    return deadline;
+}
+
+#endif // MIDI_PASSTHROUGH
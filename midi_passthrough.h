@@ -0,0 +1,47 @@
+#ifndef MIDI_PASSTHROUGH_H
+#define MIDI_PASSTHROUGH_H
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "ffb_midi.h"
+
+
+/*
+A USB-MIDI interface per stick, for software that speaks the Sidewinder's own
+MIDI dialect and would rather drive it directly than through HID PID. What the
+host sends goes out to that stick as it is, without PID's translation.
+
+Messages are put back together from the USB-MIDI packets before they go out,
+and a modify's 0xb5 and 0xa5 halves are kept together, so nothing of ours is
+sent in the middle of one. ffb_midi_forward() (see ffb_midi.c) decides what
+each does to the stick's slots, and refuses anything that would disturb the
+effects the PID side has there. A program that tracks effect IDs itself should
+have the stick to itself: the stick gives a new effect the lowest free slot,
+and PID effects may be holding some.
+*/
+
+#define MIDI_PASSTHROUGH_MAX_MESSAGE 64     // longer than any SysEx the stick takes
+
+
+#ifdef MIDI_PASSTHROUGH
+
+// Send MIDI arriving on a stick's USB-MIDI interface to that stick
+void midi_passthrough_set_target(uint8_t instance, struct FfbMidi *midi);
+
+// Call from the main loop
+void midi_passthrough_task();
+
+// When midi_passthrough_task() should run again, if the link held it back
+absolute_time_t midi_passthrough_get_wake_deadline();
+
+#else
+
+static inline void midi_passthrough_set_target(uint8_t instance, struct FfbMidi *midi) {}
+static inline void midi_passthrough_task() {}
+static inline absolute_time_t midi_passthrough_get_wake_deadline() { return at_the_end_of_time; }
+
+#endif // MIDI_PASSTHROUGH
+
+
+#endif //MIDI_PASSTHROUGH_H
@@ -0,0 +1,202 @@
+#include "pid_table.h"
+#include "usb_report_ids.h"
+#include "hot_path.h"
+
+#include "config.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// The table. Offsets follow the report layouts in usb_descriptors.h.
+/////////////////////////////////////////////////////////////////////
+
+#define SET_EFFECT_DIRECTION_ENABLE_OFFSET 10
+#define SET_EFFECT_DIRECTION_ENABLE_BIT 0x04
+
+static const struct PidField HOT_PATH_DATA(set_effect_fields) set_effect_fields[] =
+{
+    { .offset = 2,  .size = 2, .conversion = PID_CONV_DURATION,  .param = MODIFY_DURATION },
+    // Let the stick fire the effect itself when the trigger button is pressed.
+    { .offset = 9,  .size = 1, .conversion = PID_CONV_TRIGGER,   .param = MODIFY_BUTTON_MASK },
+    { .offset = 8,  .size = 1, .conversion = PID_CONV_RAW,       .param = MODIFY_GAIN,
+            .flags = PID_FIELD_PERIODIC_ONLY },
+    // TODO axes enable, trigger interval, direction Y
+    { .offset = 11, .size = 1, .conversion = PID_CONV_DIRECTION, .param = MODIFY_DIRECTION,
+            .flags = PID_FIELD_PERIODIC_ONLY,
+            .enable_offset = SET_EFFECT_DIRECTION_ENABLE_OFFSET, .enable_mask = SET_EFFECT_DIRECTION_ENABLE_BIT },
+};
+
+static const struct PidField HOT_PATH_DATA(set_envelope_fields) set_envelope_fields[] =
+{
+    { .offset = 1, .size = 1, .conversion = PID_CONV_HALF, .param = MODIFY_ATTACK_LEVEL },
+    { .offset = 2, .size = 1, .conversion = PID_CONV_HALF, .param = MODIFY_FADE_LEVEL },
+    { .offset = 3, .size = 2, .conversion = PID_CONV_HALF, .param = MODIFY_ATTACK_TIME },
+    { .offset = 5, .size = 2, .conversion = PID_CONV_HALF, .param = MODIFY_FADE_TIME },
+};
+
+// SW FFB Pro cannot use Neg Coefficient, Pos/Neg Saturation, or Dead Band.
+static const struct PidField HOT_PATH_DATA(set_condition_x_fields) set_condition_x_fields[] =
+{
+    { .offset = 2, .size = 1, .conversion = PID_CONV_SIGNED, .param = MODIFY_OFFSET_X },
+    { .offset = 3, .size = 1, .conversion = PID_CONV_HALF,   .param = MODIFY_STRENGTH_X },
+};
+
+static const struct PidField HOT_PATH_DATA(set_condition_y_fields) set_condition_y_fields[] =
+{
+    { .offset = 2, .size = 1, .conversion = PID_CONV_SIGNED, .param = MODIFY_OFFSET_Y },
+    { .offset = 3, .size = 1, .conversion = PID_CONV_HALF,   .param = MODIFY_STRENGTH_Y },
+};
+
+// TODO: FFB Pro doesn't support offset or phase.
+// adapt-ffb-joy works around this by switching between waveforms
+// (apparently effect type 3 on the FFB Pro is a cosine?!)
+static const struct PidField HOT_PATH_DATA(set_periodic_fields) set_periodic_fields[] =
+{
+    { .offset = 4, .size = 2, .conversion = PID_CONV_PERIOD, .param = MODIFY_FREQUENCY },
+    { .offset = 1, .size = 1, .conversion = PID_CONV_RAW,    .param = MODIFY_SUSTAIN_LEVEL },
+};
+
+static const struct PidField HOT_PATH_DATA(set_constant_fields) set_constant_fields[] =
+{
+    { .offset = 1, .size = 2, .conversion = PID_CONV_MAGNITUDE, .param = MODIFY_AMPLITUDE },
+};
+
+static const struct PidField HOT_PATH_DATA(set_ramp_fields) set_ramp_fields[] =
+{
+    { .offset = 1, .size = 1, .conversion = PID_CONV_SIGNED, .param = MODIFY_AMPLITUDE },
+    { .offset = 2, .size = 1, .conversion = PID_CONV_SIGNED, .param = MODIFY_RAMP_END },
+};
+
+static const struct PidField HOT_PATH_DATA(device_gain_fields) device_gain_fields[] =
+{
+    { .offset = 0, .size = 1, .conversion = PID_CONV_RAW, .param = MODIFY_DEVICE_GAIN },
+};
+
+#define FIELDS(f) .fields = f, .num_fields = count_of(f)
+
+static const struct PidReport HOT_PATH_DATA(pid_reports) pid_reports[] =
+{
+    { REPORT_ID_OUTPUT_SET_EFFECT,      PID_NO_SELECTOR, 0, false, FIELDS(set_effect_fields) },
+    { REPORT_ID_OUTPUT_SET_ENVELOPE,    PID_NO_SELECTOR, 0, false, FIELDS(set_envelope_fields) },
+    { REPORT_ID_OUTPUT_SET_CONDITION,   1, 0,                false, FIELDS(set_condition_x_fields) }, // axis ("block offset") 0
+    { REPORT_ID_OUTPUT_SET_CONDITION,   1, 1,                false, FIELDS(set_condition_y_fields) }, // axis 1
+    { REPORT_ID_OUTPUT_SET_PERIODIC,    PID_NO_SELECTOR, 0, false, FIELDS(set_periodic_fields) },
+    { REPORT_ID_OUTPUT_SET_CONSTANT,    PID_NO_SELECTOR, 0, false, FIELDS(set_constant_fields) },
+    { REPORT_ID_OUTPUT_SET_RAMP,        PID_NO_SELECTOR, 0, false, FIELDS(set_ramp_fields) },
+    { REPORT_ID_OUTPUT_DEVICE_GAIN,     PID_NO_SELECTOR, 0, true,  FIELDS(device_gain_fields) },
+};
+
+// Report ID to the first pid_reports entry for it, +1 so that 0 means "not in the table"
+#define PID_MAX_REPORT_ID 32
+static uint8_t report_index[PID_MAX_REPORT_ID];
+
+
+/////////////////////////////////////////////////////////////////////
+// Conversions
+/////////////////////////////////////////////////////////////////////
+
+#define USB_DURATION_INFINITE 0xffff
+#define MIDI_DURATION_INFINITE 0
+#define MIDI_DURATION_MAX 0x3fff
+
+// Periods of 1000 ms and up are all 1 Hz, the slowest the stick goes
+#define PERIOD_LUT_SIZE 1000
+static uint8_t period_to_frequency[PERIOD_LUT_SIZE];
+
+/*
+PID trigger buttons are 1-based USB button numbers, and the descriptor allows 1-9.
+The stick wants a mask of its 9 physical buttons. Anything out of range
+(including the 0xff "no trigger" value some hosts send) clears the trigger.
+*/
+#ifdef FIRMWARE_SHIFT
+// Shifted buttons are the same physical buttons as far as the stick knows.
+static const uint16_t HOT_PATH_DATA(trigger_to_mask) trigger_to_mask[10] = { 0, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x01 };
+#else
+static const uint16_t HOT_PATH_DATA(trigger_to_mask) trigger_to_mask[10] = { 0, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x100 };
+#endif
+
+void pid_table_init()
+{
+    for (uint i = 0; i < PERIOD_LUT_SIZE; i++)
+    {
+        period_to_frequency[i] = (i <= 13) ? 77 : ((2000 / i) + 1) / 2;
+    }
+
+    for (int i = count_of(pid_reports) - 1; i >= 0; i--)
+    {
+        if (pid_reports[i].report_id < PID_MAX_REPORT_ID) { report_index[pid_reports[i].report_id] = i + 1; }
+    }
+}
+
+static uint16_t HOT_PATH_FUNC(convert)(uint8_t conversion, uint16_t value)
+{
+    switch (conversion)
+    {
+        case PID_CONV_SIGNED:       return (uint16_t) (int8_t) value;
+        case PID_CONV_HALF:         return value >> 1;
+        case PID_CONV_DIRECTION:    return value << 1;
+        case PID_CONV_TRIGGER:      return (value < count_of(trigger_to_mask)) ? trigger_to_mask[value] : 0;
+        case PID_CONV_MAGNITUDE:    return (value & 0x1ff) >> 1;
+        case PID_CONV_PERIOD:       return (value < PERIOD_LUT_SIZE) ? period_to_frequency[value] : 1;
+
+        case PID_CONV_DURATION:
+            // USB uses the max possible value for infinity. MIDI uses 0.
+            if (value == USB_DURATION_INFINITE) { return MIDI_DURATION_INFINITE; }
+            value >>= 1;
+            return (value > MIDI_DURATION_MAX) ? MIDI_DURATION_MAX : value; // cap long but finite effects
+
+        default:                    return value;
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Dispatch
+/////////////////////////////////////////////////////////////////////
+
+static void HOT_PATH_FUNC(apply_fields)(struct EffectPool *pool, const struct PidReport *report,
+        const uint8_t *buffer, uint16_t bufsize)
+{
+    int effect_id = report->all_effects ? MIDI_ALL_EFFECTS : buffer[0];
+    bool periodic = !report->all_effects && ffb_midi_is_periodic(effect_pool_get_type(pool, effect_id));
+
+    for (uint i = 0; i < report->num_fields; i++)
+    {
+        const struct PidField *field = &report->fields[i];
+
+        if (field->offset + field->size > bufsize) { continue; }
+        if ((field->flags & PID_FIELD_PERIODIC_ONLY) && !periodic) { continue; }
+        if (field->enable_mask != 0
+                && (field->enable_offset >= bufsize || (buffer[field->enable_offset] & field->enable_mask) == 0))
+        {
+            continue;
+        }
+
+        uint16_t value = buffer[field->offset];
+        if (field->size == 2) { value |= ((uint16_t) buffer[field->offset + 1]) << 8; }
+        value = convert(field->conversion, value);
+
+        if (report->all_effects) { ffb_midi_modify(pool->midi, MIDI_ALL_EFFECTS, field->param, value); }
+        else { effect_pool_modify(pool, effect_id, field->param, value); }
+    }
+}
+
+bool HOT_PATH_FUNC(pid_table_apply)(struct EffectPool *pool, uint8_t report_id, const uint8_t *buffer, uint16_t bufsize)
+{
+    if (report_id >= PID_MAX_REPORT_ID || report_index[report_id] == 0 || bufsize == 0) { return false; }
+
+    // Entries for the same report are adjacent; selectors pick among them
+    for (uint i = report_index[report_id] - 1; i < count_of(pid_reports) && pid_reports[i].report_id == report_id; i++)
+    {
+        const struct PidReport *report = &pid_reports[i];
+
+        if (report->select_offset != PID_NO_SELECTOR
+                && (report->select_offset >= bufsize || buffer[report->select_offset] != report->select_value))
+        {
+            continue;
+        }
+
+        apply_fields(pool, report, buffer, bufsize);
+    }
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef PID_TABLE_H
+#define PID_TABLE_H
+
+#include "pico/stdlib.h"
+
+#include "effect_pool.h"
+
+
+/*
+How PID output reports that only set effect parameters turn into MIDI modifies.
+Each report is a list of fields: where the field sits in the report, how to convert
+its value to the stick's units, and which modify parameter it sets. Adding support
+for a parameter is one line in pid_table.c.
+
+Reports that do more than set parameters (Effect Operation, Block Free, the
+custom force reports) are still handled by hand in usb.c.
+*/
+
+enum PidConversion
+{
+    PID_CONV_RAW,           // unsigned, as-is
+    PID_CONV_SIGNED,        // 8-bit two's complement, sign-extended
+    PID_CONV_HALF,          // USB levels (0-255) and times (ms) to the stick's 0-127 and 2 ms units
+    PID_CONV_DIRECTION,     // 0-180 to 0-360 degrees
+    PID_CONV_DURATION,      // ms, 0xffff = infinite, to 2 ms units, 0 = infinite
+    PID_CONV_TRIGGER,       // 1-based trigger button to the stick's button mask
+    PID_CONV_MAGNITUDE,     // Set Constant Force's -255..255 to the stick's amplitude
+    PID_CONV_PERIOD,        // period in ms to frequency in Hz
+};
+
+#define PID_FIELD_PERIODIC_ONLY 0x01 // only for constant/periodic/ramp effects; others reuse the param number
+
+struct PidField
+{
+    uint8_t offset;         // in the report, after the report ID
+    uint8_t size;           // 1 or 2 bytes, little-endian
+    uint8_t conversion;     // enum PidConversion
+    uint8_t param;          // MIDI modify parameter
+    uint8_t flags;          // PID_FIELD_*
+    uint8_t enable_offset;  // if enable_mask isn't 0, the field only applies
+    uint8_t enable_mask;    // when one of these bits is set at enable_offset
+};
+
+#define PID_NO_SELECTOR 0xff
+
+struct PidReport
+{
+    uint8_t report_id;
+    uint8_t select_offset;  // if not PID_NO_SELECTOR, this entry only applies
+    uint8_t select_value;   // when the byte at select_offset has this value
+    bool all_effects;       // device-wide: no effect ID, applies to every effect on the stick
+    const struct PidField *fields;
+    uint8_t num_fields;
+};
+
+
+// Builds the conversion lookup tables. Call once at startup.
+void pid_table_init();
+
+// Apply a report's fields to the pool. Returns false if the table doesn't cover the report.
+bool pid_table_apply(struct EffectPool *pool, uint8_t report_id, const uint8_t *buffer, uint16_t bufsize);
+
+
+#endif //PID_TABLE_H
@@ -0,0 +1,213 @@
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+
+#include "tusb.h"
+
+#include "power.h"
+
+#include "config.h"
+
+struct ClockProfileSettings
+{
+    uint32_t sys_khz;
+    enum vreg_voltage vreg;
+};
+
+static const struct ClockProfileSettings clock_profiles[CLOCK_NUM_PROFILES] =
+{
+    [CLOCK_PROFILE_SUSPEND] = {  48000, VREG_VOLTAGE_DEFAULT },
+    [CLOCK_PROFILE_NORMAL]  = { 125000, VREG_VOLTAGE_DEFAULT },
+    [CLOCK_PROFILE_TURBO]   = { 200000, VREG_VOLTAGE_1_15 },
+};
+
+struct Joystick *power_joysticks;
+size_t power_num_joysticks;
+
+struct PowerStats power_stats;
+uint32_t power_profile_since_ms;
+
+// Set from TinyUSB callbacks, acted on in power_task()
+volatile bool power_suspend_pending = false;
+volatile bool power_resume_pending = false;
+bool power_remote_wakeup_allowed = false;
+
+uint16_t power_suspend_buttons[NUM_JOYSTICKS];
+absolute_time_t power_next_poll;
+
+static void account_profile_time()
+{
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    power_stats.profiles[power_stats.profile].time_ms += now_ms - power_profile_since_ms;
+    power_profile_since_ms = now_ms;
+}
+
+static void set_clock_profile(enum ClockProfile profile)
+{
+    const struct ClockProfileSettings *settings = &clock_profiles[profile];
+
+    account_profile_time();
+
+    // Changing clk_peri mid-byte would garble MIDI
+    for (size_t i = 0; i < power_num_joysticks; i++)
+    {
+        uart_tx_wait_blocking(power_joysticks[i].uart);
+    }
+
+    // Raise the voltage before speeding up; lower it after slowing down
+    bool faster = settings->sys_khz * 1000 > clock_get_hz(clk_sys);
+    if (faster) { vreg_set_voltage(settings->vreg); sleep_ms(1); }
+
+    if (profile == CLOCK_PROFILE_SUSPEND)
+    {
+        set_sys_clock_48mhz();
+    }
+    else
+    {
+        set_sys_clock_khz(settings->sys_khz, true);
+    }
+
+    if (!faster) { vreg_set_voltage(settings->vreg); }
+
+    for (size_t i = 0; i < power_num_joysticks; i++)
+    {
+        joystick_clocks_changed(&power_joysticks[i]);
+    }
+
+    power_stats.profile = profile;
+    power_stats.sys_hz = clock_get_hz(clk_sys);
+}
+
+void power_init(struct Joystick *joysticks, size_t count)
+{
+    power_stats.state = POWER_ACTIVE;
+    power_stats.profile = ACTIVE_CLOCK_PROFILE;
+    power_profile_since_ms = to_ms_since_boot(get_absolute_time());
+
+    // The sticks aren't set up yet, so they'll pick up the new clock on their own
+    set_clock_profile(ACTIVE_CLOCK_PROFILE);
+
+    power_joysticks = joysticks;
+    power_num_joysticks = count;
+}
+
+bool power_is_active()
+{
+    return power_stats.state == POWER_ACTIVE;
+}
+
+void power_record_report_latency(uint32_t latency_us)
+{
+    struct PowerProfileStats *stats = &power_stats.profiles[power_stats.profile];
+
+    stats->reports++;
+    stats->latency_us_total += latency_us;
+    if (latency_us > stats->latency_us_max) { stats->latency_us_max = latency_us; }
+}
+
+const struct PowerStats *power_get_stats()
+{
+    account_profile_time();
+    return &power_stats;
+}
+
+static void enter_suspend()
+{
+    for (size_t i = 0; i < power_num_joysticks; i++)
+    {
+        joystick_capture_pause(&power_joysticks[i]);
+        power_suspend_buttons[i] = joystick_buttons(&power_joysticks[i]);
+    }
+
+    set_clock_profile(CLOCK_PROFILE_SUSPEND);
+
+    power_stats.state = POWER_SUSPENDED;
+    power_next_poll = make_timeout_time_ms(POWER_SUSPEND_POLL_MS);
+}
+
+static void leave_suspend()
+{
+    set_clock_profile(ACTIVE_CLOCK_PROFILE);
+
+    for (size_t i = 0; i < power_num_joysticks; i++)
+    {
+        joystick_capture_resume(&power_joysticks[i]);
+    }
+
+    power_stats.state = POWER_ACTIVE;
+}
+
+static bool buttons_changed_while_suspended()
+{
+    for (size_t i = 0; i < power_num_joysticks; i++)
+    {
+        if (joystick_buttons(&power_joysticks[i]) != power_suspend_buttons[i]) { return true; }
+    }
+
+    return false;
+}
+
+void power_task()
+{
+    if (power_resume_pending)
+    {
+        power_resume_pending = false;
+        power_suspend_pending = false;
+        if (power_stats.state != POWER_ACTIVE) { leave_suspend(); }
+        return;
+    }
+
+    if (power_suspend_pending)
+    {
+        power_suspend_pending = false;
+        if (power_stats.state == POWER_ACTIVE) { enter_suspend(); }
+    }
+
+    if (power_stats.state == POWER_ACTIVE) { return; }
+
+    if (power_stats.state == POWER_SUSPENDED && buttons_changed_while_suspended())
+    {
+        if (power_remote_wakeup_allowed && tud_remote_wakeup()) { power_stats.wakeups++; }
+
+        // Either way, don't keep asking. The host will resume us when it's ready.
+        power_stats.state = POWER_WAKING;
+    }
+
+    if (time_reached(power_next_poll))
+    {
+        if (power_stats.state == POWER_SUSPENDED)
+        {
+            for (size_t i = 0; i < power_num_joysticks; i++)
+            {
+                joystick_capture_once(&power_joysticks[i]);
+            }
+        }
+
+        power_next_poll = make_timeout_time_ms(POWER_SUSPEND_POLL_MS);
+    }
+}
+
+absolute_time_t power_get_wake_deadline()
+{
+    return (power_stats.state == POWER_SUSPENDED) ? power_next_poll : at_the_end_of_time;
+}
+
+// Invoked when usb bus is suspended
+// remote_wakeup_en : if host allow us to perform remote wakeup
+// Within 7ms, device must draw an average of current less than 2.5 mA from bus
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+    power_remote_wakeup_allowed = remote_wakeup_en;
+    power_suspend_pending = true;
+}
+
+// Invoked when usb bus is resumed
+void tud_resume_cb(void)
+{
+    power_resume_pending = true;
+}
+
+// Invoked when device is mounted. A bus reset while suspended ends up here rather than in tud_resume_cb.
+void tud_mount_cb(void)
+{
+    power_resume_pending = true;
+}
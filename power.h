@@ -0,0 +1,72 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "pico/stdlib.h"
+
+#include "joystick.h"
+
+
+/*
+Power management. While the host has USB suspended, we stop polling the sticks
+continuously, drop the system clock, and sleep between occasional button checks.
+A button press while suspended wakes the host (if it allowed remote wakeup).
+
+The clock profile used while active is chosen with ACTIVE_CLOCK_PROFILE in config.h.
+*/
+
+enum ClockProfile
+{
+    CLOCK_PROFILE_SUSPEND,  // 48 MHz from the USB PLL; the system PLL is turned off
+    CLOCK_PROFILE_NORMAL,   // 125 MHz, the SDK default
+    CLOCK_PROFILE_TURBO,    // 200 MHz with a slightly raised core voltage, for minimum latency
+    CLOCK_NUM_PROFILES
+};
+
+enum PowerState
+{
+    POWER_ACTIVE,
+    POWER_SUSPENDED,
+    POWER_WAKING,           // remote wakeup sent; waiting for the host to resume us
+};
+
+// How often to read the sticks while suspended, to notice button presses
+#define POWER_SUSPEND_POLL_MS 50
+
+// Per clock profile, for comparing them on real hardware. Packed, since it goes over USB as-is.
+struct __attribute__((__packed__)) PowerProfileStats
+{
+    uint32_t time_ms;           // time spent in this profile
+    uint32_t reports;           // joystick reports sent
+    uint64_t latency_us_total;  // from frame capture to its report being queued for USB
+    uint32_t latency_us_max;
+};
+
+struct __attribute__((__packed__)) PowerStats
+{
+    uint8_t state;              // enum PowerState
+    uint8_t profile;            // enum ClockProfile
+    uint16_t reserved;
+    uint32_t sys_hz;
+    uint32_t wakeups;           // remote wakeups sent
+    struct PowerProfileStats profiles[CLOCK_NUM_PROFILES];
+};
+
+
+// Applies the active clock profile; call first thing, before setting up USB or the sticks
+void power_init(struct Joystick *joysticks, size_t count);
+
+// Call from the main loop
+void power_task();
+
+// When the main loop must wake up next even if no interrupt arrives: the next button check
+// while suspended, otherwise never
+absolute_time_t power_get_wake_deadline();
+
+bool power_is_active();
+void power_record_report_latency(uint32_t latency_us);
+
+// Fills in the time spent in the current profile up to now
+const struct PowerStats *power_get_stats();
+
+
+#endif //POWER_H
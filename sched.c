@@ -0,0 +1,171 @@
+#include "sched.h"
+#include "hot_path.h"
+
+// What's outstanding for each task
+struct SchedTaskState
+{
+    uint32_t next_period_us;    // when a periodic task is next due
+    bool timed;                 // its wake() time, as of the end of the last pass
+    uint32_t timed_us;
+    bool released;              // sched_release() since it last ran
+    uint32_t released_us;
+};
+
+const struct SchedTask *sched_tasks;
+struct SchedTaskState sched_state[SCHED_NUM_TASKS];
+
+uint32_t sched_woke_us;         // when the loop last woke from sleep
+absolute_time_t sched_wake_at;  // the earliest wake() time
+
+uint32_t sched_window_start_us;
+uint32_t sched_window_passes;
+struct SchedTaskStats sched_window[SCHED_NUM_TASKS];
+
+struct SchedStats sched_last_window;
+
+static inline bool reached(uint32_t time_us, uint32_t now_us)
+{
+    return (int32_t) (now_us - time_us) >= 0;
+}
+
+static inline uint32_t earlier(uint32_t a, uint32_t b)
+{
+    return ((int32_t) (a - b) < 0) ? a : b;
+}
+
+void sched_init(const struct SchedTask *tasks)
+{
+    uint32_t now_us = time_us_32();
+
+    sched_tasks = tasks;
+    for (int i = 0; i < SCHED_NUM_TASKS; i++)
+    {
+        sched_state[i] = (struct SchedTaskState) { .next_period_us = now_us };
+    }
+
+    sched_woke_us = now_us;
+    sched_wake_at = at_the_end_of_time;
+    sched_window_start_us = now_us;
+}
+
+void sched_release(enum SchedTaskId task)
+{
+    struct SchedTaskState *state = &sched_state[task];
+    if (state->released) { return; }
+
+    state->released = true;
+    state->released_us = time_us_32();
+}
+
+static void HOT_PATH_FUNC(record_run)(enum SchedTaskId task, uint32_t lateness_us)
+{
+    struct SchedTaskStats *stats = &sched_window[task];
+
+    stats->runs++;
+    stats->total_lateness_us += lateness_us;
+    if (lateness_us > stats->max_lateness_us) { stats->max_lateness_us = lateness_us; }
+    if (lateness_us > sched_tasks[task].deadline_us) { stats->misses++; }
+}
+
+static void end_window(uint32_t now_us)
+{
+    struct SchedStats *stats = &sched_last_window;
+
+    stats->window_us = now_us - sched_window_start_us;
+    stats->passes = sched_window_passes;
+
+    for (int i = 0; i < SCHED_NUM_TASKS; i++)
+    {
+        stats->tasks[i] = sched_window[i];
+        stats->tasks[i].period_us = sched_tasks[i].period_us;
+        stats->tasks[i].deadline_us = sched_tasks[i].deadline_us;
+        sched_window[i] = (struct SchedTaskStats) { 0 };
+    }
+
+    sched_window_start_us = now_us;
+    sched_window_passes = 0;
+}
+
+// Picks up each task's wake() time, for the next pass and for sched_sleep()
+static void update_wake_times()
+{
+    sched_wake_at = at_the_end_of_time;
+
+    for (int i = 0; i < SCHED_NUM_TASKS; i++)
+    {
+        if (sched_tasks[i].wake == NULL) { continue; }
+
+        absolute_time_t wake = sched_tasks[i].wake();
+        sched_state[i].timed = !is_at_the_end_of_time(wake);
+        sched_state[i].timed_us = (uint32_t) to_us_since_boot(wake);
+        sched_wake_at = absolute_time_min(sched_wake_at, wake);
+    }
+}
+
+void HOT_PATH_FUNC(sched_run_pass)()
+{
+    uint32_t pass_start_us = time_us_32();
+    uint32_t mark = cpu_load_mark();
+
+    for (int i = 0; i < SCHED_NUM_TASKS; i++)
+    {
+        const struct SchedTask *task = &sched_tasks[i];
+        struct SchedTaskState *state = &sched_state[i];
+        uint32_t now_us = time_us_32();
+
+        bool due = false;
+        uint32_t release_us = now_us;
+
+        if (task->period_us == 0)
+        {
+            due = true;
+            release_us = pass_start_us;
+        }
+        else if (reached(state->next_period_us, now_us))
+        {
+            due = true;
+            release_us = reached(state->next_period_us, sched_woke_us) ? sched_woke_us : state->next_period_us;
+
+            // Periods that went by entirely are skipped, not made up
+            state->next_period_us += task->period_us;
+            if (reached(state->next_period_us, now_us)) { state->next_period_us = now_us + task->period_us; }
+        }
+
+        if (state->timed && reached(state->timed_us, now_us))
+        {
+            due = true;
+            release_us = earlier(release_us, state->timed_us);
+            state->timed = false;
+        }
+
+        if (state->released)
+        {
+            due = true;
+            release_us = earlier(release_us, state->released_us);
+            state->released = false;
+        }
+
+        if (!due) { continue; }
+
+        task->run();
+        mark = cpu_load_account(task->cpu, mark);
+        record_run(i, time_us_32() - release_us);
+    }
+
+    update_wake_times();
+
+    sched_window_passes++;
+    uint32_t now_us = time_us_32();
+    if (now_us - sched_window_start_us >= SCHED_WINDOW_MS * 1000) { end_window(now_us); }
+}
+
+void sched_sleep()
+{
+    best_effort_wfe_or_timeout(sched_wake_at);
+    sched_woke_us = time_us_32();
+}
+
+const struct SchedStats *sched_get_stats()
+{
+    return &sched_last_window;
+}
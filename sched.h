@@ -0,0 +1,90 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "pico/stdlib.h"
+
+#include "cpu_load.h"
+
+
+/*
+The main loop's jobs, run cooperatively: each pass, every task that's due runs
+once, in the order below, to completion. Only interrupts preempt anything.
+
+A task is due
+- on every pass, if its period is 0;
+- every period_us otherwise. A period that ends while the loop is asleep only
+  counts from when it wakes, since nothing needed the task meanwhile;
+- once its wake() time passes: the time it asked to be woken for;
+- once sched_release() has been called for it, e.g. HID on each USB SOF.
+
+Its lateness runs from the earliest of those to when it finishes. Over its
+deadline_us, that's a miss. Per-task stats for the last complete
+SCHED_WINDOW_MS window can be read over the diagnostics interface
+(tools/diag.py sched).
+*/
+
+enum SchedTaskId
+{
+    SCHED_USB,              // tud_task(), including the HID/PID callbacks and the MIDI they send
+    SCHED_HID,              // joystick reports, due on each SOF and built before the next
+    SCHED_MIDI_PASSTHROUGH, // the host's own MIDI for the sticks, sent as the UART takes it
+    SCHED_DIAG,
+    SCHED_POWER,
+    SCHED_BUTTON_RULES,
+    SCHED_CUSTOM_FORCE,     // custom force samples, due at their sample times
+    SCHED_EFFECT_UPLOAD,    // created effects, sent once the UART is free
+    SCHED_NUM_TASKS
+};
+
+#define SCHED_WINDOW_MS 1000
+
+// A full-speed USB frame; the HID endpoints are polled once per frame
+#define SCHED_FRAME_US 1000
+
+// How often the housekeeping tasks run
+#define SCHED_TIMER_PERIOD_US 1000
+
+struct SchedTask
+{
+    void (*run)();
+    uint32_t period_us;                 // 0 for every pass
+    uint32_t deadline_us;
+    enum CpuSubsystem cpu;              // where cpu_load.c charges its time
+    absolute_time_t (*wake)();          // when it next needs to run, if it has timed work; may be NULL
+};
+
+// Packed, since it goes over USB as-is
+struct __attribute__((__packed__)) SchedTaskStats
+{
+    uint32_t period_us;
+    uint32_t deadline_us;
+    uint32_t runs;
+    uint32_t misses;
+    uint32_t max_lateness_us;
+    uint64_t total_lateness_us;
+};
+
+struct __attribute__((__packed__)) SchedStats
+{
+    uint32_t window_us;
+    uint32_t passes;
+    struct SchedTaskStats tasks[SCHED_NUM_TASKS];
+};
+
+
+// `tasks` has SCHED_NUM_TASKS entries, indexed by enum SchedTaskId
+void sched_init(const struct SchedTask *tasks);
+
+// One pass of the main loop
+void sched_run_pass();
+
+// Makes a task due now, if it isn't already; call from the main loop
+void sched_release(enum SchedTaskId task);
+
+// Sleeps until an interrupt, or until the earliest wake() time
+void sched_sleep();
+
+const struct SchedStats *sched_get_stats();
+
+
+#endif //SCHED_H
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "bench.h"
+#include "joystick.h"
+#include "usb.h"
+#include "usb_report_ids.h"
+#include "ffb_midi.h"
+#include "effect_pool.h"
+#include "custom_force.h"
+#include "axis_filter.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// Fixture: one stick's worth of state, with its MIDI going nowhere
+/////////////////////////////////////////////////////////////////////
+
+static struct Joystick js;
+static uint64_t midi_bytes;
+
+// Stops the compiler from optimising away work whose result nothing reads
+static volatile uint32_t bench_sink;
+
+void bench_midi_sink(const uint8_t *data, size_t size)
+{
+    midi_bytes += size;
+    bench_sink = data[size - 1];
+}
+
+static void fixture_reset()
+{
+    memset(&js, 0, sizeof(js));
+    ffb_midi_init(&js.midi, NULL);
+    effect_pool_init(&js.pool, &js.midi);
+    custom_force_init(&js.custom_force, &js.pool);
+
+    usb_set_effect_pool(0, &js.pool);
+    usb_set_custom_force_player(0, &js.custom_force);
+
+    axis_filter_set_mode(AXIS_FILTER_NONE);
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Frame decode
+/////////////////////////////////////////////////////////////////////
+
+#define RAW_FRAMES 64 // power of 2
+static uint64_t raw_frames[RAW_FRAMES];
+
+static void setup_frames()
+{
+    fixture_reset();
+
+    // xorshift, so every platform decodes the same frames
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < RAW_FRAMES; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        raw_frames[i] = x & 0xffffffffffffull;
+    }
+}
+
+// What the capture IRQ does per frame
+static void op_store(uint32_t i)
+{
+    joystick_store_frame(&js, raw_frames[i & (RAW_FRAMES - 1)], i * 1000);
+}
+
+// One frame captured and decoded per report
+static void op_decode(uint32_t i)
+{
+    op_store(i);
+    joystick_decode(&js);
+}
+
+// Four frames per report: only the filters see the older ones
+static void op_decode_4(uint32_t i)
+{
+    for (uint32_t n = 0; n < 4; n++) { op_store(i * 4 + n); }
+    joystick_decode(&js);
+}
+
+static void setup_decode_none()     { setup_frames(); axis_filter_set_mode(AXIS_FILTER_NONE); }
+static void setup_decode_box()      { setup_frames(); axis_filter_set_mode(AXIS_FILTER_BOX); }
+static void setup_decode_one_euro() { setup_frames(); axis_filter_set_mode(AXIS_FILTER_ONE_EURO); }
+
+
+/////////////////////////////////////////////////////////////////////
+// MIDI encoding
+/////////////////////////////////////////////////////////////////////
+
+static struct Effect effect_template;
+
+static void setup_define(enum MidiEffectType type)
+{
+    fixture_reset();
+
+    effect_template = (struct Effect) {
+        .type = type,
+        .direction = 90,
+        .gain = 0x7f,
+        .sample_rate = 100,
+        .attack_level = 0x7f,
+        .sustain_level = 0x40,
+        .fade_level = 0x10,
+        .attack_time = 20,
+        .fade_time = 20,
+        .frequency = 10,
+        .amplitude = 0x60,
+        .strength_x = 0x40,
+        .strength_y = 0x40,
+    };
+}
+
+// A different duration every time, so the effect cache never satisfies it.
+// The erase keeps the stick's memory from filling up, and is timed too.
+static void op_define_erase(uint32_t i)
+{
+    effect_template.duration = i & 0x3fff;
+    int effect_id = ffb_midi_define_effect(&js.midi, &effect_template);
+    if (effect_id >= 0) { ffb_midi_erase(&js.midi, effect_id); }
+}
+
+#define DEFINE_SETUP(name, type) static void setup_define_##name() { setup_define(type); }
+DEFINE_SETUP(constant, MIDI_ET_CONSTANT)
+DEFINE_SETUP(sine, MIDI_ET_SINE)
+DEFINE_SETUP(square, MIDI_ET_SQUARE)
+DEFINE_SETUP(ramp, MIDI_ET_RAMP)
+DEFINE_SETUP(triangle, MIDI_ET_TRIANGLE)
+DEFINE_SETUP(sawtoothdown, MIDI_ET_SAWTOOTHDOWN)
+DEFINE_SETUP(sawtoothup, MIDI_ET_SAWTOOTHUP)
+DEFINE_SETUP(spring, MIDI_ET_SPRING)
+DEFINE_SETUP(damper, MIDI_ET_DAMPER)
+DEFINE_SETUP(inertia, MIDI_ET_INERTIA)
+DEFINE_SETUP(friction, MIDI_ET_FRICTION)
+
+static int modify_effect_id;
+
+static void setup_modify()
+{
+    setup_define(MIDI_ET_CONSTANT);
+    modify_effect_id = ffb_midi_define_effect(&js.midi, &effect_template);
+}
+
+static void op_modify(uint32_t i)
+{
+    ffb_midi_modify(&js.midi, modify_effect_id, MODIFY_AMPLITUDE, i & 0x3fff);
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// HID set-report dispatch
+/////////////////////////////////////////////////////////////////////
+
+struct BenchReport
+{
+    uint8_t report_id;
+    hid_report_type_t report_type;
+    uint8_t data[16];
+    uint8_t size;
+};
+
+// Effect 1 is a constant force, effect 2 a custom force; see setup_set_report()
+static const struct BenchReport *current_report;
+
+#define OUTPUT(id, ...) { id, HID_REPORT_TYPE_OUTPUT, { __VA_ARGS__ }, sizeof((uint8_t[]) { __VA_ARGS__ }) }
+
+static const struct BenchReport report_set_effect =
+        OUTPUT(REPORT_ID_OUTPUT_SET_EFFECT, 1, 1, 0xe8, 0x03, 0, 0, 0, 0, 0xff, 0x01, 0x04, 0x5a, 0, 0, 0);
+static const struct BenchReport report_set_envelope =
+        OUTPUT(REPORT_ID_OUTPUT_SET_ENVELOPE, 1, 0xff, 0x80, 0x10, 0x00, 0x20, 0x00);
+static const struct BenchReport report_set_condition =
+        OUTPUT(REPORT_ID_OUTPUT_SET_CONDITION, 1, 1, 0x10, 0x80, 0x60, 0xff, 0xff, 0);
+static const struct BenchReport report_set_periodic =
+        OUTPUT(REPORT_ID_OUTPUT_SET_PERIODIC, 1, 0x80, 0, 0, 0x32, 0x00);
+static const struct BenchReport report_set_constant =
+        OUTPUT(REPORT_ID_OUTPUT_SET_CONSTANT, 1, 0x40, 0x00);
+// As it arrives on the interrupt OUT endpoint: no ID or type, and the ID as the first byte
+static const struct BenchReport report_set_constant_out_endpoint =
+        { 0, HID_REPORT_TYPE_INVALID, { REPORT_ID_OUTPUT_SET_CONSTANT, 1, 0x40, 0x00 }, 4 };
+static const struct BenchReport report_set_ramp =
+        OUTPUT(REPORT_ID_OUTPUT_SET_RAMP, 1, 0xf0, 0x10);
+static const struct BenchReport report_effect_operation =
+        OUTPUT(REPORT_ID_OUTPUT_EFFECT_OPERATION, 1, 1, 1);
+static const struct BenchReport report_device_gain =
+        OUTPUT(REPORT_ID_OUTPUT_DEVICE_GAIN, 0x64);
+static const struct BenchReport report_custom_force_data =
+        OUTPUT(REPORT_ID_OUTPUT_CUSTOM_FORCE_DATA, 2, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12);
+static const struct BenchReport report_set_custom_force =
+        OUTPUT(REPORT_ID_OUTPUT_SET_CUSTOM_FORCE, 2, 0x30, 0x00);
+
+static void setup_set_report()
+{
+    fixture_reset();
+
+    uint8_t constant = 1;
+    uint8_t custom = 12;
+    tud_hid_set_report_cb(0, REPORT_ID_FEATURE_CREATE_NEW_EFFECT, HID_REPORT_TYPE_FEATURE, &constant, 1);
+    tud_hid_set_report_cb(0, REPORT_ID_FEATURE_CREATE_NEW_EFFECT, HID_REPORT_TYPE_FEATURE, &custom, 1);
+}
+
+static void op_set_report(uint32_t i)
+{
+    tud_hid_set_report_cb(0, current_report->report_id, current_report->report_type,
+            current_report->data, current_report->size);
+}
+
+// Create and free are a pair, or the pool would run out
+static void op_create_free(uint32_t i)
+{
+    uint8_t type = 1;
+    tud_hid_set_report_cb(0, REPORT_ID_FEATURE_CREATE_NEW_EFFECT, HID_REPORT_TYPE_FEATURE, &type, 1);
+
+    uint8_t effect_id = effect_pool_last_assigned_effect_id(&js.pool);
+    tud_hid_set_report_cb(0, REPORT_ID_OUTPUT_BLOCK_FREE, HID_REPORT_TYPE_OUTPUT, &effect_id, 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Runner
+/////////////////////////////////////////////////////////////////////
+
+struct BenchCase
+{
+    const char *name;
+    void (*setup)();
+    void (*op)(uint32_t i);
+    const struct BenchReport *report; // for op_set_report
+    bool needs_usb;
+};
+
+static const struct BenchCase cases[] =
+{
+    { "capture/store",              setup_decode_none,          op_store },
+    { "decode/none",                setup_decode_none,          op_decode },
+    { "decode/box",                 setup_decode_box,           op_decode },
+    { "decode/one_euro",            setup_decode_one_euro,      op_decode },
+    { "decode/none/4_frames",       setup_decode_none,          op_decode_4 },
+    { "decode/box/4_frames",        setup_decode_box,           op_decode_4 },
+    { "decode/one_euro/4_frames",   setup_decode_one_euro,      op_decode_4 },
+
+    { "midi/define_erase/constant",     setup_define_constant,      op_define_erase },
+    { "midi/define_erase/sine",         setup_define_sine,          op_define_erase },
+    { "midi/define_erase/square",       setup_define_square,        op_define_erase },
+    { "midi/define_erase/ramp",         setup_define_ramp,          op_define_erase },
+    { "midi/define_erase/triangle",     setup_define_triangle,      op_define_erase },
+    { "midi/define_erase/sawtoothdown", setup_define_sawtoothdown,  op_define_erase },
+    { "midi/define_erase/sawtoothup",   setup_define_sawtoothup,    op_define_erase },
+    { "midi/define_erase/spring",       setup_define_spring,        op_define_erase },
+    { "midi/define_erase/damper",       setup_define_damper,        op_define_erase },
+    { "midi/define_erase/inertia",      setup_define_inertia,       op_define_erase },
+    { "midi/define_erase/friction",     setup_define_friction,      op_define_erase },
+    { "midi/modify",                    setup_modify,               op_modify },
+
+    { "set_report/set_effect",          setup_set_report, op_set_report, &report_set_effect,         true },
+    { "set_report/set_envelope",        setup_set_report, op_set_report, &report_set_envelope,       true },
+    { "set_report/set_condition",       setup_set_report, op_set_report, &report_set_condition,      true },
+    { "set_report/set_periodic",        setup_set_report, op_set_report, &report_set_periodic,       true },
+    { "set_report/set_constant",        setup_set_report, op_set_report, &report_set_constant,       true },
+    { "set_report/set_constant/out_ep", setup_set_report, op_set_report, &report_set_constant_out_endpoint, true },
+    { "set_report/set_ramp",            setup_set_report, op_set_report, &report_set_ramp,           true },
+    { "set_report/effect_operation",    setup_set_report, op_set_report, &report_effect_operation,   true },
+    { "set_report/device_gain",         setup_set_report, op_set_report, &report_device_gain,        true },
+    { "set_report/custom_force_data",   setup_set_report, op_set_report, &report_custom_force_data,  true },
+    { "set_report/set_custom_force",    setup_set_report, op_set_report, &report_set_custom_force,   true },
+    { "set_report/create_free",         setup_set_report, op_create_free, NULL,                      true },
+};
+
+static void print_result(const char *platform, const char *name, uint32_t iterations,
+        const struct BenchCounters *counters)
+{
+    printf("{\"platform\": \"%s\", \"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.1f",
+            platform, name, (unsigned long) iterations, (double) counters->ns / iterations);
+    if (counters->has_cycles)
+    {
+        printf(", \"cycles_per_op\": %.1f", (double) counters->cycles / iterations);
+    }
+    if (counters->has_instructions)
+    {
+        printf(", \"instructions_per_op\": %.1f", (double) counters->instructions / iterations);
+    }
+    printf("}\n");
+}
+
+void bench_run_all(const char *platform, const char *filter, uint32_t iterations)
+{
+    for (size_t c = 0; c < count_of(cases); c++)
+    {
+        const struct BenchCase *bench = &cases[c];
+
+        if (filter != NULL && strncmp(bench->name, filter, strlen(filter)) != 0) { continue; }
+        if (bench->needs_usb && !bench_usb_available()) { continue; }
+
+        bench->setup();
+        current_report = bench->report;
+
+        // One untimed pass, to warm caches and get the state into its steady pattern
+        for (uint32_t i = 0; i < iterations / 16; i++) { bench->op(i); }
+
+        struct BenchCounters counters;
+        bench_counters_start();
+        for (uint32_t i = 0; i < iterations; i++) { bench->op(i); }
+        bench_counters_stop(&counters);
+
+        print_result(platform, bench->name, iterations, &counters);
+    }
+}
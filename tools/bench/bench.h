@@ -0,0 +1,45 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "pico/stdlib.h"
+
+
+/*
+Microbenchmarks for the firmware's hot paths. The cases in bench.c are shared;
+each platform supplies the timing around them:
+
+  bench_host.c  on a PC, with wall time and perf counters (cycles, instructions)
+  bench_pico.c  on the Pico, timed with the RP2040 timer
+
+Each case runs as one timed batch, and prints one JSON object per line:
+
+  {"platform": "host", "name": "midi/modify", "iterations": 200000,
+   "ns_per_op": 21.4, "cycles_per_op": 80.1, "instructions_per_op": 190.0}
+
+Cycle and instruction counts are left out where the platform can't measure them.
+tools/bench_compare.py diffs two result files.
+*/
+
+struct BenchCounters
+{
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t instructions;
+    bool has_cycles;
+    bool has_instructions;
+};
+
+// Provided by the platform
+void bench_counters_start();
+void bench_counters_stop(struct BenchCounters *counters);
+bool bench_usb_available(); // false skips the cases that need a working tud_hid_n_report()
+
+// Where the fixture's MIDI goes. On the host it's reached through uart_write_blocking();
+// the on-device image is built with BENCH_BUILD, which sends MIDI here instead of the UART.
+void bench_midi_sink(const uint8_t *data, size_t size);
+
+// Runs every case whose name starts with filter (NULL for all)
+void bench_run_all(const char *platform, const char *filter, uint32_t iterations);
+
+
+#endif //BENCH_H
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "bench.h"
+#include "pid_table.h"
+#include "hardware/uart.h"
+
+/*
+Host side of the benchmarks (see bench.h):
+
+    bench [-n <iterations>] [<name prefix>]
+
+On Linux, cycles and instructions come from perf counters, counting this
+process in user space only. Where perf isn't available (other systems, or
+kernel.perf_event_paranoid set too high) only wall time is reported.
+*/
+
+#define DEFAULT_ITERATIONS 200000
+
+static int perf_cycles_fd = -1;
+static int perf_instructions_fd = -1;
+static struct timespec start_time;
+
+#ifdef __linux__
+static int perf_open(uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group_fd < 0);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+static void perf_init()
+{
+#ifdef __linux__
+    perf_cycles_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (perf_cycles_fd >= 0)
+    {
+        perf_instructions_fd = perf_open(PERF_COUNT_HW_INSTRUCTIONS, perf_cycles_fd);
+    }
+    else
+    {
+        fprintf(stderr, "bench: perf counters unavailable, reporting wall time only\n");
+    }
+#endif
+}
+
+static uint64_t perf_read(int fd)
+{
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) { return 0; }
+    return value;
+}
+
+void bench_counters_start()
+{
+#ifdef __linux__
+    if (perf_cycles_fd >= 0)
+    {
+        ioctl(perf_cycles_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+void bench_counters_stop(struct BenchCounters *counters)
+{
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+#ifdef __linux__
+    if (perf_cycles_fd >= 0)
+    {
+        ioctl(perf_cycles_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+
+    counters->ns = (uint64_t) (end_time.tv_sec - start_time.tv_sec) * 1000000000u
+            + (end_time.tv_nsec - start_time.tv_nsec);
+    counters->has_cycles = perf_cycles_fd >= 0;
+    counters->cycles = perf_read(perf_cycles_fd);
+    counters->has_instructions = perf_instructions_fd >= 0;
+    counters->instructions = perf_read(perf_instructions_fd);
+}
+
+// The host has no UART; the MIDI just gets counted
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len)
+{
+    if (len > 0) { bench_midi_sink(src, len); }
+}
+
+bool bench_usb_available()
+{
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            iterations = strtoul(argv[++i], NULL, 0);
+        }
+        else if (argv[i][0] == '-' || filter != NULL)
+        {
+            fprintf(stderr, "usage: %s [-n <iterations>] [<name prefix>]\n", argv[0]);
+            return 2;
+        }
+        else
+        {
+            filter = argv[i];
+        }
+    }
+
+    if (iterations == 0) { iterations = 1; }
+
+    perf_init();
+    pid_table_init();
+    bench_run_all("host", filter, iterations);
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+
+#include "tusb.h"
+
+#include "bench.h"
+#include "pid_table.h"
+
+/*
+On-device side of the benchmarks (see bench.h), built as picowinder_bench.uf2
+when the firmware is configured with -DPICOWINDER_BENCH=ON.
+
+Batches are timed with the RP2040's 1 us timer; cycles are derived from that
+and clk_sys, since the M0+ has no cycle or instruction counters. Results go to
+stdio on UART1 (TX on GPIO 8, the second stick's MIDI pin), so no stick needs
+to be attached. The USB side comes up as the normal adapter; set_report cases
+only run once a host has configured it, since their echo needs the endpoint.
+*/
+
+#define PICO_ITERATIONS 2000
+#define USB_WAIT_MS 5000
+
+static uint64_t start_us;
+
+void bench_counters_start()
+{
+    start_us = time_us_64();
+}
+
+void bench_counters_stop(struct BenchCounters *counters)
+{
+    uint64_t elapsed_us = time_us_64() - start_us;
+
+    counters->ns = elapsed_us * 1000;
+    counters->has_cycles = true;
+    counters->cycles = elapsed_us * (clock_get_hz(clk_sys) / 1000000);
+    counters->has_instructions = false;
+    counters->instructions = 0;
+}
+
+bool bench_usb_available()
+{
+    tud_task();
+    return tud_mounted();
+}
+
+int main()
+{
+    stdio_init_all();
+    pid_table_init();
+    tud_init(0);
+
+    absolute_time_t usb_deadline = make_timeout_time_ms(USB_WAIT_MS);
+    while (!tud_mounted() && !time_reached(usb_deadline)) { tud_task(); }
+
+    while (1)
+    {
+        bench_run_all("pico", NULL, PICO_ITERATIONS);
+        printf("\n");
+
+        // Keep USB serviced between runs
+        absolute_time_t next_run = make_timeout_time_ms(5000);
+        while (!time_reached(next_run)) { tud_task(); }
+    }
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Compares two benchmark result files (JSON lines from bench or picowinder_bench;
+see bench/bench.h) and flags cases that got slower.
+
+    ./build-tools/bench > before.json
+    (make the change, rebuild)
+    ./build-tools/bench > after.json
+    ./bench_compare.py before.json after.json
+
+Cycles are compared where both files have them, wall time otherwise. The exit
+status is 1 if any case regressed by more than the threshold, so this can gate CI.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('{'):
+                continue
+            result = json.loads(line)
+            results[(result['platform'], result['name'])] = result
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('before')
+    parser.add_argument('after')
+    parser.add_argument('--threshold', type=float, default=5.0, help='regression threshold in percent (default 5)')
+    args = parser.parse_args()
+
+    before = load(args.before)
+    after = load(args.after)
+
+    regressed = False
+    print('%-40s %12s %12s %9s' % ('case', 'before', 'after', 'change'))
+
+    for key in sorted(before.keys() & after.keys()):
+        old, new = before[key], after[key]
+        metric = 'cycles_per_op' if 'cycles_per_op' in old and 'cycles_per_op' in new else 'ns_per_op'
+        unit = 'cyc' if metric == 'cycles_per_op' else 'ns'
+
+        old_cost, new_cost = old[metric], new[metric]
+        change = 100.0 * (new_cost - old_cost) / old_cost if old_cost else 0.0
+
+        flag = ''
+        if change > args.threshold:
+            flag = '  REGRESSION'
+            regressed = True
+        elif change < -args.threshold:
+            flag = '  faster'
+
+        name = key[1] if key[0] == 'host' else '%s:%s' % key
+        print('%-40s %8.1f %-3s %8.1f %-3s %+8.1f%%%s' % (name, old_cost, unit, new_cost, unit, change, flag))
+
+    for key in sorted(before.keys() - after.keys()):
+        print('%-40s only in %s' % (key[1], args.before))
+    for key in sorted(after.keys() - before.keys()):
+        print('%-40s only in %s' % (key[1], args.after))
+
+    return 1 if regressed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
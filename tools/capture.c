@@ -0,0 +1,98 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+bool capture_open(struct CaptureReader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->name = path;
+    reader->file = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+
+    return reader->file != NULL;
+}
+
+void capture_close(struct CaptureReader *reader)
+{
+    if (reader->file && reader->file != stdin) { fclose(reader->file); }
+    reader->file = NULL;
+}
+
+static bool parse_line(char *line, struct CaptureRecord *record)
+{
+    char *cursor = line;
+    char *end;
+
+    record->time_us = strtoull(cursor, &end, 10);
+    if (end == cursor) { return false; }
+    cursor = end;
+
+    unsigned long interface = strtoul(cursor, &end, 10);
+    if (end == cursor || interface > 0xff) { return false; }
+    record->interface = interface;
+    cursor = end;
+
+    while (isspace((unsigned char) *cursor)) { cursor++; }
+    switch (*cursor)
+    {
+        case CAPTURE_OUTPUT:
+        case CAPTURE_SET_FEATURE:
+        case CAPTURE_GET_FEATURE:
+            record->kind = *cursor;
+            break;
+        default:
+            return false;
+    }
+    cursor++;
+
+    unsigned long report_id = strtoul(cursor, &end, 10);
+    if (end == cursor || report_id > 0xff) { return false; }
+    record->report_id = report_id;
+    cursor = end;
+
+    record->size = 0;
+    while (1)
+    {
+        unsigned long byte = strtoul(cursor, &end, 16);
+        if (end == cursor) { break; }
+        if (byte > 0xff || record->size >= CAPTURE_MAX_REPORT_SIZE) { return false; }
+
+        record->data[record->size++] = byte;
+        cursor = end;
+    }
+
+    while (isspace((unsigned char) *cursor)) { cursor++; }
+    return *cursor == '\0';
+}
+
+bool capture_next(struct CaptureReader *reader, struct CaptureRecord *record)
+{
+    char line[512];
+
+    while (fgets(line, sizeof(line), reader->file))
+    {
+        reader->line++;
+
+        char *start = line;
+        while (isspace((unsigned char) *start)) { start++; }
+        if (*start == '\0' || *start == '#') { continue; }
+
+        if (!parse_line(start, record))
+        {
+            fprintf(stderr, "%s:%u: skipping malformed record\n", reader->name, reader->line);
+            continue;
+        }
+
+        if (record->time_us < reader->last_time_us)
+        {
+            fprintf(stderr, "%s:%u: time went backwards; treating it as simultaneous\n", reader->name, reader->line);
+            record->time_us = reader->last_time_us;
+        }
+        reader->last_time_us = record->time_us;
+
+        return true;
+    }
+
+    return false;
+}
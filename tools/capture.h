@@ -0,0 +1,60 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+
+
+/*
+PID traffic captured from a game, one report per line:
+
+    <time_us> <interface> <kind> <report_id> [<hex byte> ...]
+
+  * time_us is from the start of the capture, and never goes backwards.
+  * interface is the HID interface (i.e. which stick) the report was sent to.
+  * kind is O for an output report, F for a feature report the host set,
+    or G for a feature report the host asked for (no data bytes).
+  * The data bytes are the report as the firmware's callback sees it,
+    so without the report ID.
+
+Blank lines and lines starting with # are ignored.
+See usbmon_to_capture.py for making one from a real game session.
+*/
+
+#define CAPTURE_MAX_REPORT_SIZE 64
+
+enum CaptureKind
+{
+    CAPTURE_OUTPUT      = 'O',
+    CAPTURE_SET_FEATURE = 'F',
+    CAPTURE_GET_FEATURE = 'G',
+};
+
+struct CaptureRecord
+{
+    uint64_t time_us;
+    uint8_t interface;
+    enum CaptureKind kind;
+    uint8_t report_id;
+    uint8_t data[CAPTURE_MAX_REPORT_SIZE];
+    uint16_t size;
+};
+
+struct CaptureReader
+{
+    FILE *file;
+    const char *name;
+    unsigned line;
+    uint64_t last_time_us;
+};
+
+
+bool capture_open(struct CaptureReader *reader, const char *path);
+void capture_close(struct CaptureReader *reader);
+
+// Returns false at the end of the file. Malformed lines are reported on stderr and skipped.
+bool capture_next(struct CaptureReader *reader, struct CaptureRecord *record);
+
+
+#endif //CAPTURE_H
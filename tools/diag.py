@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""
+Reads statistics from the adapter over its diagnostics interface (see diag.h).
+
+    ./diag.py power     # clock profile, suspend state, and report latency per profile
+    ./diag.py cpu       # CPU time per subsystem over the last second
+    ./diag.py latency   # XIP cache hit rate, IRQ latency and hot-path timings since the last call
+    ./diag.py sched     # how late each main-loop task ran, and its deadline misses, over the last second
+    ./diag.py load constant --gain 100 --direction 90 --start
+                        # defines an effect in one request, and prints the host effect ID it got
+    ./diag.py rules 0x1:rising:play:3 0x1:falling:pause:3
+                        # replaces the button rules: <button mask>:<edge>:<action>:<host effect ID> each;
+                        # with none, clears them
+"""
+
+import argparse
+import struct
+
+import diag_usb
+
+DIAG_CMD_POWER_STATS = 0x02
+DIAG_CMD_CPU_LOAD = 0x03
+DIAG_CMD_LATENCY_STATS = 0x04
+DIAG_CMD_SCHED_STATS = 0x05
+DIAG_CMD_LOAD_EFFECT = 0x06
+DIAG_CMD_LOAD_BUTTON_RULES = 0x07
+
+POWER_STATES = ['active', 'suspended', 'waking']
+CLOCK_PROFILES = ['suspend', 'normal', 'turbo']
+
+POWER_STATS = struct.Struct('<BBHII')      # state, profile, reserved, sys_hz, wakeups
+PROFILE_STATS = struct.Struct('<IIQI')     # time_ms, reports, latency_us_total, latency_us_max
+
+# enum CpuSubsystem
+CPU_SUBSYSTEMS = ['usb', 'hid', 'button rules', 'custom force', 'effect upload', 'midi passthrough', 'diag', 'power', 'frame irq']
+CPU_LOAD = struct.Struct('<IIIII%dI' % len(CPU_SUBSYSTEMS))
+
+# enum LatencyPath
+LATENCY_PATHS = ['irq entry', 'frame irq', 'hid report', 'set report']
+LATENCY_STATS = struct.Struct('<IIB3xQQ')  # sys_hz, window_us, ram_hot_path, xip_accesses, xip_hits
+LATENCY_TIMING = struct.Struct('<IIIQ')    # count, min_cycles, max_cycles, total_cycles
+
+# enum SchedTaskId
+SCHED_TASKS = ['usb', 'hid', 'midi passthrough', 'diag', 'power', 'button rules', 'custom force', 'effect upload']
+SCHED_STATS = struct.Struct('<II')         # window_us, passes
+SCHED_TASK_STATS = struct.Struct('<IIIIIQ')  # period_us, deadline_us, runs, misses, max_lateness_us, total_lateness_us
+
+# enum MidiEffectType
+EFFECT_TYPES = {
+    'sine': 0x02, 'square': 0x05, 'ramp': 0x06, 'triangle': 0x08, 'sawtoothdown': 0x0a, 'sawtoothup': 0x0b,
+    'spring': 0x0d, 'damper': 0x0e, 'inertia': 0x0f, 'friction': 0x10, 'constant': 0x12,
+}
+
+# struct DiagEffectLoad after stick, start and type, with the defaults a PID-created effect gets (effect_pool.c)
+EFFECT_FIELDS = [
+    ('duration', 'H', 0), ('button_mask', 'H', 0), ('direction', 'H', 0), ('gain', 'B', 0x7f),
+    ('sample_rate', 'B', 100), ('attack_level', 'B', 0x7f), ('sustain_level', 'B', 0x7f), ('fade_level', 'B', 0x7f),
+    ('attack_time', 'H', 0), ('fade_time', 'H', 0), ('frequency', 'H', 1), ('amplitude', 'H', 0x7f),
+    ('ramp_end', 'H', 0), ('strength_x', 'B', 0), ('strength_y', 'B', 0), ('offset_x', 'H', 0), ('offset_y', 'H', 0),
+]
+EFFECT_LOAD = struct.Struct('<BBB' + ''.join(f for _, f, _ in EFFECT_FIELDS))
+EFFECT_LOAD_RESULT = struct.Struct('<BBB')  # effect_id, load_status, num_available
+LOAD_STATUSES = {1: 'loaded', 2: 'full'}
+
+# struct DiagButtonRulesLoad; enum ButtonEdge and enum ButtonAction (button_rules.h)
+MAX_BUTTON_RULES = 16
+BUTTON_RULE = struct.Struct('<HBBB')       # button_mask, edge, action, effect_id
+BUTTON_RULES_LOAD = struct.Struct('<BB%ds' % (MAX_BUTTON_RULES * BUTTON_RULE.size))
+BUTTON_RULES_RESULT = struct.Struct('<B')  # loaded
+BUTTON_EDGES = ['rising', 'falling', 'both']
+BUTTON_ACTIONS = ['play', 'solo', 'pause']
+
+
+def show_power(args):
+    data = diag_usb.request(DIAG_CMD_POWER_STATS)
+    state, profile, _, sys_hz, wakeups = POWER_STATS.unpack_from(data)
+
+    print('state:    %s' % POWER_STATES[state])
+    print('profile:  %s (%.1f MHz)' % (CLOCK_PROFILES[profile], sys_hz / 1e6))
+    print('wakeups:  %d' % wakeups)
+    print()
+    print('%-8s %10s %10s %12s %12s' % ('profile', 'time (s)', 'reports', 'mean (us)', 'max (us)'))
+
+    for i, name in enumerate(CLOCK_PROFILES):
+        time_ms, reports, total_us, max_us = PROFILE_STATS.unpack_from(data, POWER_STATS.size + i * PROFILE_STATS.size)
+        mean = '%.1f' % (total_us / reports) if reports else '-'
+        print('%-8s %10.1f %10d %12s %12d' % (name, time_ms / 1000, reports, mean, max_us))
+
+
+def show_cpu(args):
+    data = diag_usb.request(DIAG_CMD_CPU_LOAD)
+    sys_hz, window_us, iterations, wakeups, max_iteration_cycles, *busy = CPU_LOAD.unpack_from(data)
+
+    if window_us == 0:
+        print('No complete window yet; try again in a second.')
+        return
+
+    window_cycles = window_us * sys_hz / 1e6
+
+    print('window:          %.3f s at %.1f MHz' % (window_us / 1e6, sys_hz / 1e6))
+    print('loop passes:     %d (%d woke from sleep)' % (iterations, wakeups))
+    print('longest pass:    %.1f us' % (max_iteration_cycles * 1e6 / sys_hz))
+    print()
+
+    # Frame IRQ time is also inside whichever subsystem it interrupted, so it's left out of the total
+    total = 0
+    for name, cycles in zip(CPU_SUBSYSTEMS, busy):
+        print('%-16s %6.2f%%' % (name, 100 * cycles / window_cycles))
+        if name != 'frame irq':
+            total += cycles
+    print('%-16s %6.2f%%' % ('idle', max(0, 100 * (1 - total / window_cycles))))
+
+
+def show_latency(args):
+    data = diag_usb.request(DIAG_CMD_LATENCY_STATS)
+    sys_hz, window_us, ram_hot_path, accesses, hits = LATENCY_STATS.unpack_from(data)
+
+    print('build:    %s' % ('RAM_HOT_PATH' if ram_hot_path else 'default (hot paths in flash)'))
+    print('window:   %.3f s at %.1f MHz' % (window_us / 1e6, sys_hz / 1e6))
+    if accesses:
+        print('xip:      %d accesses, %d misses (%.3f%% hit rate)' % (accesses, accesses - hits, 100 * hits / accesses))
+    else:
+        print('xip:      no accesses')
+    print()
+    print('%-12s %8s %10s %10s %10s' % ('path', 'count', 'min (us)', 'mean (us)', 'max (us)'))
+
+    us = 1e6 / sys_hz
+    for i, name in enumerate(LATENCY_PATHS):
+        count, min_cycles, max_cycles, total = LATENCY_TIMING.unpack_from(data, LATENCY_STATS.size + i * LATENCY_TIMING.size)
+        if count == 0:
+            print('%-12s %8d %10s %10s %10s' % (name, 0, '-', '-', '-'))
+            continue
+        print('%-12s %8d %10.2f %10.2f %10.2f' % (name, count, min_cycles * us, total / count * us, max_cycles * us))
+
+
+def show_sched(args):
+    data = diag_usb.request(DIAG_CMD_SCHED_STATS)
+    window_us, passes = SCHED_STATS.unpack_from(data)
+
+    if window_us == 0:
+        print('No complete window yet; try again in a second.')
+        return
+
+    print('window:  %.3f s, %d loop passes' % (window_us / 1e6, passes))
+    print()
+    print('%-16s %10s %10s %8s %8s %10s %10s' % ('task', 'period', 'deadline', 'runs', 'misses', 'mean late', 'max late'))
+
+    for i, name in enumerate(SCHED_TASKS):
+        period_us, deadline_us, runs, misses, max_us, total_us = SCHED_TASK_STATS.unpack_from(
+                data, SCHED_STATS.size + i * SCHED_TASK_STATS.size)
+        period = '%d us' % period_us if period_us else 'each pass'
+        mean = '%.1f us' % (total_us / runs) if runs else '-'
+        print('%-16s %10s %7d us %8d %8d %10s %7d us' % (name, period, deadline_us, runs, misses, mean, max_us))
+
+
+def load_effect(args):
+    values = [getattr(args, name) for name, _, _ in EFFECT_FIELDS]
+    data = diag_usb.request(DIAG_CMD_LOAD_EFFECT, EFFECT_LOAD.pack(args.stick, args.start, EFFECT_TYPES[args.type], *values))
+    effect_id, status, num_available = EFFECT_LOAD_RESULT.unpack_from(data)
+
+    print('status:     %s' % LOAD_STATUSES.get(status, status))
+    if effect_id:
+        print('effect ID:  %d%s' % (effect_id, ' (playing)' if args.start else ''))
+    print('available:  %d' % num_available)
+
+
+def parse_rule(text):
+    try:
+        mask, edge, action, effect_id = text.split(':')
+        return BUTTON_RULE.pack(int(mask, 0), BUTTON_EDGES.index(edge), BUTTON_ACTIONS.index(action), int(effect_id, 0))
+    except (ValueError, struct.error):
+        raise argparse.ArgumentTypeError('not <button mask>:<%s>:<%s>:<host effect ID>: %s'
+                % ('|'.join(BUTTON_EDGES), '|'.join(BUTTON_ACTIONS), text))
+
+
+def load_rules(args):
+    if len(args.rules) > MAX_BUTTON_RULES:
+        raise SystemExit('At most %d rules.' % MAX_BUTTON_RULES)
+
+    data = diag_usb.request(DIAG_CMD_LOAD_BUTTON_RULES, BUTTON_RULES_LOAD.pack(args.stick, len(args.rules), b''.join(args.rules)))
+    loaded, = BUTTON_RULES_RESULT.unpack_from(data)
+
+    print('loaded:  %d of %d rules' % (loaded, len(args.rules)))
+
+
+COMMANDS = {
+    'power': show_power,
+    'cpu': show_cpu,
+    'latency': show_latency,
+    'sched': show_sched,
+    'load': load_effect,
+    'rules': load_rules,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    commands = parser.add_subparsers(dest='command', required=True)
+    for name in COMMANDS:
+        commands.add_parser(name)
+
+    # Parameters as in struct Effect (ffb_midi.h)
+    load = commands.choices['load']
+    load.add_argument('type', choices=EFFECT_TYPES.keys())
+    load.add_argument('--stick', type=int, default=0)
+    load.add_argument('--start', action='store_true', help='play it at once')
+    for name, _, default in EFFECT_FIELDS:
+        load.add_argument('--' + name.replace('_', '-'), type=lambda x: int(x, 0), default=default)
+
+    rules = commands.choices['rules']
+    rules.add_argument('rules', nargs='*', type=parse_rule)
+    rules.add_argument('--stick', type=int, default=0)
+
+    args = parser.parse_args()
+
+    COMMANDS[args.command](args)
+
+
+if __name__ == '__main__':
+    main()
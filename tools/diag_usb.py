@@ -0,0 +1,60 @@
+"""
+Talks to the adapter's diagnostics interface (see diag.h). Needs pyusb.
+"""
+
+import struct
+import sys
+
+VENDOR_ID = 0xcafe
+
+RESPONSE_HEADER = struct.Struct('<BBHI')   # command, status, reserved, length
+
+DIAG_STATUS_OK = 0
+DIAG_STATUS_INVALID = 2
+
+
+def find_interface():
+    import usb.core
+    import usb.util
+
+    for device in usb.core.find(find_all=True, idVendor=VENDOR_ID):
+        for interface in device.get_active_configuration():
+            if interface.bInterfaceClass != 0xff:
+                continue
+
+            ep_out = usb.util.find_descriptor(interface, custom_match=lambda e:
+                    usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+            ep_in = usb.util.find_descriptor(interface, custom_match=lambda e:
+                    usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+            return ep_out, ep_in
+
+    sys.exit('No adapter with a diagnostics interface found. Check DIAG_INTERFACE in config.h.')
+
+
+def request_raw(command, args=b''):
+    """Sends a command and its arguments, and returns the whole reply, header included."""
+    ep_out, ep_in = find_interface()
+
+    ep_out.write(bytes([command]) + args)
+
+    data = bytearray(ep_in.read(4096, timeout=1000))
+    while len(data) < RESPONSE_HEADER.size or \
+            len(data) < RESPONSE_HEADER.size + RESPONSE_HEADER.unpack_from(data)[3]:
+        data += ep_in.read(4096, timeout=1000)
+
+    return bytes(data)
+
+
+def parse_response(data, command):
+    """Checks a reply and returns its payload."""
+    reply_command, status, _, length = RESPONSE_HEADER.unpack_from(data)
+    if reply_command == command and status == DIAG_STATUS_INVALID:
+        sys.exit('The adapter rejected the arguments to command 0x%02x.' % command)
+    if reply_command != command or status != DIAG_STATUS_OK:
+        sys.exit('The adapter refused command 0x%02x (status %d). Is it enabled in config.h?' % (command, status))
+
+    return data[RESPONSE_HEADER.size:RESPONSE_HEADER.size + length]
+
+
+def request(command, args=b''):
+    return parse_response(request_raw(command, args), command)
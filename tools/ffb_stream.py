@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""
+Streams constant-force updates to the adapter the way a racing game does, and times them. Linux only.
+
+    ./ffb_stream.py                     # 5000 updates, as fast as they go
+    ./ffb_stream.py --interval-ms 2     # paced like a game updating at 500 Hz
+
+Creates a constant force effect, starts it, sends Set Constant Force reports
+with a changing magnitude, then frees the effect. Each report is written to
+the stick's hidraw node; the kernel sends it on the interrupt OUT endpoint if
+there is one (HID_OUT_ENDPOINT in config.h), or as a SET_REPORT control
+transfer if not. Either way the write returns once the transfer is done, so
+its duration is the per-update latency. The CPU time this process spent,
+mostly in the kernel, is the host's cost per update.
+
+Run it against builds with and without HID_OUT_ENDPOINT to compare. Needs
+read/write access to the /dev/hidraw node.
+"""
+
+import argparse
+import fcntl
+import glob
+import math
+import os
+import resource
+import time
+
+VENDOR_ID = 0xcafe
+
+# usb_report_ids.h
+REPORT_ID_OUTPUT_SET_CONSTANT = 6
+REPORT_ID_OUTPUT_EFFECT_OPERATION = 8
+REPORT_ID_OUTPUT_BLOCK_FREE = 9
+REPORT_ID_FEATURE_CREATE_NEW_EFFECT = 12
+REPORT_ID_FEATURE_BLOCK_LOAD = 13
+
+USB_ET_CONSTANT = 1         # effect type index in the Create New Effect report
+OP_START = 1
+OP_STOP = 3
+BLOCK_LOAD_SUCCESS = 1
+
+
+def hidioc(direction, number, size):
+    return (direction << 30) | (size << 16) | (ord('H') << 8) | number
+
+
+def HIDIOCSFEATURE(size):
+    return hidioc(3, 0x06, size)
+
+
+def HIDIOCGFEATURE(size):
+    return hidioc(3, 0x07, size)
+
+
+def find_hidraw():
+    """The first of the adapter's hidraw nodes, and whether its interface has an interrupt OUT endpoint."""
+    for path in sorted(glob.glob('/sys/class/hidraw/hidraw*')):
+        with open(os.path.join(path, 'device', 'uevent')) as f:
+            uevent = dict(line.strip().split('=', 1) for line in f if '=' in line)
+
+        # HID_ID=0003:0000CAFE:0000xxxx
+        if int(uevent.get('HID_ID', '0:0:0').split(':')[1], 16) != VENDOR_ID:
+            continue
+
+        interface = os.path.realpath(os.path.join(path, 'device', '..'))
+        has_out = False
+        for ep in glob.glob(os.path.join(interface, 'ep_*')):
+            with open(os.path.join(ep, 'direction')) as f:
+                has_out |= f.read().strip() == 'out'
+
+        return '/dev/' + os.path.basename(path), has_out
+
+    raise SystemExit('No adapter found.')
+
+
+def cpu_seconds():
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return usage.ru_utime + usage.ru_stime
+
+
+def percentile(sorted_values, p):
+    return sorted_values[min(len(sorted_values) - 1, int(len(sorted_values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('--count', type=int, default=5000, help='updates to send (default: 5000)')
+    parser.add_argument('--interval-ms', type=float, default=0, help='time between updates (default: none)')
+    parser.add_argument('--device', help='hidraw node (default: the first one the adapter has)')
+    args = parser.parse_args()
+
+    if args.device:
+        device, has_out = args.device, None
+    else:
+        device, has_out = find_hidraw()
+
+    fd = os.open(device, os.O_RDWR)
+
+    fcntl.ioctl(fd, HIDIOCSFEATURE(2), bytes([REPORT_ID_FEATURE_CREATE_NEW_EFFECT, USB_ET_CONSTANT]))
+    block_load = bytearray([REPORT_ID_FEATURE_BLOCK_LOAD, 0, 0, 0, 0])
+    fcntl.ioctl(fd, HIDIOCGFEATURE(len(block_load)), block_load)
+    effect_id, status = block_load[1], block_load[2]
+    if status != BLOCK_LOAD_SUCCESS:
+        raise SystemExit('The adapter has no room for another effect.')
+
+    latencies = []
+    try:
+        os.write(fd, bytes([REPORT_ID_OUTPUT_EFFECT_OPERATION, effect_id, OP_START, 1]))
+
+        cpu_start = cpu_seconds()
+        wall_start = time.perf_counter()
+        next_time = wall_start
+
+        for i in range(args.count):
+            # A slow sweep, like a wheel being turned back and forth; the magnitude is -255..255
+            magnitude = int(255 * math.sin(i / 200)) & 0xffff
+            report = bytes([REPORT_ID_OUTPUT_SET_CONSTANT, effect_id, magnitude & 0xff, magnitude >> 8])
+
+            start = time.perf_counter()
+            os.write(fd, report)
+            latencies.append(time.perf_counter() - start)
+
+            if args.interval_ms:
+                next_time += args.interval_ms / 1000
+                delay = next_time - time.perf_counter()
+                if delay > 0:
+                    time.sleep(delay)
+
+        wall = time.perf_counter() - wall_start
+        cpu = cpu_seconds() - cpu_start
+    finally:
+        os.write(fd, bytes([REPORT_ID_OUTPUT_EFFECT_OPERATION, effect_id, OP_STOP, 0]))
+        os.write(fd, bytes([REPORT_ID_OUTPUT_BLOCK_FREE, effect_id]))
+        os.close(fd)
+
+    latencies.sort()
+    us = [x * 1e6 for x in latencies]
+
+    print('device:           %s (%s)' % (device, {True: 'interrupt OUT endpoint', False: 'SET_REPORT on EP0',
+                                                  None: 'transport unknown'}[has_out]))
+    print('updates:          %d in %.2f s (%.0f per second)' % (len(us), wall, len(us) / wall))
+    print('write latency:    mean %.0f us, median %.0f us, 99th percentile %.0f us, max %.0f us' %
+          (sum(us) / len(us), percentile(us, 50), percentile(us, 99), us[-1]))
+    print('host CPU time:    %.1f us per update' % (cpu * 1e6 / len(us)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,15 @@
+#ifndef HOST_TUSB_COMMON_H
+#define HOST_TUSB_COMMON_H
+
+// Just enough of TinyUSB's common helpers for its HID report items (see device/usbd.h).
+
+#include <stdint.h>
+
+#define TU_U16_LOW(x)       ((uint8_t) ((x) & 0xff))
+#define TU_U16_HIGH(x)      ((uint8_t) (((x) >> 8) & 0xff))
+
+#define U16_TO_U8S_LE(x)    TU_U16_LOW(x), TU_U16_HIGH(x)
+#define U32_TO_U8S_LE(x)    ((uint8_t) (x)), ((uint8_t) ((x) >> 8)), ((uint8_t) ((x) >> 16)), ((uint8_t) ((x) >> 24))
+
+
+#endif //HOST_TUSB_COMMON_H
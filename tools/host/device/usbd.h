@@ -0,0 +1,120 @@
+#ifndef HOST_USBD_H
+#define HOST_USBD_H
+
+// Just enough of TinyUSB to build the HID report descriptor in usb_descriptors.h
+// on a PC: its short report items, encoded as TinyUSB does (HID 1.11, 6.2.2).
+
+#include "common/tusb_common.h"
+
+#define HID_REPORT_DATA_0(data)
+#define HID_REPORT_DATA_1(data) , data
+#define HID_REPORT_DATA_2(data) , U16_TO_U8S_LE(data)
+#define HID_REPORT_DATA_3(data) , U32_TO_U8S_LE(data)
+
+// Size 3 means 4 bytes of data
+#define HID_REPORT_ITEM(data, tag, type, size) \
+    (((tag) << 4) | ((type) << 2) | (size)) HID_REPORT_DATA_##size(data)
+
+enum
+{
+    RI_TYPE_MAIN = 0,
+    RI_TYPE_GLOBAL,
+    RI_TYPE_LOCAL,
+};
+
+enum
+{
+    RI_MAIN_INPUT = 8,
+    RI_MAIN_OUTPUT,
+    RI_MAIN_COLLECTION,
+    RI_MAIN_FEATURE,
+    RI_MAIN_COLLECTION_END,
+};
+
+enum
+{
+    RI_GLOBAL_USAGE_PAGE = 0,
+    RI_GLOBAL_LOGICAL_MIN,
+    RI_GLOBAL_LOGICAL_MAX,
+    RI_GLOBAL_PHYSICAL_MIN,
+    RI_GLOBAL_PHYSICAL_MAX,
+    RI_GLOBAL_UNIT_EXPONENT,
+    RI_GLOBAL_UNIT,
+    RI_GLOBAL_REPORT_SIZE,
+    RI_GLOBAL_REPORT_ID,
+    RI_GLOBAL_REPORT_COUNT,
+};
+
+enum
+{
+    RI_LOCAL_USAGE = 0,
+    RI_LOCAL_USAGE_MIN,
+    RI_LOCAL_USAGE_MAX,
+};
+
+// Main items
+#define HID_INPUT(x)                HID_REPORT_ITEM(x, RI_MAIN_INPUT, RI_TYPE_MAIN, 1)
+#define HID_OUTPUT(x)               HID_REPORT_ITEM(x, RI_MAIN_OUTPUT, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION(x)           HID_REPORT_ITEM(x, RI_MAIN_COLLECTION, RI_TYPE_MAIN, 1)
+#define HID_FEATURE(x)              HID_REPORT_ITEM(x, RI_MAIN_FEATURE, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION_END          HID_REPORT_ITEM(x, RI_MAIN_COLLECTION_END, RI_TYPE_MAIN, 0)
+
+// Global items
+#define HID_USAGE_PAGE(x)           HID_REPORT_ITEM(x, RI_GLOBAL_USAGE_PAGE, RI_TYPE_GLOBAL, 1)
+#define HID_USAGE_PAGE_N(x, n)      HID_REPORT_ITEM(x, RI_GLOBAL_USAGE_PAGE, RI_TYPE_GLOBAL, n)
+#define HID_LOGICAL_MIN(x)          HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MIN, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MIN_N(x, n)     HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MIN, RI_TYPE_GLOBAL, n)
+#define HID_LOGICAL_MAX(x)          HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MAX, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MAX_N(x, n)     HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MAX, RI_TYPE_GLOBAL, n)
+#define HID_PHYSICAL_MIN(x)         HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MIN, RI_TYPE_GLOBAL, 1)
+#define HID_PHYSICAL_MIN_N(x, n)    HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MIN, RI_TYPE_GLOBAL, n)
+#define HID_PHYSICAL_MAX(x)         HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MAX, RI_TYPE_GLOBAL, 1)
+#define HID_PHYSICAL_MAX_N(x, n)    HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MAX, RI_TYPE_GLOBAL, n)
+#define HID_UNIT_EXPONENT(x)        HID_REPORT_ITEM(x, RI_GLOBAL_UNIT_EXPONENT, RI_TYPE_GLOBAL, 1)
+#define HID_UNIT(x)                 HID_REPORT_ITEM(x, RI_GLOBAL_UNIT, RI_TYPE_GLOBAL, 1)
+#define HID_UNIT_N(x, n)            HID_REPORT_ITEM(x, RI_GLOBAL_UNIT, RI_TYPE_GLOBAL, n)
+#define HID_REPORT_SIZE(x)          HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_SIZE, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_ID(x)            HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_ID, RI_TYPE_GLOBAL, 1),
+#define HID_REPORT_COUNT(x)         HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_COUNT, RI_TYPE_GLOBAL, 1)
+
+// Local items
+#define HID_USAGE(x)                HID_REPORT_ITEM(x, RI_LOCAL_USAGE, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MIN(x)            HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MIN, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MAX(x)            HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MAX, RI_TYPE_LOCAL, 1)
+
+// Main item flags
+#define HID_DATA                    (0 << 0)
+#define HID_CONSTANT                (1 << 0)
+#define HID_ARRAY                   (0 << 1)
+#define HID_VARIABLE                (1 << 1)
+#define HID_ABSOLUTE                (0 << 2)
+#define HID_RELATIVE                (1 << 2)
+
+enum
+{
+    HID_COLLECTION_PHYSICAL = 0,
+    HID_COLLECTION_APPLICATION,
+    HID_COLLECTION_LOGICAL,
+};
+
+enum
+{
+    HID_USAGE_PAGE_DESKTOP  = 0x01,
+    HID_USAGE_PAGE_BUTTON   = 0x09,
+    HID_USAGE_PAGE_ORDINAL  = 0x0a,
+    HID_USAGE_PAGE_PID      = 0x0f,
+    HID_USAGE_PAGE_VENDOR   = 0xff00,
+};
+
+enum
+{
+    HID_USAGE_DESKTOP_JOYSTICK      = 0x04,
+    HID_USAGE_DESKTOP_X             = 0x30,
+    HID_USAGE_DESKTOP_Y             = 0x31,
+    HID_USAGE_DESKTOP_RZ            = 0x35,
+    HID_USAGE_DESKTOP_SLIDER        = 0x36,
+    HID_USAGE_DESKTOP_HAT_SWITCH    = 0x39,
+};
+
+
+#endif //HOST_USBD_H
@@ -0,0 +1,13 @@
+#ifndef HOST_HARDWARE_PIO_H
+#define HOST_HARDWARE_PIO_H
+
+#include "pico/stdlib.h"
+
+// Only the types struct Joystick needs; nothing on the host drives a PIO.
+typedef struct pio_hw pio_hw_t;
+typedef pio_hw_t *PIO;
+
+typedef void (*irq_handler_t)(void);
+
+
+#endif //HOST_HARDWARE_PIO_H
@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_UART_H
+#define HOST_HARDWARE_UART_H
+
+#include "pico/stdlib.h"
+
+// Each tool defines struct uart_inst to be whatever it wants the MIDI bytes to land in.
+typedef struct uart_inst uart_inst_t;
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+
+
+#endif //HOST_HARDWARE_UART_H
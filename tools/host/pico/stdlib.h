@@ -0,0 +1,46 @@
+#ifndef HOST_PICO_STDLIB_H
+#define HOST_PICO_STDLIB_H
+
+// Just enough of the Pico SDK to build the firmware's portable modules on a PC.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+// Everything runs from RAM here (see hot_path.h)
+#define __not_in_flash(group)
+#define __not_in_flash_func(name) name
+
+// Simulated time, driven by the tool (see host_clock.c)
+extern uint64_t host_time_us;
+
+static inline uint32_t time_us_32()
+{
+    return (uint32_t) host_time_us;
+}
+
+static inline uint64_t time_us_64()
+{
+    return host_time_us;
+}
+
+static inline void __compiler_memory_barrier()
+{
+    __asm__ volatile ("" ::: "memory");
+}
+
+typedef uint64_t absolute_time_t;
+
+#define at_the_end_of_time ((absolute_time_t) UINT64_MAX)
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us)
+{
+    return host_time_us + us;
+}
+
+
+#endif //HOST_PICO_STDLIB_H
@@ -0,0 +1,34 @@
+#ifndef HOST_TUSB_H
+#define HOST_TUSB_H
+
+// Just enough of TinyUSB to build usb.c on a PC.
+
+#include "pico/stdlib.h"
+
+// The firmware's own config, so CFG_TUD_HID etc. match the real build
+#define OPT_MCU_NONE            0
+#define OPT_OS_NONE             1
+#define OPT_MODE_DEFAULT_SPEED  0
+#define CFG_TUSB_MCU            OPT_MCU_NONE
+#include "tusb_config.h"
+
+typedef enum
+{
+    HID_REPORT_TYPE_INVALID = 0,
+    HID_REPORT_TYPE_INPUT,
+    HID_REPORT_TYPE_OUTPUT,
+    HID_REPORT_TYPE_FEATURE,
+} hid_report_type_t;
+
+// Provided by usb.c
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
+        hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen);
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
+        hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize);
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len);
+
+// Provided by host_clock.c; reports to the host go nowhere
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const* report, uint16_t len);
+
+
+#endif //HOST_TUSB_H
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_link.h"
+
+void midi_link_init(struct MidiLink *link)
+{
+    memset(link, 0, sizeof(*link));
+}
+
+void midi_link_free(struct MidiLink *link)
+{
+    free(link->writes);
+    link->writes = NULL;
+    link->num_writes = link->writes_capacity = 0;
+}
+
+static uint32_t backlog_bytes_at(const struct MidiLink *link, uint64_t now_us)
+{
+    if (link->busy_until_us <= now_us) { return 0; }
+
+    return (link->busy_until_us - now_us + MIDI_LINK_US_PER_BYTE - 1) / MIDI_LINK_US_PER_BYTE;
+}
+
+uint32_t midi_link_backlog_bytes(const struct MidiLink *link)
+{
+    return backlog_bytes_at(link, host_time_us);
+}
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len)
+{
+    struct MidiLink *link = &uart->link;
+    uint64_t now_us = host_time_us;
+
+    if (len == 0) { return; }
+
+    if (link->busy_until_us < now_us) { link->busy_until_us = now_us; }
+    link->busy_until_us += (uint64_t) len * MIDI_LINK_US_PER_BYTE;
+    link->bytes_total += len;
+
+    uint64_t backlog_us = link->busy_until_us - now_us;
+    if (backlog_us > link->peak_backlog_us) { link->peak_backlog_us = backlog_us; }
+
+    uint32_t backlog_bytes = backlog_bytes_at(link, now_us);
+    if (backlog_bytes > link->peak_backlog_bytes) { link->peak_backlog_bytes = backlog_bytes; }
+
+    if (link->num_writes == link->writes_capacity)
+    {
+        link->writes_capacity = link->writes_capacity ? link->writes_capacity * 2 : 1024;
+        link->writes = realloc(link->writes, link->writes_capacity * sizeof(*link->writes));
+        if (link->writes == NULL) { abort(); }
+    }
+    link->writes[link->num_writes++] = (struct MidiLinkWrite) { now_us, len };
+
+    if (link->on_write) { link->on_write(link, src, len); }
+}
+
+uint64_t midi_link_peak_window_bytes(const struct MidiLink *link, uint64_t window_us)
+{
+    uint64_t peak = 0;
+    uint64_t in_window = 0;
+    size_t first = 0;
+
+    for (size_t i = 0; i < link->num_writes; i++)
+    {
+        in_window += link->writes[i].size;
+
+        while (link->writes[i].time_us - link->writes[first].time_us >= window_us)
+        {
+            in_window -= link->writes[first].size;
+            first++;
+        }
+
+        if (in_window > peak) { peak = in_window; }
+    }
+
+    return peak;
+}
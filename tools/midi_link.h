@@ -0,0 +1,59 @@
+#ifndef MIDI_LINK_H
+#define MIDI_LINK_H
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+
+
+/*
+A simulated MIDI cable. Bytes written by the firmware are queued and go out
+at 31250 baud (10 bits per byte, so 320 us each). The queue is unbounded and
+never stalls the writer, so the backlog shows how far the wire falls behind
+the host, rather than hiding it in a blocked CPU.
+*/
+
+#define MIDI_LINK_BAUD 31250
+#define MIDI_LINK_US_PER_BYTE (10 * 1000000 / MIDI_LINK_BAUD)
+
+struct MidiLinkWrite
+{
+    uint64_t time_us;
+    uint32_t size;
+};
+
+struct MidiLink
+{
+    uint64_t busy_until_us;     // when the last queued byte finishes on the wire
+    uint64_t bytes_total;
+
+    uint64_t peak_backlog_us;
+    uint32_t peak_backlog_bytes;
+
+    // Every write, for windowed throughput
+    struct MidiLinkWrite *writes;
+    size_t num_writes;
+    size_t writes_capacity;
+
+    // Optional copy of everything sent, for tools that check the bytes themselves
+    void (*on_write)(struct MidiLink *link, const uint8_t *data, size_t size);
+    void *user;
+};
+
+// The firmware only sees a uart_inst_t; ours is a link.
+struct uart_inst
+{
+    struct MidiLink link;
+};
+
+
+void midi_link_init(struct MidiLink *link);
+void midi_link_free(struct MidiLink *link);
+
+// Bytes still waiting to go out at the current (host) time
+uint32_t midi_link_backlog_bytes(const struct MidiLink *link);
+
+// Most bytes queued within any window_us-long window
+uint64_t midi_link_peak_window_bytes(const struct MidiLink *link, uint64_t window_us);
+
+
+#endif //MIDI_LINK_H
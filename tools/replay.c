@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "config.h"
+#include "capture.h"
+#include "midi_link.h"
+#include "usb.h"
+#include "usb_report_ids.h"
+#include "ffb_midi.h"
+#include "effect_pool.h"
+#include "custom_force.h"
+#include "pid_table.h"
+#include "sidewinder_model.h"
+
+/*
+Pushes a capture (see capture.h) through the firmware's HID callbacks, with each
+stick's MIDI going over a simulated 31250 baud link, and reports what it cost:
+MIDI throughput, how far the link fell behind, and how long Start/Stop
+operations took to finish going out to the stick.
+
+    replay [-q] [-c] <capture> [<capture> ...]
+
+Each capture starts from a freshly initialised firmware. What each stick
+receives goes through the model of its MIDI receiver (sidewinder_model.h),
+and the replay fails if the stick would have choked on any of it.
+
+With -c, each capture is replayed with running status (MIDI_STATUS_RUNNING),
+whatever config.h sets, then a second time with every MIDI status byte sent
+(MIDI_STATUS_ALWAYS), and after every report the modelled stick must be
+in the same state as in the first run. Custom force streams amplitudes as
+fast as the link allows, so when it did, amplitudes are left out of that.
+*/
+
+#define EFFECT_OP_START 1
+#define EFFECT_OP_START_SOLO 2
+#define EFFECT_OP_STOP 3
+
+struct LatencyList
+{
+    uint64_t *values;
+    size_t count;
+    size_t capacity;
+};
+
+static void latency_add(struct LatencyList *list, uint64_t value)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->values = realloc(list->values, list->capacity * sizeof(*list->values));
+        if (list->values == NULL) { abort(); }
+    }
+    list->values[list->count++] = value;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const struct LatencyList *list, unsigned pct)
+{
+    if (list->count == 0) { return 0; }
+
+    size_t index = (list->count * pct + 99) / 100;
+    if (index > 0) { index--; }
+    return list->values[index];
+}
+
+static void print_latency(const char *name, struct LatencyList *list)
+{
+    if (list->count == 0)
+    {
+        printf("  %-6s latency:      none\n", name);
+        return;
+    }
+
+    qsort(list->values, list->count, sizeof(*list->values), compare_u64);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < list->count; i++) { total += list->values[i]; }
+
+    printf("  %-6s latency (us): n=%zu mean=%llu p50=%llu p99=%llu max=%llu\n", name, list->count,
+            (unsigned long long) (total / list->count),
+            (unsigned long long) percentile(list, 50),
+            (unsigned long long) percentile(list, 99),
+            (unsigned long long) list->values[list->count - 1]);
+}
+
+static void model_on_write(struct MidiLink *link, const uint8_t *data, size_t size)
+{
+    sidewinder_model_receive(link->user, data, size);
+}
+
+static uint32_t fold_hash(uint32_t hash, uint32_t value)
+{
+    return (hash ^ value) * 0x01000193;
+}
+
+// What one stick got out of a replay
+struct StickResult
+{
+    uint64_t bytes;
+    uint32_t messages;
+    uint32_t status_bytes_saved;
+    uint32_t custom_force_samples;
+    uint32_t state_history;                 // the model's state after each report, folded together
+    uint32_t state_history_no_amplitude;
+};
+
+struct Stick
+{
+    struct uart_inst uart;
+    struct SidewinderModel model;
+    uint32_t state_history;
+    uint32_t state_history_no_amplitude;
+    struct FfbMidi midi;
+    struct EffectPool pool;
+    struct CustomForcePlayer custom_force;
+};
+
+// Let the custom force players and effect uploads run, as the firmware's main loop would, until the given time
+static void run_players_until(struct Stick *sticks, uint64_t until_us)
+{
+    while (1)
+    {
+        absolute_time_t next = at_the_end_of_time;
+        for (int i = 0; i < CFG_TUD_HID; i++)
+        {
+            absolute_time_t deadline = custom_force_get_wake_deadline(&sticks[i].custom_force);
+            if (deadline < next) { next = deadline; }
+            deadline = effect_pool_get_wake_deadline(&sticks[i].pool);
+            if (deadline < next) { next = deadline; }
+        }
+
+        if (next > until_us) { return; }
+        if (next > host_time_us) { host_time_us = next; }
+
+        uint64_t before_us = host_time_us;
+        for (int i = 0; i < CFG_TUD_HID; i++)
+        {
+            custom_force_task(&sticks[i].custom_force);
+            effect_pool_task(&sticks[i].pool);
+        }
+
+        // Nothing to send yet; step on rather than asking again at the same instant
+        if (host_time_us == before_us && next <= before_us) { host_time_us++; }
+    }
+}
+
+static int replay(const char *path, bool quiet, bool report, enum FfbMidiStatusMode status_mode,
+        struct StickResult *results)
+{
+    struct CaptureReader reader;
+    if (!capture_open(&reader, path))
+    {
+        perror(path);
+        return 1;
+    }
+
+    pid_table_init();
+
+    static struct Stick sticks[CFG_TUD_HID];
+    for (int i = 0; i < CFG_TUD_HID; i++)
+    {
+        midi_link_init(&sticks[i].uart.link);
+        sidewinder_model_init(&sticks[i].model);
+        sticks[i].state_history = sticks[i].state_history_no_amplitude = 0x811c9dc5;
+        sticks[i].uart.link.on_write = model_on_write;
+        sticks[i].uart.link.user = &sticks[i].model;
+        ffb_midi_init(&sticks[i].midi, &sticks[i].uart);
+        ffb_midi_set_status_mode(&sticks[i].midi, status_mode);
+        effect_pool_init(&sticks[i].pool, &sticks[i].midi);
+        usb_set_effect_pool(i, &sticks[i].pool);
+        custom_force_init(&sticks[i].custom_force, &sticks[i].pool);
+        usb_set_custom_force_player(i, &sticks[i].custom_force);
+    }
+
+    struct LatencyList start_latency = {0};
+    struct LatencyList stop_latency = {0};
+
+    struct CaptureRecord record;
+    uint64_t first_us = 0;
+    uint64_t num_records = 0;
+
+    host_time_us = 0;
+
+    while (capture_next(&reader, &record))
+    {
+        if (record.interface >= CFG_TUD_HID)
+        {
+            fprintf(stderr, "%s:%u: no interface %u in this build\n", path, reader.line, record.interface);
+            continue;
+        }
+
+        if (num_records++ == 0) { first_us = record.time_us; }
+        run_players_until(sticks, record.time_us);
+        host_time_us = record.time_us;
+
+        struct MidiLink *link = &sticks[record.interface].uart.link;
+        uint64_t bytes_before = link->bytes_total;
+
+        switch (record.kind)
+        {
+            case CAPTURE_OUTPUT:
+                tud_hid_set_report_cb(record.interface, record.report_id, HID_REPORT_TYPE_OUTPUT, record.data, record.size);
+                break;
+            case CAPTURE_SET_FEATURE:
+                tud_hid_set_report_cb(record.interface, record.report_id, HID_REPORT_TYPE_FEATURE, record.data, record.size);
+                break;
+            case CAPTURE_GET_FEATURE:
+            {
+                uint8_t buffer[CAPTURE_MAX_REPORT_SIZE];
+                tud_hid_get_report_cb(record.interface, record.report_id, HID_REPORT_TYPE_FEATURE, buffer, sizeof(buffer));
+                break;
+            }
+        }
+
+        struct Stick *stick = &sticks[record.interface];
+        stick->state_history = fold_hash(stick->state_history, sidewinder_model_state_hash(&stick->model, true));
+        stick->state_history_no_amplitude = fold_hash(stick->state_history_no_amplitude,
+                sidewinder_model_state_hash(&stick->model, false));
+
+        // Latency runs from the host sending the operation to the last byte it caused reaching the stick
+        if (record.kind == CAPTURE_OUTPUT && record.report_id == REPORT_ID_OUTPUT_EFFECT_OPERATION
+                && record.size >= 2 && link->bytes_total > bytes_before)
+        {
+            uint64_t latency = link->busy_until_us - record.time_us;
+
+            switch (record.data[1])
+            {
+                case EFFECT_OP_START:
+                case EFFECT_OP_START_SOLO:
+                    latency_add(&start_latency, latency);
+                    break;
+                case EFFECT_OP_STOP:
+                    latency_add(&stop_latency, latency);
+                    break;
+            }
+        }
+    }
+
+    capture_close(&reader);
+
+    int result = 0;
+    for (int i = 0; i < CFG_TUD_HID; i++)
+    {
+        struct SidewinderModel *model = &sticks[i].model;
+
+        results[i].bytes = sticks[i].uart.link.bytes_total;
+        results[i].messages = model->messages;
+        results[i].status_bytes_saved = sticks[i].midi.status_bytes_saved;
+        results[i].custom_force_samples = 0;
+        for (int j = 0; j < CUSTOM_FORCE_SLOTS; j++)
+        {
+            results[i].custom_force_samples += sticks[i].custom_force.effects[j].stats.samples_sent;
+        }
+        results[i].state_history = sticks[i].state_history;
+        results[i].state_history_no_amplitude = sticks[i].state_history_no_amplitude;
+
+        if (model->errors > 0 || !sidewinder_model_idle(model))
+        {
+            fprintf(stderr, "%s: stick %d: %u errors in the MIDI stream; first at byte %llu: %s\n", path, i,
+                    model->errors, (unsigned long long) model->first_error_byte,
+                    model->errors > 0 ? model->first_error : "ends mid-message");
+            result = 1;
+        }
+    }
+
+    if (report)
+    {
+        uint64_t duration_us = host_time_us - first_us;
+
+        printf("%s: %llu reports over %.3f s\n", path, (unsigned long long) num_records, duration_us / 1e6);
+
+        for (int i = 0; i < CFG_TUD_HID; i++)
+        {
+            struct MidiLink *link = &sticks[i].uart.link;
+            const struct FfbMidiCacheStats *cache = ffb_midi_get_cache_stats(&sticks[i].midi);
+            const struct EffectPoolStats *pool = effect_pool_get_stats(&sticks[i].pool);
+            const struct FfbMidiPlayStats *play = ffb_midi_get_play_stats(&sticks[i].midi);
+
+            // The link keeps going after the last report, until it's drained
+            uint64_t end_us = link->busy_until_us > host_time_us ? link->busy_until_us : host_time_us;
+            double seconds = (end_us - first_us) / 1e6;
+
+            printf(" stick %d:\n", i);
+            printf("  midi bytes:           %llu (%u messages)\n", (unsigned long long) link->bytes_total,
+                    sticks[i].model.messages);
+            printf("  midi bytes/s:         %.1f average, %llu peak (1 s window), %d link capacity\n",
+                    seconds > 0 ? link->bytes_total / seconds : 0.0,
+                    (unsigned long long) midi_link_peak_window_bytes(link, 1000000),
+                    1000000 / MIDI_LINK_US_PER_BYTE);
+            printf("  peak backlog:         %u bytes (%.1f ms)\n", link->peak_backlog_bytes, link->peak_backlog_us / 1e3);
+
+            if (!quiet)
+            {
+                printf("  effect cache:         %u hits, %u misses, %u evictions, %u bytes saved\n",
+                        cache->hits, cache->misses, cache->evictions, cache->bytes_saved);
+                printf("  effect pool:          %u uploaded after creation, %u page-ins, %u evictions\n",
+                        pool->uploads, pool->page_ins, pool->evictions);
+                printf("  playing set:          peak %u of %d, %u preempted, %u refused\n", play->peak_playing,
+                        MAX_SIMULTANEOUS_EFFECTS, play->preemptions, play->refusals);
+                printf("  running status:       %u status bytes left out\n", sticks[i].midi.status_bytes_saved);
+                printf("  stick at the end:     %zu effects defined, %zu playing (%u definitions received)\n",
+                        sidewinder_model_num_defined(&sticks[i].model), sidewinder_model_num_playing(&sticks[i].model),
+                        sticks[i].model.definitions);
+
+                uint32_t sent = 0, skipped = 0;
+                for (int j = 0; j < CUSTOM_FORCE_SLOTS; j++)
+                {
+                    sent += sticks[i].custom_force.effects[j].stats.samples_sent;
+                    skipped += sticks[i].custom_force.effects[j].stats.samples_skipped;
+                }
+                if (sent > 0) { printf("  custom force:         %u samples sent, %u skipped\n", sent, skipped); }
+            }
+        }
+
+        print_latency("start", &start_latency);
+        print_latency("stop", &stop_latency);
+    }
+
+    for (int i = 0; i < CFG_TUD_HID; i++) { midi_link_free(&sticks[i].uart.link); }
+
+    free(start_latency.values);
+    free(stop_latency.values);
+
+    return result;
+}
+
+// With -c: the stick must go through the same states as with every status byte sent
+static int check_status_mode(const char *path, const struct StickResult *results)
+{
+    struct StickResult reference[CFG_TUD_HID];
+    if (replay(path, true, false, MIDI_STATUS_ALWAYS, reference) != 0) { return 1; }
+
+    int result = 0;
+    for (int i = 0; i < CFG_TUD_HID; i++)
+    {
+        // Streamed samples can only be compared loosely; everything else must match exactly
+        bool streamed = results[i].custom_force_samples > 0 || reference[i].custom_force_samples > 0;
+        bool same = streamed ? results[i].state_history_no_amplitude == reference[i].state_history_no_amplitude
+                : results[i].state_history == reference[i].state_history;
+
+        if (!same)
+        {
+            printf("  stick %d: FAIL, the stick ends up in a different state than with every status byte sent\n", i);
+            result = 1;
+            continue;
+        }
+
+        uint64_t unsaved = results[i].bytes + results[i].status_bytes_saved;
+        printf("  stick %d: same states%s as with every status byte sent, %u of %llu bytes saved (%.1f%%)\n",
+                i, streamed ? " (besides custom force amplitudes)" : "", results[i].status_bytes_saved,
+                (unsigned long long) unsaved, unsaved > 0 ? 100.0 * results[i].status_bytes_saved / unsaved : 0.0);
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    bool quiet = false;
+    bool check = false;
+    int first = 1;
+
+    for (; first < argc && argv[first][0] == '-'; first++)
+    {
+        if (strcmp(argv[first], "-q") == 0) { quiet = true; }
+        else if (strcmp(argv[first], "-c") == 0) { check = true; }
+        else { break; }
+    }
+
+    if (first >= argc || argv[first][0] == '-')
+    {
+        fprintf(stderr, "usage: %s [-q] [-c] <capture> [<capture> ...]\n", argv[0]);
+        return 2;
+    }
+
+    int result = 0;
+    for (int i = first; i < argc; i++)
+    {
+        struct StickResult results[CFG_TUD_HID];
+        int status = replay(argv[i], quiet, true, check ? MIDI_STATUS_RUNNING : MIDI_STATUS_MODE, results);
+        if (status == 0 && check) { status = check_status_mode(argv[i], results); }
+        result |= status;
+    }
+
+    return result;
+}
@@ -0,0 +1,499 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sidewinder_model.h"
+
+#define PARAM_BIT(param) (1u << SIDEWINDER_MODEL_PARAM_INDEX(param))
+
+// What each kind of effect accepts in a modify; anything else is an error
+#define COMMON_PARAMS (PARAM_BIT(MODIFY_DURATION) | PARAM_BIT(MODIFY_BUTTON_MASK))
+
+#define PERIODIC_PARAMS (COMMON_PARAMS | PARAM_BIT(MODIFY_DIRECTION) | PARAM_BIT(MODIFY_GAIN) \
+        | PARAM_BIT(MODIFY_ATTACK_TIME) | PARAM_BIT(MODIFY_FADE_TIME) | PARAM_BIT(MODIFY_ATTACK_LEVEL) \
+        | PARAM_BIT(MODIFY_SUSTAIN_LEVEL) | PARAM_BIT(MODIFY_FADE_LEVEL) | PARAM_BIT(MODIFY_FREQUENCY) \
+        | PARAM_BIT(MODIFY_AMPLITUDE) | PARAM_BIT(MODIFY_RAMP_END))
+
+#define FRICTION_PARAMS (COMMON_PARAMS | PARAM_BIT(MODIFY_STRENGTH_X) | PARAM_BIT(MODIFY_STRENGTH_Y))
+
+#define CONDITION_PARAMS (FRICTION_PARAMS | PARAM_BIT(MODIFY_OFFSET_X) | PARAM_BIT(MODIFY_OFFSET_Y))
+
+// The define-effect SysEx, and where each parameter sits in it
+#define SYSEX_HEADER_SIZE 5
+#define SYSEX_FLAGS 5
+#define SYSEX_TYPE 6
+#define SYSEX_EFFECT_ID 7
+
+struct DefineField
+{
+    uint8_t offset;
+    bool wide;
+    uint8_t param;
+};
+
+static const struct DefineField common_fields[] =
+{
+    { 8,  true,  MODIFY_DURATION },
+    { 10, true,  MODIFY_BUTTON_MASK },
+};
+
+static const struct DefineField periodic_fields[] =
+{
+    { 12, true,  MODIFY_DIRECTION },
+    { 14, false, MODIFY_GAIN },
+    { 19, false, MODIFY_ATTACK_LEVEL },
+    { 20, true,  MODIFY_ATTACK_TIME },
+    { 22, false, MODIFY_SUSTAIN_LEVEL },
+    { 23, true,  MODIFY_FADE_TIME },
+    { 25, false, MODIFY_FADE_LEVEL },
+    { 26, true,  MODIFY_FREQUENCY },
+    { 28, true,  MODIFY_AMPLITUDE },
+};
+
+// Strengths are sent as two bytes, but only the low one has ever been seen set
+static const struct DefineField condition_fields[] =
+{
+    { 12, true,  MODIFY_STRENGTH_X },
+    { 14, true,  MODIFY_STRENGTH_Y },
+    { 16, true,  MODIFY_OFFSET_X },
+    { 18, true,  MODIFY_OFFSET_Y },
+};
+
+#define NUM_FIELDS(fields) (sizeof(fields) / sizeof(fields[0]))
+
+static void model_error(struct SidewinderModel *model, const char *format, ...)
+{
+    if (model->errors++ > 0) { return; }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(model->first_error, sizeof(model->first_error), format, args);
+    va_end(args);
+
+    model->first_error_byte = model->bytes;
+}
+
+void sidewinder_model_init(struct SidewinderModel *model)
+{
+    memset(model, 0, sizeof(*model));
+    model->modify_param = -1;
+    model->autocenter = true; // the stick powers up centering itself
+}
+
+// The parameters a type accepts, and the SysEx size it's defined with (0 for unknown types)
+static uint16_t type_params(enum MidiEffectType type, size_t *sysex_size)
+{
+    switch (type)
+    {
+        case MIDI_ET_CONSTANT:
+        case MIDI_ET_SINE:
+        case MIDI_ET_SQUARE:
+        case MIDI_ET_RAMP:
+        case MIDI_ET_TRIANGLE:
+        case MIDI_ET_SAWTOOTHDOWN:
+        case MIDI_ET_SAWTOOTHUP:
+            *sysex_size = 34;
+            return PERIODIC_PARAMS;
+
+        case MIDI_ET_SPRING:
+        case MIDI_ET_DAMPER:
+        case MIDI_ET_INERTIA:
+            *sysex_size = 22;
+            return CONDITION_PARAMS;
+
+        case MIDI_ET_FRICTION:
+            *sysex_size = 18;
+            return FRICTION_PARAMS;
+
+        default:
+            *sysex_size = 0;
+            return 0;
+    }
+}
+
+static void set_fields(struct SidewinderModelEffect *effect, const uint8_t *sysex,
+        const struct DefineField *fields, size_t num_fields)
+{
+    for (size_t i = 0; i < num_fields; i++)
+    {
+        const uint8_t *field = &sysex[fields[i].offset];
+        uint16_t value = fields[i].wide ? (field[0] | (field[1] << 7)) : field[0];
+
+        effect->params[SIDEWINDER_MODEL_PARAM_INDEX(fields[i].param)] = value;
+        effect->params_set |= PARAM_BIT(fields[i].param);
+    }
+}
+
+static void receive_define(struct SidewinderModel *model)
+{
+    static const uint8_t header[SYSEX_HEADER_SIZE] = { 0xf0, 0x00, 0x01, 0x0a, 0x01 };
+
+    const uint8_t *sysex = model->sysex;
+    size_t size = model->sysex_size;
+
+    if (size < SYSEX_EFFECT_ID + 3 || memcmp(sysex, header, sizeof(header)) != 0)
+    {
+        model_error(model, "unknown SysEx (%zu bytes, starting %02x %02x %02x %02x %02x)",
+                size, sysex[0], sysex[1], sysex[2], sysex[3], sysex[4]);
+        return;
+    }
+
+    enum MidiEffectType type = sysex[SYSEX_TYPE];
+    size_t expected_size;
+    uint16_t params = type_params(type, &expected_size);
+
+    if (params == 0)
+    {
+        model_error(model, "define: unknown effect type 0x%02x", type);
+        return;
+    }
+    if (size != expected_size)
+    {
+        model_error(model, "define: type 0x%02x sent in %zu bytes, expected %zu", type, size, expected_size);
+        return;
+    }
+
+    // Everything from the flags byte to the checksum adds up to a multiple of 128
+    uint8_t sum = 0;
+    for (size_t i = SYSEX_FLAGS; i < size - 1; i++) { sum += sysex[i]; }
+    if ((sum & 0x7f) != 0)
+    {
+        model_error(model, "define: bad checksum 0x%02x", sysex[size - 2]);
+        return;
+    }
+
+    uint8_t flags = sysex[SYSEX_FLAGS];
+    if ((flags & 0xf0) != 0x20)
+    {
+        model_error(model, "define: flags 0x%02x would be refused", flags);
+        return;
+    }
+
+    int effect_id = sysex[SYSEX_EFFECT_ID];
+    if (effect_id == MIDI_ALL_EFFECTS)
+    {
+        for (effect_id = EFFECT_MEMORY_START; effect_id < SIDEWINDER_MODEL_SLOTS; effect_id++)
+        {
+            if (!model->effects[effect_id].defined) { break; }
+        }
+        if (effect_id == SIDEWINDER_MODEL_SLOTS)
+        {
+            model_error(model, "define: effect memory full");
+            return;
+        }
+    }
+    else if (effect_id >= SIDEWINDER_MODEL_SLOTS || !model->effects[effect_id].defined)
+    {
+        model_error(model, "define: overwriting effect %d, which isn't defined", effect_id);
+        return;
+    }
+
+    struct SidewinderModelEffect *effect = &model->effects[effect_id];
+    memset(effect, 0, sizeof(*effect));
+    effect->defined = true;
+    effect->type = type;
+    effect->playing = flags >= 0x24;
+
+    set_fields(effect, sysex, common_fields, NUM_FIELDS(common_fields));
+    if (params == PERIODIC_PARAMS)
+    {
+        set_fields(effect, sysex, periodic_fields, NUM_FIELDS(periodic_fields));
+        effect->sample_rate = sysex[15] | (sysex[16] << 7);
+    }
+    else if (params == CONDITION_PARAMS)
+    {
+        set_fields(effect, sysex, condition_fields, NUM_FIELDS(condition_fields));
+    }
+    else
+    {
+        set_fields(effect, sysex, condition_fields, 2);
+    }
+
+    model->definitions++;
+}
+
+static struct SidewinderModelEffect *defined_effect(struct SidewinderModel *model, int effect_id, const char *what)
+{
+    if (effect_id >= SIDEWINDER_MODEL_SLOTS || !model->effects[effect_id].defined)
+    {
+        model_error(model, "%s: effect %d isn't defined", what, effect_id);
+        return NULL;
+    }
+
+    return &model->effects[effect_id];
+}
+
+static void receive_modify(struct SidewinderModel *model, int effect_id, uint8_t param, uint16_t value)
+{
+    if (effect_id == MIDI_ALL_EFFECTS)
+    {
+        if (param != MODIFY_DEVICE_GAIN)
+        {
+            model_error(model, "modify 0x%02x: not a device-wide parameter", param);
+            return;
+        }
+
+        model->device_gain = value;
+        model->has_device_gain = true;
+        return;
+    }
+
+    struct SidewinderModelEffect *effect = defined_effect(model, effect_id, "modify");
+    if (effect == NULL) { return; }
+
+    size_t sysex_size;
+    if ((type_params(effect->type, &sysex_size) & PARAM_BIT(param)) == 0)
+    {
+        model_error(model, "modify 0x%02x: not a parameter of effect type 0x%02x", param, effect->type);
+        return;
+    }
+
+    effect->params[SIDEWINDER_MODEL_PARAM_INDEX(param)] = value;
+    effect->params_set |= PARAM_BIT(param);
+}
+
+// Play, pause and erase apply to every defined effect when sent to MIDI_ALL_EFFECTS
+static void receive_command(struct SidewinderModel *model, uint8_t command, int effect_id)
+{
+    if (effect_id == MIDI_ALL_EFFECTS && command != 0x00)
+    {
+        for (int i = EFFECT_MEMORY_START; i < SIDEWINDER_MODEL_SLOTS; i++)
+        {
+            if (model->effects[i].defined) { receive_command(model, command, i); }
+        }
+        return;
+    }
+
+    struct SidewinderModelEffect *effect = defined_effect(model, effect_id, "play/pause/erase");
+    if (effect == NULL) { return; }
+
+    switch (command)
+    {
+        case 0x00: // play solo
+            for (int i = EFFECT_MEMORY_START; i < SIDEWINDER_MODEL_SLOTS; i++) { model->effects[i].playing = false; }
+            effect->playing = true;
+            break;
+        case 0x10: // erase
+            memset(effect, 0, sizeof(*effect));
+            break;
+        case 0x20: // play
+            effect->playing = true;
+            break;
+        case 0x30: // pause
+            effect->playing = false;
+            break;
+    }
+}
+
+static void receive_channel_message(struct SidewinderModel *model)
+{
+    const uint8_t *msg = model->message;
+    model->messages++;
+
+    // A modify is an 0xb5 message naming the parameter and effect, then an 0xa5 one with the value
+    if (model->modify_param >= 0)
+    {
+        if (msg[0] != 0xa5)
+        {
+            model_error(model, "modify 0x%02x: followed by 0x%02x instead of its value", model->modify_param, msg[0]);
+        }
+        else
+        {
+            receive_modify(model, model->modify_effect_id, model->modify_param, msg[1] | (msg[2] << 7));
+        }
+
+        model->modify_param = -1;
+        if (msg[0] == 0xa5) { return; }
+    }
+
+    switch (msg[0])
+    {
+        case 0xb5:
+            if (msg[1] >= MODIFY_DURATION && (msg[1] & 0x03) == 0)
+            {
+                model->modify_param = msg[1];
+                model->modify_effect_id = msg[2];
+            }
+            else if (msg[1] == 0x00 || msg[1] == 0x10 || msg[1] == 0x20 || msg[1] == 0x30)
+            {
+                receive_command(model, msg[1], msg[2]);
+            }
+            else
+            {
+                model_error(model, "unknown command b5 %02x %02x", msg[1], msg[2]);
+            }
+            break;
+
+        case 0xc5:
+            if (msg[1] == 0x01 || msg[1] == 0x06)
+            {
+                model->autocenter = (msg[1] == 0x01);
+            }
+            else
+            {
+                model_error(model, "unknown program change c5 %02x", msg[1]);
+            }
+            break;
+
+        case 0xa5:
+            model_error(model, "value a5 %02x %02x without a modify", msg[1], msg[2]);
+            break;
+
+        default:
+            model_error(model, "unexpected message %02x %02x", msg[0], msg[1]);
+            break;
+    }
+}
+
+static void start_channel_message(struct SidewinderModel *model, uint8_t status)
+{
+    model->running_status = status;
+    model->message[0] = status;
+    model->message_size = 1;
+    model->message_left = ((status & 0xe0) == 0xc0) ? 1 : 2; // program change and channel pressure are short
+}
+
+void sidewinder_model_receive(struct SidewinderModel *model, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++, model->bytes++)
+    {
+        uint8_t byte = data[i];
+
+        if (byte >= 0xf8) { continue; } // real-time bytes don't disturb anything
+
+        if (byte & 0x80)
+        {
+            if (model->message_left != 0) { model_error(model, "message cut short by 0x%02x", byte); }
+            if (model->in_sysex && byte != 0xf7) { model_error(model, "SysEx cut short by 0x%02x", byte); }
+            model->message_left = 0;
+        }
+
+        if (model->in_sysex)
+        {
+            if (byte == 0xf7)
+            {
+                model->in_sysex = false;
+                model->messages++;
+
+                if (model->sysex_size < SIDEWINDER_MODEL_SYSEX_MAX)
+                {
+                    model->sysex[model->sysex_size++] = byte;
+                    receive_define(model);
+                }
+                else
+                {
+                    model_error(model, "SysEx longer than %d bytes", SIDEWINDER_MODEL_SYSEX_MAX);
+                }
+                continue;
+            }
+            if (!(byte & 0x80))
+            {
+                if (model->sysex_size < SIDEWINDER_MODEL_SYSEX_MAX) { model->sysex[model->sysex_size] = byte; }
+                model->sysex_size++;
+                continue;
+            }
+            model->in_sysex = false;
+        }
+
+        if (byte == 0xf0)
+        {
+            // System common messages cancel running status
+            model->running_status = 0;
+            model->in_sysex = true;
+            model->sysex[0] = byte;
+            model->sysex_size = 1;
+        }
+        else if (byte >= 0xf0)
+        {
+            model->running_status = 0;
+            model_error(model, "unexpected system message 0x%02x", byte);
+        }
+        else if (byte & 0x80)
+        {
+            start_channel_message(model, byte);
+        }
+        else
+        {
+            if (model->message_left == 0)
+            {
+                if (model->running_status == 0)
+                {
+                    model_error(model, "data byte 0x%02x with no status", byte);
+                    continue;
+                }
+                start_channel_message(model, model->running_status);
+            }
+
+            model->message[model->message_size++] = byte;
+            if (--model->message_left == 0) { receive_channel_message(model); }
+        }
+    }
+}
+
+bool sidewinder_model_idle(const struct SidewinderModel *model)
+{
+    return model->message_left == 0 && !model->in_sysex && model->modify_param < 0;
+}
+
+static uint32_t fnv1a(uint32_t hash, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        hash = (hash ^ (value & 0xff)) * 0x01000193;
+        value >>= 8;
+    }
+    return hash;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+uint32_t sidewinder_model_state_hash(const struct SidewinderModel *model, bool include_amplitude)
+{
+    uint32_t effect_hashes[SIDEWINDER_MODEL_SLOTS];
+    size_t count = 0;
+
+    for (int i = EFFECT_MEMORY_START; i < SIDEWINDER_MODEL_SLOTS; i++)
+    {
+        const struct SidewinderModelEffect *effect = &model->effects[i];
+        uint16_t button_mask = effect->params[SIDEWINDER_MODEL_PARAM_INDEX(MODIFY_BUTTON_MASK)];
+        if (!effect->defined || (!effect->playing && button_mask == 0)) { continue; }
+
+        uint32_t hash = fnv1a(0x811c9dc5, effect->type | (effect->playing << 8) | (effect->sample_rate << 16));
+        for (int p = 0; p < SIDEWINDER_MODEL_PARAMS; p++)
+        {
+            if (!(effect->params_set & (1u << p))) { continue; }
+            if (!include_amplitude && p == SIDEWINDER_MODEL_PARAM_INDEX(MODIFY_AMPLITUDE)) { continue; }
+
+            hash = fnv1a(hash, p | (effect->params[p] << 8));
+        }
+
+        effect_hashes[count++] = hash;
+    }
+
+    qsort(effect_hashes, count, sizeof(effect_hashes[0]), compare_u32);
+
+    uint32_t hash = fnv1a(0x811c9dc5, model->autocenter | (model->has_device_gain << 1) | (model->device_gain << 8));
+    for (size_t i = 0; i < count; i++) { hash = fnv1a(hash, effect_hashes[i]); }
+
+    return hash;
+}
+
+size_t sidewinder_model_num_defined(const struct SidewinderModel *model)
+{
+    size_t count = 0;
+    for (int i = EFFECT_MEMORY_START; i < SIDEWINDER_MODEL_SLOTS; i++) { count += model->effects[i].defined; }
+    return count;
+}
+
+size_t sidewinder_model_num_playing(const struct SidewinderModel *model)
+{
+    size_t count = 0;
+    for (int i = EFFECT_MEMORY_START; i < SIDEWINDER_MODEL_SLOTS; i++) { count += model->effects[i].playing; }
+    return count;
+}
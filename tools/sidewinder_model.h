@@ -0,0 +1,96 @@
+#ifndef SIDEWINDER_MODEL_H
+#define SIDEWINDER_MODEL_H
+
+#include "pico/stdlib.h"
+
+#include "ffb_midi.h"
+
+
+/*
+A software stand-in for the Sidewinder's MIDI receiver, for checking what
+ffb_midi.c sends without a stick. It parses the byte stream as the stick
+would (running status included), validates SysEx framing and checksums,
+and keeps a model of the effect slots: each one's type, parameters and
+whether it's playing.
+
+What we know of the stick's protocol comes from reverse engineering (see
+ffb_midi.c), so the model is strict: anything ffb_midi.c isn't known to
+send is flagged as an error rather than guessed at.
+
+Effect IDs are assigned the way the stick does it: a new definition takes
+the lowest free slot, starting at EFFECT_MEMORY_START.
+*/
+
+#define SIDEWINDER_MODEL_SLOTS (EFFECT_MEMORY_START + EFFECT_MEMORY_SIZE)
+
+// Modify parameters run from 0x40 to 0x7c in steps of 4
+#define SIDEWINDER_MODEL_PARAMS 16
+#define SIDEWINDER_MODEL_PARAM_INDEX(param) (((param) - MODIFY_DURATION) >> 2)
+
+#define SIDEWINDER_MODEL_SYSEX_MAX 40
+
+struct SidewinderModelEffect
+{
+    bool defined;
+    bool playing;
+    enum MidiEffectType type;
+
+    // Indexed by SIDEWINDER_MODEL_PARAM_INDEX(). A definition sets the ones it carries;
+    // modifies set the rest (ramp end, for one, can only be modified).
+    uint16_t params[SIDEWINDER_MODEL_PARAMS];
+    uint16_t params_set; // bit per params[] entry
+
+    uint16_t sample_rate; // only set by a definition
+};
+
+struct SidewinderModel
+{
+    // Parser
+    uint8_t running_status;
+    uint8_t message[3];
+    uint8_t message_size;
+    uint8_t message_left;           // data bytes still due for the current channel message
+    uint8_t sysex[SIDEWINDER_MODEL_SYSEX_MAX];
+    uint16_t sysex_size;
+    bool in_sysex;
+    int modify_param;               // from the 0xb5 half of a modify, or -1
+    int modify_effect_id;
+
+    // The stick
+    struct SidewinderModelEffect effects[SIDEWINDER_MODEL_SLOTS];
+    bool autocenter;
+    bool has_device_gain;
+    uint16_t device_gain;
+
+    // Counters
+    uint64_t bytes;
+    uint32_t messages;
+    uint32_t definitions;
+    uint32_t errors;
+    char first_error[128];          // the first thing the stick would have choked on
+    uint64_t first_error_byte;
+};
+
+
+void sidewinder_model_init(struct SidewinderModel *model);
+
+// Everything sent to the stick, in order
+void sidewinder_model_receive(struct SidewinderModel *model, const uint8_t *data, size_t size);
+
+// Whether the stream so far ended on a message boundary
+bool sidewinder_model_idle(const struct SidewinderModel *model);
+
+/*
+A digest of what the stick is doing that a user could feel: the global settings,
+and every effect that's playing or waiting on a button, as a sorted set, so the
+slots they happen to be in don't matter. Defined but idle effects (such as ones
+the effect cache keeps warm) don't count. With include_amplitude false, effect
+amplitudes are left out.
+*/
+uint32_t sidewinder_model_state_hash(const struct SidewinderModel *model, bool include_amplitude);
+
+size_t sidewinder_model_num_defined(const struct SidewinderModel *model);
+size_t sidewinder_model_num_playing(const struct SidewinderModel *model);
+
+
+#endif //SIDEWINDER_MODEL_H
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+Converts a firmware trace dump (see trace.h and diag.h) to Chrome trace JSON,
+which ui.perfetto.dev and chrome://tracing can open.
+
+Build the firmware with TRACE_ENABLED, reproduce the problem, then:
+
+    ./trace_to_perfetto.py --usb -o stutter.json             # needs pyusb
+    ./trace_to_perfetto.py --usb --save-dump stutter.bin -o stutter.json
+    ./trace_to_perfetto.py stutter.bin -o stutter.json       # from a saved dump
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+import diag_usb
+
+DIAG_CMD_TRACE_DUMP = 0x01
+
+TRACE_INFO = struct.Struct('<IHH')         # now_us, record_size, count
+TRACE_RECORD = struct.Struct('<IBBH')      # time_us, type, a, b
+
+# enum TraceEventType
+FRAME_IRQ_BEGIN, FRAME_IRQ_END, USB_TASK_BEGIN, USB_TASK_END, \
+    HID_SET_REPORT, HID_GET_REPORT, HID_REPORT_COMPLETE, MIDI_SEND = range(1, 9)
+
+REPORT_TYPES = {1: 'input', 2: 'output', 3: 'feature'}
+
+# From usb_report_ids.h
+REPORT_NAMES = {
+    1: 'Joystick', 2: 'Set Effect', 3: 'Set Envelope', 4: 'Set Condition', 5: 'Set Periodic',
+    6: 'Set Constant', 7: 'Set Ramp', 8: 'Effect Operation', 9: 'Block Free', 10: 'Device Control',
+    11: 'Device Gain', 12: 'Create New Effect', 13: 'Block Load', 14: 'Pool', 15: 'Axis Filter',
+}
+
+MIDI_STATUS_NAMES = {0xf0: 'define effect', 0xb5: 'effect command', 0xa5: 'modify', 0xc5: 'autocenter'}
+
+# Perfetto "threads", one per subsystem
+TID_USB_TASK = 1
+TID_HID = 2
+TID_MIDI = 3
+TID_FRAME_IRQ = 10  # + stick
+
+
+def parse_dump(data):
+    data = diag_usb.parse_response(data, DIAG_CMD_TRACE_DUMP)
+
+    now_us, record_size, count = TRACE_INFO.unpack_from(data)
+    offset = TRACE_INFO.size
+
+    records = []
+    for i in range(count):
+        time_us, kind, a, b = TRACE_RECORD.unpack_from(data, offset + i * record_size)
+        # Times are a wrapping 32-bit microsecond counter; make them relative to the dump
+        age_us = (now_us - time_us) & 0xffffffff
+        records.append((-age_us, kind, a, b))
+
+    records.sort(key=lambda r: r[0])
+    return records
+
+
+def to_events(records):
+    events = []
+    if not records:
+        return events
+
+    start = records[0][0]
+
+    def event(name, phase, tid, ts, **args):
+        e = {'name': name, 'ph': phase, 'pid': 1, 'tid': tid, 'ts': ts - start}
+        if phase == 'i':
+            e['s'] = 't'
+        if args:
+            e['args'] = args
+        events.append(e)
+
+    sticks = set()
+
+    for ts, kind, a, b in records:
+        if kind == FRAME_IRQ_BEGIN:
+            sticks.add(a)
+            event('frame IRQ', 'B', TID_FRAME_IRQ + a, ts)
+        elif kind == FRAME_IRQ_END:
+            sticks.add(a)
+            event('frame IRQ', 'E', TID_FRAME_IRQ + a, ts, buttons='0x%03x' % b)
+        elif kind == USB_TASK_BEGIN:
+            event('tud_task', 'B', TID_USB_TASK, ts)
+        elif kind == USB_TASK_END:
+            event('tud_task', 'E', TID_USB_TASK, ts)
+        elif kind in (HID_SET_REPORT, HID_GET_REPORT):
+            report_id, report_type = b & 0xff, b >> 8
+            verb = 'set' if kind == HID_SET_REPORT else 'get'
+            name = '%s %s' % (verb, REPORT_NAMES.get(report_id, 'report %d' % report_id))
+            event(name, 'i', TID_HID, ts, instance=a, report_id=report_id,
+                  type=REPORT_TYPES.get(report_type, report_type))
+        elif kind == HID_REPORT_COMPLETE:
+            event('report complete', 'i', TID_HID, ts, instance=a, length=b)
+        elif kind == MIDI_SEND:
+            # Each byte takes 320 us on the wire at 31250 baud
+            event('MIDI %s' % MIDI_STATUS_NAMES.get(a, '0x%02x' % a), 'X', TID_MIDI, ts, length=b)
+            events[-1]['dur'] = b * 320
+
+    names = {TID_USB_TASK: 'tud_task', TID_HID: 'HID reports', TID_MIDI: 'MIDI (wire time)'}
+    for stick in sticks:
+        names[TID_FRAME_IRQ + stick] = 'stick %d frame IRQ' % stick
+    for tid, name in names.items():
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid, 'args': {'name': name}})
+
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('dump', nargs='?', help='a dump saved with --save-dump')
+    parser.add_argument('--usb', action='store_true', help='read the dump from the adapter')
+    parser.add_argument('--save-dump', help='also save the raw dump here')
+    parser.add_argument('-o', '--output', default='-', help='JSON output (default: stdout)')
+    args = parser.parse_args()
+
+    if args.usb:
+        data = diag_usb.request_raw(DIAG_CMD_TRACE_DUMP)
+    elif args.dump:
+        with open(args.dump, 'rb') as f:
+            data = f.read()
+    else:
+        parser.error('give a dump file or --usb')
+
+    if args.save_dump:
+        with open(args.save_dump, 'wb') as f:
+            f.write(data)
+
+    trace = {'traceEvents': to_events(parse_dump(data)), 'displayTimeUnit': 'ms'}
+
+    if args.output == '-':
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+
+
+if __name__ == '__main__':
+    main()
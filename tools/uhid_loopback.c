@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#include "tusb.h"
+
+#include "config.h"
+#include "usb.h"
+#include "usb_descriptors.h"
+#include "ffb_midi.h"
+#include "effect_pool.h"
+#include "custom_force.h"
+#include "pid_table.h"
+
+/*
+Runs the firmware's USB layer against the Linux HID stack, with no hardware:
+registers the adapter's report descriptor through /dev/uhid, and hands what the
+kernel sends to the firmware's HID callbacks, as TinyUSB would. Linux only;
+needs write access to /dev/uhid (usually root).
+
+    uhid_loopback [-v <vendor id>] [-p <product id>] [-i <seconds>]
+
+Output reports go to tud_hid_set_report_cb() as from the interrupt OUT
+endpoint (or as SET_REPORT, without HID_OUT_ENDPOINT), and SET_REPORT and
+GET_REPORT requests as from the control endpoint. The stick's MIDI goes into a
+byte sink, paced at 31250 baud so the effect pool sees the same backlog as on
+the wire. The main-loop tasks that matter to effects (uploads, custom force)
+run between requests.
+
+The kernel only attaches hid-pidff to real USB devices by itself. Where
+hid-universal-pidff is available, -v and -p can give the IDs of a device it
+lists, and it attaches hid-pidff to the loopback instead: then fftest, or
+anything else uploading FF_* effects through evdev, drives the firmware end to
+end. Without it, the device is still a hidraw node, which ffb_stream.py can
+drive.
+
+Runs until interrupted, then prints how long the firmware took to handle each
+kind of request, and what went out over MIDI. With -i, it prints that every so
+many seconds as well.
+*/
+
+#define VENDOR_ID 0xcafe
+#define PRODUCT_ID (0x4000 | (CFG_TUD_HID << 2) | (CFG_TUD_MIDI << 3) | (CFG_TUD_VENDOR << 4)) // as usb_descriptors.c
+
+#define TASK_INTERVAL_MS 1
+
+static const uint8_t desc_hid_report[] =
+{
+    SIDEWINDER_REPORT_DESC
+};
+
+_Static_assert(sizeof(desc_hid_report) <= HID_MAX_DESCRIPTOR_SIZE, "report descriptor too big for uhid");
+
+// The firmware's UART, for this tool: counts bytes, and nothing else
+struct uart_inst
+{
+    uint64_t bytes;
+    uint64_t writes;
+};
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len)
+{
+    uart->bytes += len;
+    uart->writes++;
+}
+
+enum RequestKind
+{
+    REQUEST_OUTPUT,
+    REQUEST_SET_REPORT,
+    REQUEST_GET_REPORT,
+    NUM_REQUEST_KINDS
+};
+
+static const char *request_names[NUM_REQUEST_KINDS] = { "output", "set report", "get report" };
+
+struct RequestStats
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+static struct
+{
+    struct uart_inst uart;
+    struct FfbMidi midi;
+    struct EffectPool pool;
+    struct CustomForcePlayer custom_force;
+} stick;
+
+static struct RequestStats request_stats[NUM_REQUEST_KINDS];
+static uint32_t peak_backlog_us;
+static bool opened;
+
+static volatile sig_atomic_t stopping;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t start_ns;
+
+// The firmware's clock runs in real time, from when we started
+static void update_clock()
+{
+    host_time_us = (now_ns() - start_ns) / 1000;
+}
+
+static void record(enum RequestKind kind, uint64_t start)
+{
+    uint64_t elapsed = now_ns() - start;
+    struct RequestStats *stats = &request_stats[kind];
+
+    stats->count++;
+    stats->total_ns += elapsed;
+    if (elapsed > stats->max_ns) { stats->max_ns = elapsed; }
+
+    uint32_t backlog_us = ffb_midi_tx_backlog_us(&stick.midi);
+    if (backlog_us > peak_backlog_us) { peak_backlog_us = backlog_us; }
+}
+
+static hid_report_type_t report_type_from_uhid(uint8_t rtype)
+{
+    switch (rtype)
+    {
+        case UHID_FEATURE_REPORT:   return HID_REPORT_TYPE_FEATURE;
+        case UHID_OUTPUT_REPORT:    return HID_REPORT_TYPE_OUTPUT;
+        case UHID_INPUT_REPORT:     return HID_REPORT_TYPE_INPUT;
+    }
+
+    return HID_REPORT_TYPE_INVALID;
+}
+
+static void write_event(int fd, const struct uhid_event *ev)
+{
+    if (write(fd, ev, sizeof(*ev)) != sizeof(*ev))
+    {
+        perror("uhid write");
+        exit(1);
+    }
+}
+
+static void handle_output(const struct uhid_output_req *req)
+{
+    update_clock();
+    uint64_t start = now_ns();
+
+    // Report ID first, as the kernel sends numbered reports
+#ifdef HID_OUT_ENDPOINT
+    tud_hid_set_report_cb(0, 0, HID_REPORT_TYPE_INVALID, req->data, req->size);
+#else
+    if (req->size > 1) { tud_hid_set_report_cb(0, req->data[0], HID_REPORT_TYPE_OUTPUT, req->data + 1, req->size - 1); }
+#endif
+
+    record(REQUEST_OUTPUT, start);
+}
+
+static void handle_set_report(int fd, const struct uhid_set_report_req *req)
+{
+    update_clock();
+    uint64_t start = now_ns();
+
+    // As TinyUSB does: the report ID is stripped when the data starts with it
+    const uint8_t *data = req->data;
+    uint16_t size = req->size;
+    if (req->rnum != 0 && size > 1 && data[0] == req->rnum)
+    {
+        data++;
+        size--;
+    }
+    tud_hid_set_report_cb(0, req->rnum, report_type_from_uhid(req->rtype), data, size);
+
+    record(REQUEST_SET_REPORT, start);
+
+    struct uhid_event reply = { .type = UHID_SET_REPORT_REPLY };
+    reply.u.set_report_reply.id = req->id;
+    write_event(fd, &reply);
+}
+
+static void handle_get_report(int fd, const struct uhid_get_report_req *req)
+{
+    update_clock();
+    uint64_t start = now_ns();
+
+    struct uhid_event reply = { .type = UHID_GET_REPORT_REPLY };
+    struct uhid_get_report_reply_req *r = &reply.u.get_report_reply;
+    r->id = req->id;
+
+    // As TinyUSB does: the report ID goes first, then whatever the callback fills in
+    uint16_t size = 0;
+    if (req->rnum != 0) { r->data[size++] = req->rnum; }
+    uint16_t length = tud_hid_get_report_cb(0, req->rnum, report_type_from_uhid(req->rtype),
+            r->data + size, CFG_TUD_HID_EP_BUFSIZE - size);
+
+    record(REQUEST_GET_REPORT, start);
+
+    // TinyUSB stalls the request if there's nothing to send
+    if (length == 0) { r->err = EIO; }
+    else { r->size = size + length; }
+    write_event(fd, &reply);
+}
+
+static void handle_event(int fd, const struct uhid_event *ev)
+{
+    switch (ev->type)
+    {
+        case UHID_START:    printf("started\n"); break;
+        case UHID_STOP:     printf("stopped\n"); break;
+        case UHID_OPEN:     opened = true; break;
+        case UHID_CLOSE:    opened = false; break;
+
+        case UHID_OUTPUT:       handle_output(&ev->u.output); break;
+        case UHID_SET_REPORT:   handle_set_report(fd, &ev->u.set_report); break;
+        case UHID_GET_REPORT:   handle_get_report(fd, &ev->u.get_report); break;
+    }
+}
+
+static void print_stats(double seconds)
+{
+    printf("after %.1f s%s:\n", seconds, opened ? "" : " (device not open)");
+
+    for (int i = 0; i < NUM_REQUEST_KINDS; i++)
+    {
+        const struct RequestStats *stats = &request_stats[i];
+        if (stats->count == 0)
+        {
+            printf("  %-12s none\n", request_names[i]);
+            continue;
+        }
+
+        printf("  %-12s %8llu, mean %6.2f us, max %7.2f us\n", request_names[i],
+                (unsigned long long) stats->count, stats->total_ns / 1000.0 / stats->count, stats->max_ns / 1000.0);
+    }
+
+    const struct EffectPoolStats *pool_stats = effect_pool_get_stats(&stick.pool);
+    printf("  MIDI         %llu bytes in %llu writes, peak backlog %.1f ms\n",
+            (unsigned long long) stick.uart.bytes, (unsigned long long) stick.uart.writes, peak_backlog_us / 1000.0);
+    printf("  effects      %u uploads, %u page-ins, %u evictions\n",
+            pool_stats->uploads, pool_stats->page_ins, pool_stats->evictions);
+}
+
+static void on_signal(int signal)
+{
+    stopping = 1;
+}
+
+static uint32_t parse_id(const char *arg)
+{
+    char *end;
+    unsigned long value = strtoul(arg, &end, 16);
+    if (*arg == '\0' || *end != '\0' || value > 0xffff)
+    {
+        fprintf(stderr, "Not a 16-bit hex ID: %s\n", arg);
+        exit(2);
+    }
+
+    return value;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t vendor = VENDOR_ID;
+    uint32_t product = PRODUCT_ID;
+    double interval_s = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "v:p:i:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'v': vendor = parse_id(optarg); break;
+            case 'p': product = parse_id(optarg); break;
+            case 'i': interval_s = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-v <vendor id>] [-p <product id>] [-i <seconds>]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    int fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("/dev/uhid");
+        return 1;
+    }
+
+    start_ns = now_ns();
+    update_clock();
+
+    pid_table_init();
+    ffb_midi_init(&stick.midi, &stick.uart);
+    effect_pool_init(&stick.pool, &stick.midi);
+    usb_set_effect_pool(0, &stick.pool);
+    custom_force_init(&stick.custom_force, &stick.pool);
+    usb_set_custom_force_player(0, &stick.custom_force);
+
+    struct uhid_event create = { .type = UHID_CREATE2 };
+    struct uhid_create2_req *req = &create.u.create2;
+    snprintf((char *) req->name, sizeof(req->name), "Picowinder uhid loopback");
+    snprintf((char *) req->phys, sizeof(req->phys), "uhid_loopback");
+    req->rd_size = sizeof(desc_hid_report);
+    req->bus = BUS_USB;
+    req->vendor = vendor;
+    req->product = product;
+    req->version = 0x0100;
+    memcpy(req->rd_data, desc_hid_report, sizeof(desc_hid_report));
+    write_event(fd, &create);
+
+    printf("created %04x:%04x; Ctrl-C to stop\n", vendor, product);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    uint64_t next_print_ns = start_ns + (uint64_t) (interval_s * 1e9);
+
+    while (!stopping)
+    {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, TASK_INTERVAL_MS);
+        if (ready < 0 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        if (ready > 0)
+        {
+            struct uhid_event ev;
+            ssize_t size = read(fd, &ev, sizeof(ev));
+            if (size < 0 && errno != EINTR)
+            {
+                perror("uhid read");
+                break;
+            }
+            if (size > 0) { handle_event(fd, &ev); }
+        }
+
+        update_clock();
+        effect_pool_task(&stick.pool);
+        custom_force_task(&stick.custom_force);
+
+        if (interval_s > 0 && now_ns() >= next_print_ns)
+        {
+            print_stats((now_ns() - start_ns) / 1e9);
+            next_print_ns += (uint64_t) (interval_s * 1e9);
+        }
+    }
+
+    struct uhid_event destroy = { .type = UHID_DESTROY };
+    write_event(fd, &destroy);
+    close(fd);
+
+    print_stats((now_ns() - start_ns) / 1e9);
+    return 0;
+}
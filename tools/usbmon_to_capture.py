@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""
+Turns a Linux usbmon text trace into a capture for the replay tool (see capture.h).
+
+Record while a game runs, then convert:
+
+    sudo modprobe usbmon
+    lsusb | grep -i picowinder                # note the bus and device numbers
+    sudo cat /sys/kernel/debug/usb/usbmon/3u > game.usbmon
+    ./usbmon_to_capture.py --device 3:7 game.usbmon > captures/game.cap
+
+Picks up SET_REPORT (output and feature) and GET_REPORT (feature) control
+requests, plus anything sent to an interrupt OUT endpoint. usbmon only keeps
+the first 32 bytes of each transfer, which covers every report we have.
+"""
+
+import argparse
+import sys
+
+USB_REQ_GET_REPORT = 0x01
+USB_REQ_SET_REPORT = 0x09
+REPORT_TYPE_OUTPUT = 2
+REPORT_TYPE_FEATURE = 3
+
+
+def words_to_bytes(words):
+    data = bytearray()
+    for word in words:
+        data.extend(bytes.fromhex(word))
+    return data
+
+
+def convert(lines, device, out):
+    first_us = None
+    last_raw = None
+    wraps = 0
+
+    for line in lines:
+        fields = line.split()
+        if len(fields) < 4 or fields[2] != 'S':
+            continue
+
+        kind, bus, dev, ep = fields[3].split(':')
+        if device and (int(bus), int(dev)) != device:
+            continue
+
+        # usbmon timestamps are 32-bit microseconds
+        raw = int(fields[1])
+        if last_raw is not None and raw < last_raw:
+            wraps += 1
+        last_raw = raw
+        time_us = raw + (wraps << 32)
+
+        record = None
+
+        if kind == 'Co' and fields[4] == 's':
+            request_type, request = int(fields[5], 16), int(fields[6], 16)
+            value, index = int(fields[7], 16), int(fields[8], 16)
+            report_type, report_id = value >> 8, value & 0xff
+            interface = index & 0xff
+            data = words_to_bytes(fields[12:]) if len(fields) > 11 and fields[11] == '=' else bytearray()
+
+            # As with TinyUSB, the report ID isn't passed along as data
+            if report_id and data and data[0] == report_id:
+                data = data[1:]
+
+            if request_type == 0x21 and request == USB_REQ_SET_REPORT:
+                if report_type == REPORT_TYPE_OUTPUT:
+                    record = (interface, 'O', report_id, data)
+                elif report_type == REPORT_TYPE_FEATURE:
+                    record = (interface, 'F', report_id, data)
+
+        elif kind == 'Ci' and fields[4] == 's':
+            request_type, request = int(fields[5], 16), int(fields[6], 16)
+            value, index = int(fields[7], 16), int(fields[8], 16)
+
+            if request_type == 0xa1 and request == USB_REQ_GET_REPORT and (value >> 8) == REPORT_TYPE_FEATURE:
+                record = (index & 0xff, 'G', value & 0xff, bytearray())
+
+        elif kind == 'Io' and len(fields) > 6 and fields[6] == '=':
+            # Interrupt OUT: the report ID is the first byte. Endpoint n belongs to interface n - 1.
+            data = words_to_bytes(fields[7:])
+            if data:
+                record = (int(ep) - 1, 'O', data[0], data[1:])
+
+        if record is None:
+            continue
+
+        if first_us is None:
+            first_us = time_us
+
+        interface, kind, report_id, data = record
+        out.write('%d %d %s %d%s\n' % (time_us - first_us, interface, kind, report_id,
+                                       ''.join(' %02x' % b for b in data)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('trace', nargs='?', default='-', help='usbmon text trace (default: stdin)')
+    parser.add_argument('--device', help='only this BUS:DEVICE')
+    args = parser.parse_args()
+
+    device = tuple(int(x) for x in args.device.split(':')) if args.device else None
+
+    with (sys.stdin if args.trace == '-' else open(args.trace)) as lines:
+        convert(lines, device, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
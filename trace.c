@@ -0,0 +1,46 @@
+#include <string.h>
+
+#include "trace.h"
+
+#ifdef TRACE_ENABLED
+
+struct TraceRing trace_rings[TRACE_NUM_CONTEXTS];
+
+// Copy whatever of a ring survives being read. Its writer may preempt us,
+// so anything it could have overwritten in the meantime is thrown away.
+static size_t snapshot_ring(struct TraceRing *ring, struct TraceRecord *out, size_t max_records)
+{
+    uint32_t head = ring->head;
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    if (count > max_records) { count = max_records; }
+
+    uint32_t first = head - count;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        out[i] = ring->records[(first + i) & (TRACE_RING_SIZE - 1)];
+    }
+
+    // Anything older than new_head - TRACE_RING_SIZE may have been overwritten while we copied
+    uint32_t new_head = ring->head;
+    uint32_t written = new_head - head;
+    uint32_t overwritten = written > TRACE_RING_SIZE - count ? written - (TRACE_RING_SIZE - count) : 0;
+    if (overwritten == 0) { return count; }
+    if (overwritten >= count) { return 0; }
+
+    memmove(out, out + overwritten, (count - overwritten) * sizeof(*out));
+    return count - overwritten;
+}
+
+size_t trace_snapshot(struct TraceRecord *out, size_t max_records)
+{
+    size_t total = 0;
+
+    for (int i = 0; i < TRACE_NUM_CONTEXTS; i++)
+    {
+        total += snapshot_ring(&trace_rings[i], out + total, max_records - total);
+    }
+
+    return total;
+}
+
+#endif // TRACE_ENABLED
@@ -0,0 +1,88 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+
+
+/*
+A flight recorder for debugging stutter: compact timestamped events from the
+capture IRQ, the USB task, HID report handling and MIDI sends, kept in RAM
+and read out over the diagnostics interface (see diag.h).
+tools/trace_to_perfetto.py turns a dump into a trace for ui.perfetto.dev.
+
+There's one ring per execution context, so each ring has a single writer and
+nothing needs a lock. When a ring is full, the oldest events are overwritten.
+
+Without TRACE_ENABLED, the TRACE macros compile to nothing.
+*/
+
+enum TraceEventType
+{
+    TRACE_NONE = 0,
+
+    TRACE_FRAME_IRQ_BEGIN,      // a: stick
+    TRACE_FRAME_IRQ_END,        // a: stick, b: buttons
+    TRACE_USB_TASK_BEGIN,
+    TRACE_USB_TASK_END,
+    TRACE_HID_SET_REPORT,       // a: instance, b: report ID | report type << 8
+    TRACE_HID_GET_REPORT,       // a: instance, b: report ID | report type << 8
+    TRACE_HID_REPORT_COMPLETE,  // a: instance, b: length
+    TRACE_MIDI_SEND,            // a: first byte (the MIDI status), b: length
+};
+
+// 8 bytes, so a dump is cheap to send and parse
+struct __attribute__((__packed__)) TraceRecord
+{
+    uint32_t time_us;
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+};
+
+enum TraceContext
+{
+    TRACE_CONTEXT_THREAD,   // main loop, including TinyUSB callbacks
+    TRACE_CONTEXT_IRQ,      // capture IRQs
+    TRACE_NUM_CONTEXTS
+};
+
+#define TRACE_RING_SIZE 512 // records per context; must be a power of 2
+
+struct TraceRing
+{
+    struct TraceRecord records[TRACE_RING_SIZE];
+    volatile uint32_t head; // total records ever written
+};
+
+
+#ifdef TRACE_ENABLED
+
+extern struct TraceRing trace_rings[TRACE_NUM_CONTEXTS];
+
+static inline void trace_emit(enum TraceContext context, uint8_t type, uint8_t a, uint16_t b)
+{
+    struct TraceRing *ring = &trace_rings[context];
+    uint32_t head = ring->head;
+
+    ring->records[head & (TRACE_RING_SIZE - 1)] = (struct TraceRecord) { time_us_32(), type, a, b };
+    __compiler_memory_barrier(); // the record must land before a reader can see it
+    ring->head = head + 1;
+}
+
+#define TRACE(type, a, b)       trace_emit(TRACE_CONTEXT_THREAD, (type), (a), (b))
+#define TRACE_IRQ(type, a, b)   trace_emit(TRACE_CONTEXT_IRQ, (type), (a), (b))
+
+// Copies out the newest events from every ring, oldest first per ring. Returns how many were copied.
+size_t trace_snapshot(struct TraceRecord *out, size_t max_records);
+
+#else
+
+#define TRACE(type, a, b)       ((void) 0)
+#define TRACE_IRQ(type, a, b)   ((void) 0)
+
+#endif // TRACE_ENABLED
+
+
+#endif //TRACE_H
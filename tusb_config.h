@@ -26,6 +26,8 @@
 #ifndef _TUSB_CONFIG_H_
 #define _TUSB_CONFIG_H_
 
+#include "config.h"
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -91,15 +93,32 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID               1
+#define CFG_TUD_HID               NUM_JOYSTICKS // one joystick+PID interface per stick
 #define CFG_TUD_CDC               0
 #define CFG_TUD_MSC               0
+#ifdef MIDI_PASSTHROUGH
+#define CFG_TUD_MIDI              NUM_JOYSTICKS // the sticks' own MIDI; see midi_passthrough.h
+#else
 #define CFG_TUD_MIDI              0
+#endif
+#ifdef DIAG_INTERFACE
+#define CFG_TUD_VENDOR            1 // diagnostics; see diag.h
+#else
 #define CFG_TUD_VENDOR            0
+#endif
 
-// HID buffer size Should be sufficient to hold ID (if any) + Data
+// HID endpoint size: the largest report on the interrupt endpoints, report ID included.
+// That's Set Effect and Custom Force Data on OUT, 16 bytes each; the joystick report on IN is smaller.
 #define CFG_TUD_HID_EP_BUFSIZE    16
 
+// MIDI FIFO sizes; nothing is sent back to the host
+#define CFG_TUD_MIDI_RX_BUFSIZE   64
+#define CFG_TUD_MIDI_TX_BUFSIZE   64
+
+// Vendor FIFO sizes; replies to the host are streamed through the TX FIFO
+#define CFG_TUD_VENDOR_RX_BUFSIZE 64
+#define CFG_TUD_VENDOR_TX_BUFSIZE 256
+
 #ifdef __cplusplus
  }
 #endif
@@ -1,11 +1,21 @@
 #include "tusb.h"
 #include "usb_report_ids.h"
 
+#include "usb.h"
 #include "ffb_midi.h"
+#include "effect_pool.h"
+#include "custom_force.h"
+#include "pid_table.h"
+#include "axis_filter.h"
+#include "trace.h"
+#include "latency_stats.h"
+#include "hot_path.h"
+
+#include "config.h"
 
 
 // Translate from index in USB descriptor to byte that Sidewinder MIDI expects
-static const uint8_t effect_type_usb_to_midi[] =
+static const uint8_t HOT_PATH_DATA(effect_type_usb_to_midi) effect_type_usb_to_midi[] =
 {
     MIDI_ET_NONE,
     MIDI_ET_CONSTANT,
@@ -18,12 +28,35 @@ static const uint8_t effect_type_usb_to_midi[] =
     MIDI_ET_SPRING,
     MIDI_ET_DAMPER,
     MIDI_ET_INERTIA,
-    MIDI_ET_FRICTION
+    MIDI_ET_FRICTION,
+    MIDI_ET_CONSTANT    // custom force: a constant force whose amplitude is streamed (see custom_force.h)
 };
 
+#define USB_ET_CUSTOM_FORCE 12
+
+// Each HID interface drives its own stick
+struct EffectPool *effect_pools[CFG_TUD_HID];
+
+void usb_set_effect_pool(uint8_t instance, struct EffectPool *pool)
+{
+    if (instance < CFG_TUD_HID) { effect_pools[instance] = pool; }
+}
+
+struct CustomForcePlayer *custom_force_players[CFG_TUD_HID];
+
+void usb_set_custom_force_player(uint8_t instance, struct CustomForcePlayer *player)
+{
+    if (instance < CFG_TUD_HID) { custom_force_players[instance] = player; }
+}
+
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
         hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
 {
+    TRACE(TRACE_HID_GET_REPORT, instance, report_id | (report_type << 8));
+
+    struct EffectPool *pool = effect_pools[instance];
+    if (pool == NULL) { return 0; }
+
     switch (report_type)
     {
         case HID_REPORT_TYPE_FEATURE:
@@ -32,18 +65,18 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
                 // Block Load Request
                 case REPORT_ID_FEATURE_BLOCK_LOAD:
                     // Block Index / Assigned Effect ID
-                    buffer[0] = ffb_midi_last_assigned_effect_id();
+                    buffer[0] = effect_pool_last_assigned_effect_id(pool);
                     // Block Load Status: per our descriptor, 1 is success, 2 is full, 3 is error.
-                    buffer[1] = ffb_midi_last_add_succeeded() ? 1 : 2;
+                    buffer[1] = effect_pool_last_add_succeeded(pool) ? 1 : 2;
                     // 16-bit RAM pool available: we'll just give the number of effects remaining
-                    buffer[2] = ffb_midi_get_num_available_effects();
+                    buffer[2] = effect_pool_get_num_available_effects(pool);
                     buffer[3] = 0x00;
                     return 4;
 
                 // Pool size, max simultaneous effects, etc.
                 case REPORT_ID_FEATURE_POOL_REPORT:
                     // 16-bit RAM pool size: we'll just give the total number of effects
-                    buffer[0] = EFFECT_MEMORY_SIZE;
+                    buffer[0] = VIRTUAL_EFFECT_COUNT;
                     buffer[1] = 0x00;
                     // Num simultaneous effects
                     buffer[2] = MAX_SIMULTANEOUS_EFFECTS;
@@ -51,6 +84,10 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
                     // Bit 6: 1 for supporting shared parameter blocks, 0 for not
                     buffer[3] = 0xff;
                     return 4;
+
+                case REPORT_ID_FEATURE_AXIS_FILTER:
+                    buffer[0] = axis_filter_get_mode();
+                    return 1;
             }
 
             break;
@@ -64,186 +101,83 @@ static inline uint16_t join16(uint8_t first, uint8_t second)
     return ((uint16_t) first) | (((uint16_t) second) << 8);
 }
 
-#define USB_DURATION_INFINITE 0xffff
-#define MIDI_DURATION_INFINITE 0
-
-struct __attribute__((__packed__ )) t_set_envelope_report
-{
-    uint8_t effect_id;
-    uint8_t attack_level;
-    uint8_t fade_level;
-    uint16_t attack_time;
-    uint16_t fade_time;
-};
-
-struct __attribute__((__packed__ )) t_set_condition_report
-{
-    uint8_t effect_id;
-    uint8_t axis; // "block offset"
-    int8_t center_point_offset;
-    uint8_t pos_coefficient;
-    uint8_t neg_coefficient;
-    uint8_t pos_saturation;
-    uint8_t neg_saturation;
-    uint8_t dead_band;
-};
-
-struct __attribute__((__packed__ )) t_set_ramp_report
-{
-    uint8_t effect_id;
-    int8_t start;
-    int8_t end;
-};
-
-void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
+void HOT_PATH_FUNC(tud_hid_set_report_cb)(uint8_t instance, uint8_t report_id,
         hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
+    // Reports from the interrupt OUT endpoint (see HID_OUT_ENDPOINT) come without an ID or type.
+    // All of ours have an ID, so it's the first byte, and only output reports go that way.
+    // They aren't echoed: at one per millisecond, echoes would crowd the joystick state off the
+    // IN endpoint.
     bool echo = true;
+    if (report_id == 0 && bufsize > 0)
+    {
+        report_id = buffer[0];
+        report_type = HID_REPORT_TYPE_OUTPUT;
+        buffer++;
+        bufsize--;
+        echo = false;
+    }
+
+    TRACE(TRACE_HID_SET_REPORT, instance, report_id | (report_type << 8));
+    uint32_t start = latency_stats_mark();
+
+    struct EffectPool *pool = effect_pools[instance];
+    if (pool == NULL) { return; }
+    struct CustomForcePlayer *custom_force = custom_force_players[instance];
 
     switch (report_type)
     {
         case HID_REPORT_TYPE_OUTPUT:
         {
+            // Effect parameters: see pid_table.c
+            pid_table_apply(pool, report_id, buffer, bufsize);
+
             switch(report_id)
             {
                 case REPORT_ID_OUTPUT_SET_EFFECT:
                 {
+                    // The parameters the stick takes are set from the table; this is the rest.
                     uint8_t effect_id       = buffer[0];
                     uint8_t effect_type_usb = buffer[1];
                     uint16_t duration       = join16(buffer[2], buffer[3]);
-                    uint16_t trig_interval  = join16(buffer[4], buffer[5]);
                     uint16_t sample_period  = join16(buffer[6], buffer[7]);
-                    uint8_t gain            = buffer[8];
-                    uint8_t trig_button     = buffer[9];
-                    bool ax0_enable         = (buffer[10] >> 0) & 0x01;
-                    bool ax1_enable         = (buffer[10] >> 1) & 0x01;
-                    bool dir_enable         = (buffer[10] >> 2) & 0x01;
-                    uint8_t direction_x     = buffer[11];
-                    uint8_t direction_y     = buffer[12];
-                    uint16_t start_delay    = join16(buffer[13], buffer[14]);
-
-                    // TODO use trigger interval
-                    // TODO use sample period
-                    // TODO use trigger button
-                    // TODO use ax0 enable
-                    // TODO use ax1 enable
-
-                    uint8_t effect_type_midi = effect_type_usb_to_midi[effect_type_usb];
-
-                    // MIDI duration is in "units of 2 ms".
-                    // USB uses the max possible value for infinity. MIDI uses 0.
-                    uint16_t duration_midi = (duration == USB_DURATION_INFINITE) ? MIDI_DURATION_INFINITE : (duration >> 1);
-                    if (duration_midi > 0x3fff) { duration_midi = 0x3fff; } // cap long but finite effects
-                    ffb_midi_modify(uart0, effect_id, MODIFY_DURATION, duration_midi);
-
-                    switch (effect_type_midi)
-                    {
-                        case MIDI_ET_CONSTANT:
-                        case MIDI_ET_SINE:
-                        case MIDI_ET_SQUARE:
-                        case MIDI_ET_RAMP:
-                        case MIDI_ET_TRIANGLE:
-                        case MIDI_ET_SAWTOOTHDOWN:
-                        case MIDI_ET_SAWTOOTHUP:
-
-                            ffb_midi_modify(uart0, effect_id, MODIFY_GAIN, gain);
-
-                            // TODO axes enable
-                            uint16_t direction_midi = 0;
-
-                            if (dir_enable)
-                            {
-                                // map 0-180 to 0-360
-                                direction_midi = ((uint16_t)direction_x) << 1;
-                                ffb_midi_modify(uart0, effect_id, MODIFY_DIRECTION, direction_midi);
-                            }
-                            break;
-                    }
-
-                    break;
-                }
-
-                case REPORT_ID_OUTPUT_SET_ENVELOPE:
-                {
-                    struct t_set_envelope_report *report = (struct t_set_envelope_report*)(buffer);
-
-                    // map 0->0xff down to 0->0x7f
-                    ffb_midi_modify(uart0, report->effect_id, MODIFY_ATTACK_LEVEL, report->attack_level >> 1);
-                    ffb_midi_modify(uart0, report->effect_id, MODIFY_FADE_LEVEL, report->fade_level >> 1);
-
-                    // USB times are in ms; we convert to 2ms units
-                    ffb_midi_modify(uart0, report->effect_id, MODIFY_ATTACK_TIME, report->attack_time >> 1);
-                    ffb_midi_modify(uart0, report->effect_id, MODIFY_FADE_TIME, report->fade_time >> 1);
-
-                    break;
-                }
-
-                case REPORT_ID_OUTPUT_SET_CONDITION:
-                {
-                    struct t_set_condition_report *report = (struct t_set_condition_report*)(buffer);
-                    // SW FFB Pro cannot use Neg Coefficient, Pos/Neg Saturation, or Dead Band.
 
-                    switch (report->axis)
+                    if (custom_force != NULL && effect_type_usb == USB_ET_CUSTOM_FORCE)
                     {
-                        case 0:
-                        {
-                            ffb_midi_modify(uart0, report->effect_id, MODIFY_OFFSET_X, report->center_point_offset);
-                            ffb_midi_modify(uart0, report->effect_id, MODIFY_STRENGTH_X, report->pos_coefficient >> 1);
-
-                            break;
-                        }
-                        case 1:
-                        {
-                            ffb_midi_modify(uart0, report->effect_id, MODIFY_OFFSET_Y, report->center_point_offset);
-                            ffb_midi_modify(uart0, report->effect_id, MODIFY_STRENGTH_Y, report->pos_coefficient >> 1);
-
-                            break;
-                        }
+                        custom_force_set_timing(custom_force, effect_id, sample_period, duration);
                     }
 
                     break;
                 }
 
-                case REPORT_ID_OUTPUT_SET_CONSTANT:
+                case REPORT_ID_OUTPUT_CUSTOM_FORCE_DATA:
                 {
+                    if (custom_force == NULL) { break; }
+
                     uint8_t effect_id = buffer[0];
-                    uint16_t magnitude  = join16(buffer[1], buffer[2]); // 255 to -255
-                    magnitude = (magnitude & 0x1ff) >> 1;
+                    uint16_t offset = join16(buffer[1], buffer[2]);
+                    size_t count = (bufsize > 3) ? bufsize - 3 : 0;
+                    if (count > CUSTOM_FORCE_DATA_SIZE) { count = CUSTOM_FORCE_DATA_SIZE; }
 
-                    ffb_midi_modify(uart0, effect_id, MODIFY_AMPLITUDE, magnitude);
+                    custom_force_write(custom_force, effect_id, offset, (const int8_t*)(buffer + 3), count);
 
                     break;
                 }
 
-
-                case REPORT_ID_OUTPUT_SET_RAMP:
+                case REPORT_ID_OUTPUT_DOWNLOAD_FORCE_SAMPLE:
                 {
-                    struct t_set_ramp_report *report = (struct t_set_ramp_report*)(buffer);
-
-                    ffb_midi_modify(uart0, report->effect_id, MODIFY_AMPLITUDE, report->start);
-                    ffb_midi_modify(uart0, report->effect_id, MODIFY_RAMP_END, report->end);
+                    // One channel per effect: the X sample plays along the effect's direction, Y is ignored.
+                    if (custom_force != NULL) { custom_force_download_sample(custom_force, (int8_t) buffer[0]); }
 
                     break;
                 }
 
-                case REPORT_ID_OUTPUT_SET_PERIODIC:
+                case REPORT_ID_OUTPUT_SET_CUSTOM_FORCE:
                 {
-                    uint8_t effect_id   = buffer[0];
-                    uint8_t magnitude   = buffer[1];
-                    int8_t offset       = (int8_t) buffer[2];
-                    uint8_t phase       = buffer[3];
-                    uint16_t period     = join16(buffer[4], buffer[5]);
-
-                    // TODO: FFB Pro doesn't support offset or phase.
-                    // adapt-ffb-joy works around this by switching between waveforms
-                    // (apparently effect type 3 on the FFB Pro is a cosine?!)
-
-                    uint16_t frequency = 1;
-                    if (period <= 13) { frequency = 77; }
-                    else if (period < 1000) { frequency = ((2000 / period) + 1) / 2; }
+                    uint8_t effect_id = buffer[0];
+                    uint16_t sample_count = join16(buffer[1], buffer[2]);
 
-                    ffb_midi_modify(uart0, effect_id, MODIFY_FREQUENCY, frequency);
-                    ffb_midi_modify(uart0, effect_id, MODIFY_SUSTAIN_LEVEL, magnitude);
+                    if (custom_force != NULL) { custom_force_set_sample_count(custom_force, effect_id, sample_count); }
 
                     break;
                 }
@@ -257,13 +191,20 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                     switch (operation)
                     {
                         case 1: // Start
-                            ffb_midi_play(uart0, effect_id);
+                            if (custom_force != NULL) { custom_force_start(custom_force, effect_id); }
+                            effect_pool_start(pool, effect_id);
                             break;
                         case 2: // Start Solo
-                            ffb_midi_play_solo(uart0, effect_id);
+                            if (custom_force != NULL)
+                            {
+                                custom_force_stop_all(custom_force);
+                                custom_force_start(custom_force, effect_id);
+                            }
+                            effect_pool_start_solo(pool, effect_id);
                             break;
                         case 3: // Stop
-                            ffb_midi_pause(uart0, effect_id);
+                            if (custom_force != NULL) { custom_force_stop(custom_force, effect_id); }
+                            effect_pool_stop(pool, effect_id);
                             break;
                     }
 
@@ -273,7 +214,8 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                 case REPORT_ID_OUTPUT_BLOCK_FREE:
                 {
                     uint8_t effect_id = buffer[0];
-                    ffb_midi_erase(uart0, effect_id);
+                    if (custom_force != NULL) { custom_force_detach(custom_force, effect_id); }
+                    effect_pool_free(pool, effect_id);
 
                     break;
                 }
@@ -285,12 +227,6 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
 
                     break;
                 }
-
-                case REPORT_ID_OUTPUT_DEVICE_GAIN:
-                {
-                    uint8_t device_gain = buffer[0];
-                    ffb_midi_modify(uart0, 0x7f, MODIFY_DEVICE_GAIN, device_gain);
-                }
             }
 
             break;
@@ -302,25 +238,37 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                 case REPORT_ID_FEATURE_CREATE_NEW_EFFECT:
                 {
                     // Only one byte: the effect type
-                    struct Effect newEffect = {
-                        .type = effect_type_usb_to_midi[buffer[0]],
-                        .duration = 0,
-                        .button_mask = 0,
-                        .direction = 0,
-                        .gain = 0x7f,
-                        .strength_x = 0,
-                        .strength_y = 0,
-                        .sample_rate = 100,
-                        .attack_level = 0x7f,
-                        .sustain_level = 0x7f,
-                        .fade_level = 0x7f,
-                        .attack_time = 0,
-                        .fade_time = 0,
-                        .frequency = 1,
-                        .amplitude = 0x7f,
-                    };
-
-                    ffb_midi_define_effect(uart0, &newEffect);
+                    uint8_t effect_type_usb = buffer[0];
+
+                    // Types are 1-based in the descriptor; anything else has no MIDI equivalent
+                    if (effect_type_usb == 0 || effect_type_usb >= sizeof(effect_type_usb_to_midi))
+                    {
+                        effect_pool_refuse_create(pool);
+                        break;
+                    }
+
+                    if (effect_type_usb == USB_ET_CUSTOM_FORCE)
+                    {
+                        // Custom forces need a sample buffer as well as a pool effect
+                        if (custom_force == NULL || !custom_force_slot_available(custom_force))
+                        {
+                            effect_pool_refuse_create(pool);
+                            break;
+                        }
+
+                        int effect_id = effect_pool_create(pool, effect_type_usb_to_midi[effect_type_usb]);
+                        if (effect_id > 0) { custom_force_attach(custom_force, effect_id); }
+                        break;
+                    }
+
+                    effect_pool_create(pool, effect_type_usb_to_midi[effect_type_usb]);
+
+                    break;
+                }
+
+                case REPORT_ID_FEATURE_AXIS_FILTER:
+                {
+                    axis_filter_set_mode(buffer[0]);
 
                     break;
                 }
@@ -330,6 +278,14 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
         }
     }
 
+    latency_stats_record(LATENCY_SET_REPORT, start);
+
     // Echo back anything we received from the host
-    if (echo) { tud_hid_report(0, buffer, bufsize); }
-}
\ No newline at end of file
+    if (echo) { tud_hid_n_report(instance, 0, buffer, bufsize); }
+}
+
+// Invoked when a report to the host (joystick state or an echo) has gone out
+void HOT_PATH_FUNC(tud_hid_report_complete_cb)(uint8_t instance, uint8_t const* report, uint16_t len)
+{
+    TRACE(TRACE_HID_REPORT_COMPLETE, instance, len);
+}
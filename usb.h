@@ -0,0 +1,15 @@
+#ifndef USB_H
+#define USB_H
+
+#include "effect_pool.h"
+#include "custom_force.h"
+
+
+// Route PID reports arriving on a HID interface to the given stick's effects
+void usb_set_effect_pool(uint8_t instance, struct EffectPool *pool);
+
+// Play that interface's Custom Force effects with the given player
+void usb_set_custom_force_player(uint8_t instance, struct CustomForcePlayer *player);
+
+
+#endif //USB_H
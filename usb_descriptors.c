@@ -75,42 +75,13 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-/*
-    Note: hid-pidff.c in the Linux kernel will "oops" due to a null-pointer deref
-    if any of its "optional" reports are not present. These include:
-    Set Envelope, Set Condition, Set Periodic, Set Constant, Set Ramp.
-*/
-
+// See SIDEWINDER_REPORT_DESC in usb_descriptors.h
 uint8_t const desc_hid_report[] =
 {
-    // Windows expects all of the I/O/F reports to be wrapped in an application collection;
-    // otherwise, the device won't be registered as capable of force-feedback.
-    // Linux is fine either way.
-    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),
-    HID_USAGE(HID_USAGE_DESKTOP_JOYSTICK),
-    HID_COLLECTION(HID_COLLECTION_APPLICATION),
-
-    // Input Reports
-    SIDEWINDER_REPORT_DESC_INPUT_JOYSTICK               (HID_REPORT_ID(REPORT_ID_INPUT_JOYSTICK)),
-    // Output Reports
-    SIDEWINDER_REPORT_DESC_OUTPUT_SET_EFFECT            (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_EFFECT)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_SET_ENVELOPE          (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_ENVELOPE)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_SET_CONDITION         (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_CONDITION)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_SET_PERIODIC          (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_PERIODIC)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_SET_CONSTANT          (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_CONSTANT)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_SET_RAMP              (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_RAMP)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_EFFECT_OPERATION      (HID_REPORT_ID(REPORT_ID_OUTPUT_EFFECT_OPERATION)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_BLOCK_FREE            (HID_REPORT_ID(REPORT_ID_OUTPUT_BLOCK_FREE)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_DEVICE_CONTROL        (HID_REPORT_ID(REPORT_ID_OUTPUT_DEVICE_CONTROL)),
-    SIDEWINDER_REPORT_DESC_OUTPUT_DEVICE_GAIN           (HID_REPORT_ID(REPORT_ID_OUTPUT_DEVICE_GAIN)),
-    // Feature Reports
-    SIDEWINDER_REPORT_DESC_FEATURE_CREATE_NEW_EFFECT    (HID_REPORT_ID(REPORT_ID_FEATURE_CREATE_NEW_EFFECT)),
-    SIDEWINDER_REPORT_DESC_FEATURE_BLOCK_LOAD           (HID_REPORT_ID(REPORT_ID_FEATURE_BLOCK_LOAD)),
-    SIDEWINDER_REPORT_DESC_FEATURE_POOL_REPORT          (HID_REPORT_ID(REPORT_ID_FEATURE_POOL_REPORT)),
-
-    HID_COLLECTION_END
+    SIDEWINDER_REPORT_DESC
 };
 
+// Every stick presents the same report descriptor
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
     return desc_hid_report;
@@ -120,23 +91,91 @@ uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
+// String Descriptor Index
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_DIAG,
+    STRID_MIDI,
+};
+
 enum
 {
     ITF_NUM_HID,
+#if NUM_JOYSTICKS > 1
+    ITF_NUM_HID_2,
+#endif
+#ifdef DIAG_INTERFACE
+    ITF_NUM_DIAG,
+#endif
+#ifdef MIDI_PASSTHROUGH
+    ITF_NUM_MIDI,
+    ITF_NUM_MIDI_STREAMING,
+#if NUM_JOYSTICKS > 1
+    ITF_NUM_MIDI_2,
+    ITF_NUM_MIDI_STREAMING_2,
+#endif
+#endif
     ITF_NUM_TOTAL
 };
 
-#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
-
 #define EPNUM_HID   0x81
+#define EPNUM_HID_2 0x82
+#define EPNUM_HID_OUT   0x01
+#define EPNUM_HID_OUT_2 0x02
+
+#define EPNUM_DIAG_OUT  0x03
+#define EPNUM_DIAG_IN   0x83
+
+#define EPNUM_MIDI_OUT   0x04
+#define EPNUM_MIDI_IN    0x84
+#define EPNUM_MIDI_OUT_2 0x05
+#define EPNUM_MIDI_IN_2  0x85
+
+// Interface number, EP In & EP Out address. Reports on the interrupt endpoints are polled every 1 ms.
+#ifdef HID_OUT_ENDPOINT
+#define HID_DESC_LEN TUD_HID_INOUT_DESC_LEN
+#define HID_INTERFACE(itf, ep_in, ep_out) \
+    TUD_HID_INOUT_DESCRIPTOR(itf, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), ep_out, ep_in, CFG_TUD_HID_EP_BUFSIZE, 1)
+#else
+// Output reports come in as SET_REPORT requests on EP0
+#define HID_DESC_LEN TUD_HID_DESC_LEN
+#define HID_INTERFACE(itf, ep_in, ep_out) \
+    TUD_HID_DESCRIPTOR(itf, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), ep_in, CFG_TUD_HID_EP_BUFSIZE, 1)
+#endif
+
+#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + NUM_JOYSTICKS * HID_DESC_LEN + CFG_TUD_VENDOR * TUD_VENDOR_DESC_LEN \
+                           + CFG_TUD_MIDI * TUD_MIDI_DESC_LEN)
+
+// Custom Force Data is the largest report, and the OUT endpoint has to take it in one packet
+_Static_assert(CFG_TUD_HID_EP_BUFSIZE >= 1 + 3 + CUSTOM_FORCE_DATA_SIZE, "CFG_TUD_HID_EP_BUFSIZE too small");
 
 uint8_t const desc_configuration[] =
 {
     // Config number, interface count, string index, total length, attribute, power in mA
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
-    // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 1)
+    HID_INTERFACE(ITF_NUM_HID, EPNUM_HID, EPNUM_HID_OUT),
+
+#if NUM_JOYSTICKS > 1
+    // The second stick gets an identical interface
+    HID_INTERFACE(ITF_NUM_HID_2, EPNUM_HID_2, EPNUM_HID_OUT_2),
+#endif
+
+#ifdef DIAG_INTERFACE
+    // Interface number, string index, EP Out & EP In address, EP size
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_DIAG, STRID_DIAG, EPNUM_DIAG_OUT, EPNUM_DIAG_IN, 64),
+#endif
+
+#ifdef MIDI_PASSTHROUGH
+    // Interface number, string index, EP Out & EP In address, EP size
+    TUD_MIDI_DESCRIPTOR(ITF_NUM_MIDI, STRID_MIDI, EPNUM_MIDI_OUT, EPNUM_MIDI_IN, 64),
+#if NUM_JOYSTICKS > 1
+    TUD_MIDI_DESCRIPTOR(ITF_NUM_MIDI_2, STRID_MIDI, EPNUM_MIDI_OUT_2, EPNUM_MIDI_IN_2, 64),
+#endif
+#endif
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -152,14 +191,6 @@ uint8_t const * tud_descriptor_configuration_cb(uint8_t index)
 // String Descriptors
 //--------------------------------------------------------------------+
 
-// String Descriptor Index
-enum {
-    STRID_LANGID = 0,
-    STRID_MANUFACTURER,
-    STRID_PRODUCT,
-    STRID_SERIAL,
-};
-
 // array of pointer to string descriptors
 char const *string_desc_arr[] =
 {
@@ -167,6 +198,8 @@ char const *string_desc_arr[] =
     "Nolbinsoft",                  // 1: Manufacturer
     "Picowinder",                  // 2: Product
     NULL,                          // 3: Serials will use unique ID if possible
+    "Picowinder Diagnostics",      // 4: Diagnostics interface
+    "Picowinder Stick MIDI",       // 5: MIDI passthrough interfaces
 };
 
 // Invoked when received GET STRING DESCRIPTOR request
@@ -5,7 +5,11 @@
 #include "device/usbd.h"
 
 #include "hid_pid.h"
+#include "usb_report_ids.h"
 #include "config.h"
+#include "effect_pool.h"
+#include "axis_filter.h"
+#include "custom_force.h"
 
 #define HID_UNIT_SECONDS 0x1003 // Documented as "Eng Lin:Time" in the PID spec
 
@@ -28,6 +32,23 @@
         HID_INPUT(HID_CONSTANT | HID_ARRAY | HID_ABSOLUTE)
 #endif
 
+#ifdef HIGH_RES_AXES
+    // Filtered and scaled up to 16 bits (see axis_filter.h)
+    #define AXIS_LOGICAL_MAX HID_LOGICAL_MAX_N(0xffff, 3)
+    #define AXIS_SIZE 16
+
+    // don't need any padding in this case
+    #define AXIS_PADDING HID_REPORT_COUNT(1)
+#else
+    #define AXIS_LOGICAL_MAX HID_LOGICAL_MAX_N(1023, 2)
+    #define AXIS_SIZE 10
+
+    #define AXIS_PADDING \
+        HID_REPORT_COUNT(1), \
+        HID_REPORT_SIZE(6), \
+        HID_INPUT(HID_CONSTANT | HID_ARRAY | HID_ABSOLUTE)
+#endif
+
 #define SIDEWINDER_REPORT_DESC_INPUT_JOYSTICK(...) \
     HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
     HID_USAGE(HID_USAGE_DESKTOP_JOYSTICK), \
@@ -45,25 +66,21 @@
             BUTTON_PADDING, \
             \
         HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
-            /* X and Y are both reported as unsigned 10-bit */ \
+            /* X and Y are both reported as unsigned 10-bit (or 16-bit with HIGH_RES_AXES) */ \
             HID_LOGICAL_MIN(0), \
-            HID_LOGICAL_MAX_N(1023, 2), \
-            /* X: 10 data bits, 6 padding bits */ \
+            AXIS_LOGICAL_MAX, \
+            /* X: 10 data bits, 6 padding bits (or 16 data bits) */ \
             HID_REPORT_COUNT(1), \
-            HID_REPORT_SIZE(10), \
+            HID_REPORT_SIZE(AXIS_SIZE), \
             HID_USAGE(HID_USAGE_DESKTOP_X), \
             HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+            AXIS_PADDING, \
+            /* Y: 10 data bits, 6 padding bits (or 16 data bits) */ \
             HID_REPORT_COUNT(1), \
-            HID_REPORT_SIZE(6), \
-            HID_INPUT(HID_CONSTANT | HID_ARRAY | HID_ABSOLUTE), \
-            /* Y: 10 data bits, 6 padding bits */ \
-            HID_REPORT_COUNT(1), \
-            HID_REPORT_SIZE(10), \
+            HID_REPORT_SIZE(AXIS_SIZE), \
             HID_USAGE(HID_USAGE_DESKTOP_Y), \
             HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
-            HID_REPORT_COUNT(1), \
-            HID_REPORT_SIZE(6), \
-            HID_INPUT(HID_CONSTANT | HID_ARRAY | HID_ABSOLUTE), \
+            AXIS_PADDING, \
             /* Rz (joystick twist): 6 data bits, 2 padding bits */ \
             HID_LOGICAL_MIN(0), \
             HID_LOGICAL_MAX(63), \
@@ -111,9 +128,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -132,11 +149,12 @@
             HID_USAGE(HID_USAGE_PID_ET_DAMPER), \
             HID_USAGE(HID_USAGE_PID_ET_INERTIA), \
             HID_USAGE(HID_USAGE_PID_ET_FRICTION), \
-            /* Unlike the FF2, ET_CUSTOM_FORCE is not supported here. */ \
+            /* Custom force comes last, so the other types keep their indices; see custom_force.h */ \
+            HID_USAGE(HID_USAGE_PID_ET_CUSTOM_FORCE), \
             HID_LOGICAL_MIN(1), \
-            HID_LOGICAL_MAX(11), \
+            HID_LOGICAL_MAX(12), \
             HID_PHYSICAL_MIN(1), \
-            HID_PHYSICAL_MAX(11), \
+            HID_PHYSICAL_MAX(12), \
             HID_REPORT_SIZE(8), \
             HID_REPORT_COUNT(1), \
             HID_OUTPUT(HID_DATA | HID_ARRAY | HID_ABSOLUTE), \
@@ -253,9 +271,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -304,9 +322,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -361,9 +379,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -430,9 +448,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -463,9 +481,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -484,6 +502,108 @@
     HID_COLLECTION_END
 
 
+/////////////////////////////////////////////////////////////////////
+// Output Report 7: Custom Force Data - download samples for a custom force
+/////////////////////////////////////////////////////////////////////
+
+#define SIDEWINDER_REPORT_DESC_OUTPUT_CUSTOM_FORCE_DATA(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_PID), \
+    HID_USAGE(HID_USAGE_PID_CUSTOM_FORCE_DATA_REPORT), \
+    HID_COLLECTION(HID_COLLECTION_LOGICAL), \
+        /* Report ID */ __VA_ARGS__ \
+        \
+        /* Block Index */ \
+        HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
+        HID_LOGICAL_MIN(1), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
+        HID_PHYSICAL_MIN(1), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
+        HID_REPORT_SIZE(8), \
+        HID_REPORT_COUNT(1), \
+        HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        \
+        /* Custom Force Data Offset: index of the first sample in this report */ \
+        HID_USAGE(HID_USAGE_PID_CUSTOM_FORCE_DATA_OFFSET), \
+        HID_LOGICAL_MIN(0), \
+        HID_LOGICAL_MAX_N(CUSTOM_FORCE_MAX_SAMPLES - 1, 2), \
+        HID_PHYSICAL_MIN(0), \
+        HID_PHYSICAL_MAX_N(CUSTOM_FORCE_MAX_SAMPLES - 1, 2), \
+        HID_REPORT_SIZE(16), \
+        HID_REPORT_COUNT(1), \
+        HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        \
+        /* Custom Force Data: one force sample per byte */ \
+        HID_USAGE(HID_USAGE_PID_CUSTOM_FORCE_DATA), \
+        HID_LOGICAL_MIN(-127), \
+        HID_LOGICAL_MAX(127), \
+        HID_PHYSICAL_MIN_N(-10000, 2), \
+        HID_PHYSICAL_MAX_N(10000, 2), \
+        HID_REPORT_SIZE(8), \
+        HID_REPORT_COUNT(CUSTOM_FORCE_DATA_SIZE), \
+        HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        \
+    HID_COLLECTION_END
+
+
+/////////////////////////////////////////////////////////////////////
+// Output Report 8: Download Force Sample - stream one sample at a time
+/////////////////////////////////////////////////////////////////////
+
+#define SIDEWINDER_REPORT_DESC_OUTPUT_DOWNLOAD_FORCE_SAMPLE(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_PID), \
+    HID_USAGE(HID_USAGE_PID_DOWNLOAD_FORCE_SAMPLE), \
+    HID_COLLECTION(HID_COLLECTION_LOGICAL), \
+        /* Report ID */ __VA_ARGS__ \
+        \
+        /* X and Y samples */ \
+        HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
+        HID_USAGE(HID_USAGE_DESKTOP_X), \
+        HID_USAGE(HID_USAGE_DESKTOP_Y), \
+        HID_LOGICAL_MIN(-127), \
+        HID_LOGICAL_MAX(127), \
+        HID_PHYSICAL_MIN_N(-10000, 2), \
+        HID_PHYSICAL_MAX_N(10000, 2), \
+        HID_REPORT_SIZE(8), \
+        HID_REPORT_COUNT(2), \
+        HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        HID_USAGE_PAGE(HID_USAGE_PAGE_PID), \
+        \
+    HID_COLLECTION_END
+
+
+/////////////////////////////////////////////////////////////////////
+// Output Report 9: Set Custom Force - how many samples a custom force has
+/////////////////////////////////////////////////////////////////////
+
+#define SIDEWINDER_REPORT_DESC_OUTPUT_SET_CUSTOM_FORCE(...) \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_PID), \
+    HID_USAGE(HID_USAGE_PID_SET_CUSTOM_FORCE_REPORT), \
+    HID_COLLECTION(HID_COLLECTION_LOGICAL), \
+        /* Report ID */ __VA_ARGS__ \
+        \
+        /* Block Index */ \
+        HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
+        HID_LOGICAL_MIN(1), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
+        HID_PHYSICAL_MIN(1), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
+        HID_REPORT_SIZE(8), \
+        HID_REPORT_COUNT(1), \
+        HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        \
+        /* Sample Count */ \
+        HID_USAGE(HID_USAGE_PID_SAMPLE_COUNT), \
+        HID_LOGICAL_MIN(0), \
+        HID_LOGICAL_MAX_N(CUSTOM_FORCE_MAX_SAMPLES, 2), \
+        HID_PHYSICAL_MIN(0), \
+        HID_PHYSICAL_MAX_N(CUSTOM_FORCE_MAX_SAMPLES, 2), \
+        HID_REPORT_SIZE(16), \
+        HID_REPORT_COUNT(1), \
+        HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        \
+    HID_COLLECTION_END
+
+
 /////////////////////////////////////////////////////////////////////
 // Output Report 10: Effect Operation - stop/start effects
 /////////////////////////////////////////////////////////////////////
@@ -497,9 +617,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -541,9 +661,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -622,17 +742,18 @@
             HID_USAGE(HID_USAGE_PID_ET_DAMPER), \
             HID_USAGE(HID_USAGE_PID_ET_INERTIA), \
             HID_USAGE(HID_USAGE_PID_ET_FRICTION), \
-            /* Unlike the FF2, ET_CUSTOM_FORCE is not supported here. */ \
+            /* Custom force comes last, so the other types keep their indices; see custom_force.h */ \
+            HID_USAGE(HID_USAGE_PID_ET_CUSTOM_FORCE), \
             HID_LOGICAL_MIN(1), \
-            HID_LOGICAL_MAX(11), \
+            HID_LOGICAL_MAX(12), \
             HID_PHYSICAL_MIN(1), \
-            HID_PHYSICAL_MAX(11), \
+            HID_PHYSICAL_MAX(12), \
             HID_REPORT_SIZE(8), \
             HID_REPORT_COUNT(1), \
             HID_FEATURE(HID_DATA | HID_ARRAY | HID_ABSOLUTE), \
         HID_COLLECTION_END, \
         \
-        /* Byte Count from FF2 descriptor omitted, since we don't support custom forces. */ \
+        /* Byte Count from FF2 descriptor omitted: custom forces get a fixed-size sample buffer. */ \
         \
     HID_COLLECTION_END
 
@@ -650,9 +771,9 @@
         /* Block Index */ \
         HID_USAGE(HID_USAGE_PID_EFFECT_PARAM_BLOCK_INDEX), \
         HID_LOGICAL_MIN(1), \
-        HID_LOGICAL_MAX(40), \
+        HID_LOGICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_PHYSICAL_MIN(1), \
-        HID_PHYSICAL_MAX(40), \
+        HID_PHYSICAL_MAX(VIRTUAL_EFFECT_COUNT), \
         HID_REPORT_SIZE(8), \
         HID_REPORT_COUNT(1), \
         HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
@@ -729,4 +850,70 @@
         \
     HID_COLLECTION_END
 
-#endif // USB_DESCRIPTORS_H
\ No newline at end of file
+
+/////////////////////////////////////////////////////////////////////
+// Feature Report (vendor-defined): Axis Filter - select the X/Y filter
+/////////////////////////////////////////////////////////////////////
+
+#define SIDEWINDER_REPORT_DESC_FEATURE_AXIS_FILTER(...) \
+    HID_USAGE_PAGE_N(HID_USAGE_PAGE_VENDOR, 2), \
+    HID_USAGE(0x01), \
+    HID_COLLECTION(HID_COLLECTION_LOGICAL), \
+        /* Report ID */ __VA_ARGS__ \
+        \
+        /* Filter mode; see enum AxisFilterMode */ \
+        HID_USAGE(0x01), \
+        HID_LOGICAL_MIN(0), \
+        HID_LOGICAL_MAX(AXIS_FILTER_NUM_MODES - 1), \
+        HID_REPORT_SIZE(8), \
+        HID_REPORT_COUNT(1), \
+        HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+        \
+    HID_COLLECTION_END
+
+
+/////////////////////////////////////////////////////////////////////
+// The whole report descriptor, one per stick. A macro so the host tools
+// can build it too (see tools/uhid_loopback.c).
+/////////////////////////////////////////////////////////////////////
+
+/*
+    Note: hid-pidff.c in the Linux kernel will "oops" due to a null-pointer deref
+    if any of its "optional" reports are not present. These include:
+    Set Envelope, Set Condition, Set Periodic, Set Constant, Set Ramp.
+*/
+
+// Windows expects all of the I/O/F reports to be wrapped in an application collection;
+// otherwise, the device won't be registered as capable of force-feedback.
+// Linux is fine either way.
+#define SIDEWINDER_REPORT_DESC \
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP), \
+    HID_USAGE(HID_USAGE_DESKTOP_JOYSTICK), \
+    HID_COLLECTION(HID_COLLECTION_APPLICATION), \
+    \
+    /* Input Reports */ \
+    SIDEWINDER_REPORT_DESC_INPUT_JOYSTICK               (HID_REPORT_ID(REPORT_ID_INPUT_JOYSTICK)), \
+    /* Output Reports */ \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_EFFECT            (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_EFFECT)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_ENVELOPE          (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_ENVELOPE)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_CONDITION         (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_CONDITION)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_PERIODIC          (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_PERIODIC)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_CONSTANT          (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_CONSTANT)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_RAMP              (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_RAMP)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_CUSTOM_FORCE_DATA     (HID_REPORT_ID(REPORT_ID_OUTPUT_CUSTOM_FORCE_DATA)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_DOWNLOAD_FORCE_SAMPLE (HID_REPORT_ID(REPORT_ID_OUTPUT_DOWNLOAD_FORCE_SAMPLE)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_SET_CUSTOM_FORCE      (HID_REPORT_ID(REPORT_ID_OUTPUT_SET_CUSTOM_FORCE)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_EFFECT_OPERATION      (HID_REPORT_ID(REPORT_ID_OUTPUT_EFFECT_OPERATION)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_BLOCK_FREE            (HID_REPORT_ID(REPORT_ID_OUTPUT_BLOCK_FREE)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_DEVICE_CONTROL        (HID_REPORT_ID(REPORT_ID_OUTPUT_DEVICE_CONTROL)), \
+    SIDEWINDER_REPORT_DESC_OUTPUT_DEVICE_GAIN           (HID_REPORT_ID(REPORT_ID_OUTPUT_DEVICE_GAIN)), \
+    /* Feature Reports */ \
+    SIDEWINDER_REPORT_DESC_FEATURE_CREATE_NEW_EFFECT    (HID_REPORT_ID(REPORT_ID_FEATURE_CREATE_NEW_EFFECT)), \
+    SIDEWINDER_REPORT_DESC_FEATURE_BLOCK_LOAD           (HID_REPORT_ID(REPORT_ID_FEATURE_BLOCK_LOAD)), \
+    SIDEWINDER_REPORT_DESC_FEATURE_POOL_REPORT          (HID_REPORT_ID(REPORT_ID_FEATURE_POOL_REPORT)), \
+    /* Vendor-defined Feature Reports */ \
+    SIDEWINDER_REPORT_DESC_FEATURE_AXIS_FILTER          (HID_REPORT_ID(REPORT_ID_FEATURE_AXIS_FILTER)), \
+    \
+    HID_COLLECTION_END
+
+#endif // USB_DESCRIPTORS_H
@@ -18,5 +18,10 @@
 #define REPORT_ID_FEATURE_CREATE_NEW_EFFECT 12
 #define REPORT_ID_FEATURE_BLOCK_LOAD        13
 #define REPORT_ID_FEATURE_POOL_REPORT       14
+#define REPORT_ID_FEATURE_AXIS_FILTER       15
+
+#define REPORT_ID_OUTPUT_CUSTOM_FORCE_DATA      16
+#define REPORT_ID_OUTPUT_DOWNLOAD_FORCE_SAMPLE  17
+#define REPORT_ID_OUTPUT_SET_CUSTOM_FORCE       18
 
 #endif // USB_REPORT_IDS_H
\ No newline at end of file